@@ -0,0 +1,50 @@
+# Generates a header with every shader in SHADER_DIR embedded as constexpr
+# string tables, one per GLSL dialect, with the version header already
+# prepended so Shader can compile them without touching the filesystem.
+#
+# Usage: cmake -DSHADER_DIR=<dir> -DOUTPUT=<header> -P EmbedShaders.cmake
+
+get_filename_component(SHADER_DIR ${SHADER_DIR} ABSOLUTE)
+file(GLOB shader_files LIST_DIRECTORIES false RELATIVE ${SHADER_DIR} ${SHADER_DIR}/*)
+list(SORT shader_files)
+
+# keep in sync with the fallback headers in shader.h
+set(es_version "#version 300 es\nprecision highp float;\n")
+set(core_version "#version 330 core\n")
+
+set(es_entries "")
+set(core_entries "")
+foreach(name ${shader_files})
+    file(READ ${SHADER_DIR}/${name} source)
+    string(FIND "${source}" ")SHADER\"" clash)
+    if(NOT clash EQUAL -1)
+        message(FATAL_ERROR "EmbedShaders: ${name} contains the raw string delimiter")
+    endif()
+    string(APPEND es_entries "    {\"res/shaders/${name}\", R\"SHADER(${es_version}${source})SHADER\"},\n")
+    string(APPEND core_entries "    {\"res/shaders/${name}\", R\"SHADER(${core_version}${source})SHADER\"},\n")
+endforeach()
+
+set(content "// Generated by cmake/EmbedShaders.cmake from src/res/shaders. Do not edit.
+#ifndef EMBEDDED_SHADERS_H
+#define EMBEDDED_SHADERS_H
+
+struct EmbeddedShader
+{
+    const char *path;
+    const char *source;
+};
+
+#ifdef __EMSCRIPTEN__
+constexpr EmbeddedShader embeddedShaders[] = {
+${es_entries}};
+#else
+constexpr EmbeddedShader embeddedShaders[] = {
+${core_entries}};
+#endif
+#endif
+")
+
+# only touch the header when it changes so unrelated edits don't trigger rebuilds
+file(WRITE ${OUTPUT}.tmp "${content}")
+file(COPY_FILE ${OUTPUT}.tmp ${OUTPUT} ONLY_IF_DIFFERENT)
+file(REMOVE ${OUTPUT}.tmp)
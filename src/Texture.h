@@ -9,6 +9,8 @@
 #include <stb_image.h>
 
 #include "shader.h"
+#include "gl_state.h"
+#include "texture_manager.h"
 
 class Texture
 {
@@ -16,6 +18,8 @@ public:
 	GLuint ID;
 	const char *type;
 	GLuint unit;
+	// Shared, refcounted GL texture owned by the texture manager
+	TextureHandle handle;
 
 	Texture(const char *image, const char *texType, GLuint slot);
 
@@ -0,0 +1,1120 @@
+#ifndef BLOCK_COMPRESS_H
+#define BLOCK_COMPRESS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+// picks up the same SSE2 / wasm simd switches as the ingestion kernels
+#include "pixel_convert.h"
+#include "thread_pool.h"
+
+enum BlockFormat
+{
+    BLOCK_FORMAT_BC1 = 0,
+    BLOCK_FORMAT_BC3,
+    // ETC2 colour blocks in the ETC1-compatible and planar modes
+    BLOCK_FORMAT_ETC2_RGB,
+    // EAC alpha followed by an ETC2 colour block
+    BLOCK_FORMAT_ETC2_RGBA
+};
+
+// Speed against quality; every step costs roughly 2-4x the previous one.
+enum BlockQuality
+{
+    // BC: inset bounding box; ETC: one subblock split, luminance-only fit
+    BLOCK_QUALITY_FAST = 0,
+    // BC: principal axis endpoints, one least squares refinement; ETC:
+    // both splits, exact fit
+    BLOCK_QUALITY_NORMAL,
+    // BC: more refinement, 6-value alpha; ETC: refined base colours and
+    // the planar mode, which suits smooth gradients
+    BLOCK_QUALITY_HIGH
+};
+
+// Real-time 4x4 block encoder for textures made at runtime, producing the
+// same GL formats as cooked KTX2 files. Meant to run on the decode workers;
+// every function is reentrant. Input is 3 or 4 channel pixels in texture
+// row order, blocks come out row by row, the layout glCompressedTexImage2D
+// takes. Partial blocks on the right and top edges repeat the last texel.
+//
+// The BC paths are vectorized where the time goes: block gather, bounding
+// box and selector projection. ETC spends it in the table search, which is
+// scalar but exits early once a table can't win.
+class BlockCompress
+{
+public:
+    static int blockBytes(BlockFormat format)
+    {
+        return format == BLOCK_FORMAT_BC1 || format == BLOCK_FORMAT_ETC2_RGB ? 8 : 16;
+    }
+
+    static size_t compressedSize(BlockFormat format, int width, int height)
+    {
+        return (size_t)((width + 3) / 4) * ((height + 3) / 4) * blockBytes(format);
+    }
+
+    // Encodes block rows [firstRow, firstRow + rows) of the image; out is the
+    // whole image's block data, so bands can be encoded in parallel.
+    static void compress(const uint8_t *pixels, int width, int height, int channels, BlockFormat format, BlockQuality quality,
+                         uint8_t *out, int firstRow = 0, int rows = -1)
+    {
+        int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+        int lastRow = rows < 0 ? blocksY : std::min(blocksY, firstRow + rows);
+        int bytes = blockBytes(format);
+        uint8_t block[64];
+        for (int by = firstRow; by < lastRow; by++)
+            for (int bx = 0; bx < blocksX; bx++)
+            {
+                loadBlock(pixels, width, height, channels, bx, by, block);
+                encodeBlock(block, format, quality, out + ((size_t)by * blocksX + bx) * bytes);
+            }
+    }
+
+    // block is 16 RGBA texels, row by row
+    static void encodeBlock(const uint8_t *block, BlockFormat format, BlockQuality quality, uint8_t *out)
+    {
+        switch (format)
+        {
+        case BLOCK_FORMAT_BC1:
+            encodeBC1(block, quality, out);
+            break;
+        case BLOCK_FORMAT_BC3:
+            encodeBC4(block, quality, out);
+            encodeBC1(block, quality, out + 8);
+            break;
+        case BLOCK_FORMAT_ETC2_RGB:
+            encodeETC(block, quality, out);
+            break;
+        case BLOCK_FORMAT_ETC2_RGBA:
+            encodeEAC(block, quality, out);
+            encodeETC(block, quality, out + 8);
+            break;
+        }
+    }
+
+    // back to 16 RGBA texels, for the benchmark's error figures. Only the
+    // ETC2 modes the encoder writes are decoded, T and H blocks come out
+    // black.
+    static void decodeBlock(const uint8_t *in, BlockFormat format, uint8_t *block)
+    {
+        for (int i = 0; i < 16; i++)
+            block[i * 4 + 3] = 255;
+        switch (format)
+        {
+        case BLOCK_FORMAT_BC1:
+            decodeBC1(in, block);
+            break;
+        case BLOCK_FORMAT_BC3:
+            decodeBC1(in + 8, block);
+            decodeBC4(in, block);
+            break;
+        case BLOCK_FORMAT_ETC2_RGB:
+            decodeETC(in, block);
+            break;
+        case BLOCK_FORMAT_ETC2_RGBA:
+            decodeETC(in + 8, block);
+            decodeEAC(in, block);
+            break;
+        }
+    }
+
+    static const char *formatName(BlockFormat format)
+    {
+        static const char *names[] = {"bc1", "bc3", "etc2 rgb", "etc2 rgba"};
+        return names[format];
+    }
+
+    static const char *qualityName(BlockQuality quality)
+    {
+        static const char *names[] = {"fast", "normal", "high"};
+        return names[quality];
+    }
+
+    static bool parseQuality(const char *setting, BlockQuality &quality)
+    {
+        for (int i = BLOCK_QUALITY_FAST; i <= BLOCK_QUALITY_HIGH; i++)
+            if (strcmp(setting, qualityName((BlockQuality)i)) == 0)
+            {
+                quality = (BlockQuality)i;
+                return true;
+            }
+        std::cout << "[BLOCKS] unknown quality '" << setting << "', expected fast, normal or high" << std::endl;
+        return false;
+    }
+
+    // Throughput and PSNR of every format and quality on a synthetic image
+    // with gradients, edges, grain and an alpha ramp, on one thread and then on
+    // the whole pool.
+    static void benchmark(std::ostream &out = std::cout)
+    {
+#ifdef __EMSCRIPTEN__
+        const int maxSize = 1024;
+#else
+        const int maxSize = 2048;
+#endif
+        int threads = ThreadPool::defaultThreadCount();
+        ThreadPool pool;
+        pool.start(threads);
+        out << "[BLOCKS] kernels: " << PixelConvert::simdName() << ", " << pool.threadCount() << " worker threads" << std::endl;
+        for (int size = 1024; size <= maxSize; size *= 2)
+        {
+            std::vector<uint8_t> src = testImage(size);
+            for (int f = BLOCK_FORMAT_BC1; f <= BLOCK_FORMAT_ETC2_RGBA; f++)
+            {
+                BlockFormat format = (BlockFormat)f;
+                std::vector<uint8_t> blocks(compressedSize(format, size, size));
+                for (int q = BLOCK_QUALITY_FAST; q <= BLOCK_QUALITY_HIGH; q++)
+                {
+                    BlockQuality quality = (BlockQuality)q;
+                    auto start = std::chrono::steady_clock::now();
+                    compress(src.data(), size, size, 4, format, quality, blocks.data());
+                    float ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+                    start = std::chrono::steady_clock::now();
+                    compressParallel(pool, src.data(), size, size, 4, format, quality, blocks.data());
+                    float parallelMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+                    double mpix = (double)size * size / 1e6;
+                    out << "  " << std::setw(5) << size << "^2 " << std::setw(10) << std::left << formatName(format)
+                        << std::setw(7) << qualityName(quality) << std::right
+                        << std::fixed << std::setprecision(1) << std::setw(9) << ms << " ms " << std::setw(8) << mpix / (ms / 1000.0) << " MPix/s"
+                        << std::setw(9) << mpix / (parallelMs / 1000.0) << " MPix/s pooled"
+                        << std::setprecision(2) << "  PSNR " << psnr(src.data(), size, size, format, blocks.data()) << " dB" << std::endl;
+                }
+            }
+        }
+        out << std::defaultfloat;
+    }
+
+private:
+    // ETC1 intensity modifiers {a, b}; pixel index 0..3 selects a, b, -a, -b
+    static constexpr int etcTables[8][2] = {{2, 8}, {5, 17}, {9, 29}, {13, 42}, {18, 60}, {24, 80}, {33, 106}, {47, 183}};
+    // EAC modifiers, indexed by table then pixel index
+    static constexpr int eacTables[16][8] = {
+        {-3, -6, -9, -15, 2, 5, 8, 14}, {-3, -7, -10, -13, 2, 6, 9, 12}, {-2, -5, -8, -13, 1, 4, 7, 12}, {-2, -4, -6, -13, 1, 3, 5, 12},
+        {-3, -6, -8, -12, 2, 5, 7, 11}, {-3, -7, -9, -11, 2, 6, 8, 10}, {-4, -7, -8, -11, 3, 6, 7, 10}, {-3, -5, -8, -11, 2, 4, 7, 10},
+        {-2, -6, -8, -10, 1, 5, 7, 9}, {-2, -5, -8, -10, 1, 4, 7, 9}, {-2, -4, -8, -10, 1, 3, 7, 9}, {-2, -5, -7, -10, 1, 4, 6, 9},
+        {-3, -4, -7, -10, 2, 3, 6, 9}, {-1, -2, -3, -10, 0, 1, 2, 9}, {-4, -6, -8, -9, 3, 5, 7, 8}, {-3, -5, -7, -9, 2, 4, 6, 8}};
+
+    static int clamp255(int value)
+    {
+        return value < 0 ? 0 : value > 255 ? 255 : value;
+    }
+
+    static int square(int value)
+    {
+        return value * value;
+    }
+
+    static void loadBlock(const uint8_t *pixels, int width, int height, int channels, int bx, int by, uint8_t *block)
+    {
+        int x0 = bx * 4, y0 = by * 4;
+        if (channels == 4 && x0 + 4 <= width && y0 + 4 <= height)
+        {
+            for (int y = 0; y < 4; y++)
+                memcpy(block + y * 16, pixels + ((size_t)(y0 + y) * width + x0) * 4, 16);
+            return;
+        }
+        for (int y = 0; y < 4; y++)
+            for (int x = 0; x < 4; x++)
+            {
+                const uint8_t *src = pixels + ((size_t)std::min(y0 + y, height - 1) * width + std::min(x0 + x, width - 1)) * channels;
+                uint8_t *dst = block + (y * 4 + x) * 4;
+                dst[0] = src[0];
+                dst[1] = src[1];
+                dst[2] = src[2];
+                dst[3] = channels == 4 ? src[3] : 255;
+            }
+    }
+
+    // ---- BC1 / BC3 ----------------------------------------------------
+
+    static uint16_t to565(const int *rgb)
+    {
+        return (uint16_t)(((rgb[0] * 31 + 127) / 255) << 11 | ((rgb[1] * 63 + 127) / 255) << 5 | (rgb[2] * 31 + 127) / 255);
+    }
+
+    static void from565(uint16_t color, int *rgb)
+    {
+        int r = color >> 11, g = (color >> 5) & 63, b = color & 31;
+        rgb[0] = r << 3 | r >> 2;
+        rgb[1] = g << 2 | g >> 4;
+        rgb[2] = b << 3 | b >> 2;
+    }
+
+    // the four colours of a c0 > c1 block
+    static void bc1Palette(uint16_t c0, uint16_t c1, int palette[4][3])
+    {
+        from565(c0, palette[0]);
+        from565(c1, palette[1]);
+        for (int c = 0; c < 3; c++)
+        {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+    }
+
+    static void boundingBox(const uint8_t *block, uint8_t *lo, uint8_t *hi)
+    {
+#if defined(PIXEL_CONVERT_SSE2)
+        __m128i r0 = _mm_loadu_si128((const __m128i *)block), r1 = _mm_loadu_si128((const __m128i *)(block + 16));
+        __m128i r2 = _mm_loadu_si128((const __m128i *)(block + 32)), r3 = _mm_loadu_si128((const __m128i *)(block + 48));
+        __m128i mn = _mm_min_epu8(_mm_min_epu8(r0, r1), _mm_min_epu8(r2, r3));
+        __m128i mx = _mm_max_epu8(_mm_max_epu8(r0, r1), _mm_max_epu8(r2, r3));
+        // fold the four texel lanes into one
+        mn = _mm_min_epu8(mn, _mm_srli_si128(mn, 8));
+        mn = _mm_min_epu8(mn, _mm_srli_si128(mn, 4));
+        mx = _mm_max_epu8(mx, _mm_srli_si128(mx, 8));
+        mx = _mm_max_epu8(mx, _mm_srli_si128(mx, 4));
+        uint32_t packedLo = (uint32_t)_mm_cvtsi128_si32(mn), packedHi = (uint32_t)_mm_cvtsi128_si32(mx);
+        memcpy(lo, &packedLo, 4);
+        memcpy(hi, &packedHi, 4);
+#elif defined(PIXEL_CONVERT_WASM_SIMD)
+        v128_t r0 = wasm_v128_load(block), r1 = wasm_v128_load(block + 16);
+        v128_t r2 = wasm_v128_load(block + 32), r3 = wasm_v128_load(block + 48);
+        v128_t mn = wasm_u8x16_min(wasm_u8x16_min(r0, r1), wasm_u8x16_min(r2, r3));
+        v128_t mx = wasm_u8x16_max(wasm_u8x16_max(r0, r1), wasm_u8x16_max(r2, r3));
+        mn = wasm_u8x16_min(mn, wasm_i64x2_shuffle(mn, mn, 1, 0));
+        mn = wasm_u8x16_min(mn, wasm_i32x4_shuffle(mn, mn, 1, 0, 3, 2));
+        mx = wasm_u8x16_max(mx, wasm_i64x2_shuffle(mx, mx, 1, 0));
+        mx = wasm_u8x16_max(mx, wasm_i32x4_shuffle(mx, mx, 1, 0, 3, 2));
+        uint32_t packedLo = (uint32_t)wasm_i32x4_extract_lane(mn, 0), packedHi = (uint32_t)wasm_i32x4_extract_lane(mx, 0);
+        memcpy(lo, &packedLo, 4);
+        memcpy(hi, &packedHi, 4);
+#else
+        for (int c = 0; c < 4; c++)
+        {
+            lo[c] = 255;
+            hi[c] = 0;
+        }
+        for (int i = 0; i < 16; i++)
+            for (int c = 0; c < 4; c++)
+            {
+                lo[c] = std::min(lo[c], block[i * 4 + c]);
+                hi[c] = std::max(hi[c], block[i * 4 + c]);
+            }
+#endif
+    }
+
+    // dot product of every texel's rgb with axis, four texels per step
+    static void dotProducts(const uint8_t *block, const int *axis, int32_t *dots)
+    {
+#if defined(PIXEL_CONVERT_SSE2)
+        const __m128i weights = _mm_setr_epi16((short)axis[0], (short)axis[1], (short)axis[2], 0, (short)axis[0], (short)axis[1], (short)axis[2], 0);
+        const __m128i zero = _mm_setzero_si128();
+        for (int i = 0; i < 4; i++)
+        {
+            __m128i texels = _mm_loadu_si128((const __m128i *)(block + i * 16));
+            // (r g, b a) pairs summed by madd, then the two halves of each texel
+            __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(texels, zero), weights);
+            __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(texels, zero), weights);
+            lo = _mm_add_epi32(lo, _mm_srli_epi64(lo, 32));
+            hi = _mm_add_epi32(hi, _mm_srli_epi64(hi, 32));
+            __m128i sums = _mm_unpacklo_epi64(_mm_shuffle_epi32(lo, _MM_SHUFFLE(3, 1, 2, 0)), _mm_shuffle_epi32(hi, _MM_SHUFFLE(3, 1, 2, 0)));
+            _mm_storeu_si128((__m128i *)(dots + i * 4), sums);
+        }
+#elif defined(PIXEL_CONVERT_WASM_SIMD)
+        const v128_t weights = wasm_i16x8_make((short)axis[0], (short)axis[1], (short)axis[2], 0, (short)axis[0], (short)axis[1], (short)axis[2], 0);
+        for (int i = 0; i < 4; i++)
+        {
+            v128_t texels = wasm_v128_load(block + i * 16);
+            v128_t lo = wasm_i32x4_dot_i16x8(wasm_u16x8_extend_low_u8x16(texels), weights);
+            v128_t hi = wasm_i32x4_dot_i16x8(wasm_u16x8_extend_high_u8x16(texels), weights);
+            lo = wasm_i32x4_add(lo, wasm_u64x2_shr(lo, 32));
+            hi = wasm_i32x4_add(hi, wasm_u64x2_shr(hi, 32));
+            wasm_v128_store(dots + i * 4, wasm_i32x4_shuffle(lo, hi, 0, 2, 4, 6));
+        }
+#else
+        for (int i = 0; i < 16; i++)
+            dots[i] = block[i * 4] * axis[0] + block[i * 4 + 1] * axis[1] + block[i * 4 + 2] * axis[2];
+#endif
+    }
+
+    // selectors from each texel's position along c1 -> c0
+    static uint32_t projectSelectors(const uint8_t *block, const int palette[4][3])
+    {
+        static const int order[4] = {1, 3, 2, 0};
+        int axis[3] = {palette[0][0] - palette[1][0], palette[0][1] - palette[1][1], palette[0][2] - palette[1][2]};
+        int32_t dots[16];
+        dotProducts(block, axis, dots);
+        int start = palette[1][0] * axis[0] + palette[1][1] * axis[1] + palette[1][2] * axis[2];
+        int range = std::max(1, axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+        uint32_t selectors = 0;
+        for (int i = 0; i < 16; i++)
+        {
+            int t = dots[i] - start;
+            int step = t <= 0 ? 0 : std::min(3, (t * 3 + range / 2) / range);
+            selectors |= (uint32_t)order[step] << (i * 2);
+        }
+        return selectors;
+    }
+
+    static uint32_t nearestSelectors(const uint8_t *block, const int palette[4][3], int &error)
+    {
+        uint32_t selectors = 0;
+        error = 0;
+        for (int i = 0; i < 16; i++)
+        {
+            const uint8_t *p = block + i * 4;
+            int best = 0, bestError = INT32_MAX;
+            for (int s = 0; s < 4; s++)
+            {
+                int e = square(p[0] - palette[s][0]) + square(p[1] - palette[s][1]) + square(p[2] - palette[s][2]);
+                if (e < bestError)
+                {
+                    bestError = e;
+                    best = s;
+                }
+            }
+            selectors |= (uint32_t)best << (i * 2);
+            error += bestError;
+        }
+        return selectors;
+    }
+
+    // end points along the colour distribution's principal axis
+    static void principalEndpoints(const uint8_t *block, int *lo, int *hi)
+    {
+        float mean[3] = {0, 0, 0};
+        for (int i = 0; i < 16; i++)
+            for (int c = 0; c < 3; c++)
+                mean[c] += block[i * 4 + c] / 16.0f;
+        float cov[3][3] = {};
+        for (int i = 0; i < 16; i++)
+        {
+            float d[3] = {block[i * 4] - mean[0], block[i * 4 + 1] - mean[1], block[i * 4 + 2] - mean[2]};
+            for (int a = 0; a < 3; a++)
+                for (int b = 0; b < 3; b++)
+                    cov[a][b] += d[a] * d[b];
+        }
+        // power iteration, starting from the channel that varies most
+        int widest = cov[1][1] > cov[0][0] ? 1 : 0;
+        widest = cov[2][2] > cov[widest][widest] ? 2 : widest;
+        float axis[3] = {cov[0][widest], cov[1][widest], cov[2][widest]};
+        for (int iteration = 0; iteration < 4; iteration++)
+        {
+            float next[3];
+            for (int a = 0; a < 3; a++)
+                next[a] = cov[a][0] * axis[0] + cov[a][1] * axis[1] + cov[a][2] * axis[2];
+            float scale = std::max(std::max(std::fabs(next[0]), std::fabs(next[1])), std::fabs(next[2]));
+            if (scale < 1e-6f)
+                break;
+            for (int a = 0; a < 3; a++)
+                axis[a] = next[a] / scale;
+        }
+        float length = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+        if (length < 1e-12f)
+        {
+            for (int c = 0; c < 3; c++)
+                lo[c] = hi[c] = (int)(mean[c] + 0.5f);
+            return;
+        }
+        float tMin = 1e30f, tMax = -1e30f;
+        for (int i = 0; i < 16; i++)
+        {
+            float t = ((block[i * 4] - mean[0]) * axis[0] + (block[i * 4 + 1] - mean[1]) * axis[1] + (block[i * 4 + 2] - mean[2]) * axis[2]) / length;
+            tMin = std::min(tMin, t);
+            tMax = std::max(tMax, t);
+        }
+        // inset like the bounding box, outliers cost less than banding
+        float inset = (tMax - tMin) / 16.0f;
+        for (int c = 0; c < 3; c++)
+        {
+            lo[c] = clamp255((int)std::lround(mean[c] + (tMin + inset) * axis[c]));
+            hi[c] = clamp255((int)std::lround(mean[c] + (tMax - inset) * axis[c]));
+        }
+    }
+
+    // end points that best reproduce the block for the given selectors
+    static bool leastSquaresEndpoints(const uint8_t *block, uint32_t selectors, int *c0, int *c1)
+    {
+        static const float weights[4] = {1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f};
+        float aa = 0, ab = 0, bb = 0, ap[3] = {}, bp[3] = {};
+        for (int i = 0; i < 16; i++)
+        {
+            float w = weights[(selectors >> (i * 2)) & 3];
+            aa += w * w;
+            ab += w * (1 - w);
+            bb += (1 - w) * (1 - w);
+            for (int c = 0; c < 3; c++)
+            {
+                ap[c] += w * block[i * 4 + c];
+                bp[c] += (1 - w) * block[i * 4 + c];
+            }
+        }
+        float det = aa * bb - ab * ab;
+        if (std::fabs(det) < 1e-6f)
+            return false;
+        for (int c = 0; c < 3; c++)
+        {
+            c0[c] = clamp255((int)std::lround((ap[c] * bb - bp[c] * ab) / det));
+            c1[c] = clamp255((int)std::lround((bp[c] * aa - ap[c] * ab) / det));
+        }
+        return true;
+    }
+
+    // Always a four colour block: c0 > c1, or equal with every selector 0,
+    // which decodes the same in BC1 and in BC3's colour half.
+    static void encodeBC1(const uint8_t *block, BlockQuality quality, uint8_t *out)
+    {
+        int lo[3], hi[3];
+        if (quality == BLOCK_QUALITY_FAST)
+        {
+            // pulled in by 1/16 of the range, which lowers the average error
+            uint8_t boxLo[4], boxHi[4];
+            boundingBox(block, boxLo, boxHi);
+            for (int c = 0; c < 3; c++)
+            {
+                int inset = (boxHi[c] - boxLo[c]) >> 4;
+                lo[c] = boxLo[c] + inset;
+                hi[c] = boxHi[c] - inset;
+            }
+        }
+        else
+            principalEndpoints(block, lo, hi);
+
+        uint16_t c0 = to565(hi), c1 = to565(lo);
+        uint32_t selectors = 0;
+        if (c0 < c1)
+            std::swap(c0, c1);
+        if (c0 != c1)
+        {
+            int palette[4][3];
+            bc1Palette(c0, c1, palette);
+            if (quality == BLOCK_QUALITY_FAST)
+                selectors = projectSelectors(block, palette);
+            else
+            {
+                int error = 0;
+                selectors = nearestSelectors(block, palette, error);
+                int iterations = quality == BLOCK_QUALITY_HIGH ? 4 : 1;
+                for (int iteration = 0; iteration < iterations && error > 0; iteration++)
+                {
+                    int a[3], b[3];
+                    if (!leastSquaresEndpoints(block, selectors, a, b))
+                        break;
+                    uint16_t n0 = to565(a), n1 = to565(b);
+                    if (n0 < n1)
+                        std::swap(n0, n1);
+                    if (n0 == n1 || (n0 == c0 && n1 == c1))
+                        break;
+                    int trial[4][3], trialError = 0;
+                    bc1Palette(n0, n1, trial);
+                    uint32_t trialSelectors = nearestSelectors(block, trial, trialError);
+                    if (trialError >= error)
+                        break;
+                    c0 = n0;
+                    c1 = n1;
+                    selectors = trialSelectors;
+                    error = trialError;
+                }
+            }
+        }
+        out[0] = (uint8_t)c0;
+        out[1] = (uint8_t)(c0 >> 8);
+        out[2] = (uint8_t)c1;
+        out[3] = (uint8_t)(c1 >> 8);
+        for (int i = 0; i < 4; i++)
+            out[4 + i] = (uint8_t)(selectors >> (i * 8));
+    }
+
+    static void bc4Palette(int a0, int a1, int *palette)
+    {
+        palette[0] = a0;
+        palette[1] = a1;
+        if (a0 > a1)
+            for (int i = 2; i < 8; i++)
+                palette[i] = ((8 - i) * a0 + (i - 1) * a1) / 7;
+        else
+        {
+            for (int i = 2; i < 6; i++)
+                palette[i] = ((6 - i) * a0 + (i - 1) * a1) / 5;
+            palette[6] = 0;
+            palette[7] = 255;
+        }
+    }
+
+    static uint64_t bc4Nearest(const uint8_t *block, const int *palette, int &error)
+    {
+        uint64_t indices = 0;
+        error = 0;
+        for (int i = 0; i < 16; i++)
+        {
+            int alpha = block[i * 4 + 3], best = 0, bestError = INT32_MAX;
+            for (int s = 0; s < 8; s++)
+                if (square(alpha - palette[s]) < bestError)
+                {
+                    bestError = square(alpha - palette[s]);
+                    best = s;
+                }
+            indices |= (uint64_t)best << (i * 3);
+            error += bestError;
+        }
+        return indices;
+    }
+
+    // BC3's alpha half
+    static void encodeBC4(const uint8_t *block, BlockQuality quality, uint8_t *out)
+    {
+        int lo = 255, hi = 0;
+        for (int i = 0; i < 16; i++)
+        {
+            lo = std::min(lo, (int)block[i * 4 + 3]);
+            hi = std::max(hi, (int)block[i * 4 + 3]);
+        }
+        int a0 = hi, a1 = lo;
+        uint64_t indices = 0;
+        if (hi > lo)
+        {
+            // evenly spaced, so rounding the position is the nearest value
+            int range = hi - lo;
+            for (int i = 0; i < 16; i++)
+            {
+                int step = ((block[i * 4 + 3] - lo) * 14 + range) / (2 * range);
+                indices |= (uint64_t)(step == 7 ? 0 : step == 0 ? 1 : 8 - step) << (i * 3);
+            }
+            // blocks with fully opaque or clear texels may do better with
+            // the 6-value mode, which stores 0 and 255 exactly
+            if (quality == BLOCK_QUALITY_HIGH && (lo == 0 || hi == 255))
+            {
+                int innerLo = 255, innerHi = 0;
+                for (int i = 0; i < 16; i++)
+                {
+                    int alpha = block[i * 4 + 3];
+                    if (alpha != 0 && alpha != 255)
+                    {
+                        innerLo = std::min(innerLo, alpha);
+                        innerHi = std::max(innerHi, alpha);
+                    }
+                }
+                if (innerLo > innerHi)
+                    innerLo = innerHi = lo == 0 ? 0 : 255;
+                int palette[8], error = 0, sixError = 0;
+                bc4Palette(a0, a1, palette);
+                bc4Nearest(block, palette, error);
+                bc4Palette(innerLo, innerHi, palette);
+                uint64_t six = bc4Nearest(block, palette, sixError);
+                if (sixError < error)
+                {
+                    a0 = innerLo;
+                    a1 = innerHi;
+                    indices = six;
+                }
+            }
+        }
+        out[0] = (uint8_t)a0;
+        out[1] = (uint8_t)a1;
+        for (int i = 0; i < 6; i++)
+            out[2 + i] = (uint8_t)(indices >> (i * 8));
+    }
+
+    static void decodeBC1(const uint8_t *in, uint8_t *block)
+    {
+        uint16_t c0 = (uint16_t)(in[0] | in[1] << 8), c1 = (uint16_t)(in[2] | in[3] << 8);
+        uint32_t selectors = (uint32_t)in[4] | (uint32_t)in[5] << 8 | (uint32_t)in[6] << 16 | (uint32_t)in[7] << 24;
+        int palette[4][3];
+        bc1Palette(c0, c1, palette);
+        bool transparent = c0 <= c1;
+        if (transparent)
+            for (int c = 0; c < 3; c++)
+            {
+                palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+                palette[3][c] = 0;
+            }
+        for (int i = 0; i < 16; i++)
+        {
+            int s = (selectors >> (i * 2)) & 3;
+            for (int c = 0; c < 3; c++)
+                block[i * 4 + c] = (uint8_t)palette[s][c];
+            if (transparent && s == 3)
+                block[i * 4 + 3] = 0;
+        }
+    }
+
+    static void decodeBC4(const uint8_t *in, uint8_t *block)
+    {
+        int palette[8];
+        bc4Palette(in[0], in[1], palette);
+        uint64_t indices = 0;
+        for (int i = 0; i < 6; i++)
+            indices |= (uint64_t)in[2 + i] << (i * 8);
+        for (int i = 0; i < 16; i++)
+            block[i * 4 + 3] = (uint8_t)palette[(indices >> (i * 3)) & 7];
+    }
+
+    // ---- ETC2 -----------------------------------------------------------
+    // Blocks are big endian 64-bit words and number their texels column by
+    // column (x * 4 + y), unlike the row order of the block buffer.
+
+    static void storeBigEndian(uint64_t bits, uint8_t *out)
+    {
+        for (int i = 0; i < 8; i++)
+            out[i] = (uint8_t)(bits >> (56 - i * 8));
+    }
+
+    static uint64_t loadBigEndian(const uint8_t *in)
+    {
+        uint64_t bits = 0;
+        for (int i = 0; i < 8; i++)
+            bits = bits << 8 | in[i];
+        return bits;
+    }
+
+    static int expand4(int value)
+    {
+        return value << 4 | value;
+    }
+
+    static int expand5(int value)
+    {
+        return value << 3 | value >> 2;
+    }
+
+    // block buffer index of the i-th texel of a subblock: the left and right
+    // halves without flip, the first and last two rows with it
+    static int subblockTexel(int subblock, bool flip, int i)
+    {
+        return flip ? (subblock * 2 + i / 4) * 4 + i % 4 : (i / 2) * 4 + subblock * 2 + i % 2;
+    }
+
+    // Best table and modifier per texel around `base`. The fast fit picks
+    // modifiers from the mean channel difference, ignoring clamping.
+    static int fitSubblock(const uint8_t *block, int subblock, bool flip, const int *base, bool exact, int &table, int *indices, int bound)
+    {
+        int texels[8][3], offsets[8];
+        for (int i = 0; i < 8; i++)
+        {
+            const uint8_t *p = block + subblockTexel(subblock, flip, i) * 4;
+            for (int c = 0; c < 3; c++)
+                texels[i][c] = p[c];
+            offsets[i] = p[0] + p[1] + p[2] - base[0] - base[1] - base[2];
+        }
+        int best = bound;
+        for (int t = 0; t < 8; t++)
+        {
+            const int modifiers[4] = {etcTables[t][0], etcTables[t][1], -etcTables[t][0], -etcTables[t][1]};
+            // halfway between a and b, over three channels
+            const int threshold = 3 * (etcTables[t][0] + etcTables[t][1]) / 2;
+            int error = 0, trial[8];
+            for (int i = 0; i < 8 && error < best; i++)
+            {
+                const int *p = texels[i];
+                int chosen = 0, chosenError = INT32_MAX;
+                if (exact)
+                {
+                    for (int m = 0; m < 4; m++)
+                    {
+                        int e = square(clamp255(base[0] + modifiers[m]) - p[0]) + square(clamp255(base[1] + modifiers[m]) - p[1]) +
+                                square(clamp255(base[2] + modifiers[m]) - p[2]);
+                        if (e < chosenError)
+                        {
+                            chosenError = e;
+                            chosen = m;
+                        }
+                    }
+                }
+                else
+                {
+                    chosen = (offsets[i] < 0 ? 2 : 0) + (std::abs(offsets[i]) > threshold ? 1 : 0);
+                    chosenError = square(clamp255(base[0] + modifiers[chosen]) - p[0]) + square(clamp255(base[1] + modifiers[chosen]) - p[1]) +
+                                  square(clamp255(base[2] + modifiers[chosen]) - p[2]);
+                }
+                trial[i] = chosen;
+                error += chosenError;
+            }
+            if (error < best)
+            {
+                best = error;
+                table = t;
+                std::copy(trial, trial + 8, indices);
+            }
+        }
+        return best;
+    }
+
+    // One ETC1-compatible block for the given subblock colours: differential
+    // when the 5-bit colours are close enough, individual 4-bit otherwise.
+    // Differential blocks never overflow, so ETC2 decoders don't read them
+    // as T, H or planar blocks.
+    static int encodeETCColors(const uint8_t *block, bool flip, const float colors[2][3], bool exact, uint64_t &bits)
+    {
+        int q[2][3], base[2][3];
+        bool differential = true;
+        for (int s = 0; s < 2; s++)
+            for (int c = 0; c < 3; c++)
+                q[s][c] = std::min(31, std::max(0, (int)std::lround(colors[s][c] * 31.0f / 255.0f)));
+        for (int c = 0; c < 3; c++)
+            differential = differential && q[1][c] - q[0][c] >= -4 && q[1][c] - q[0][c] <= 3;
+        for (int s = 0; s < 2; s++)
+            for (int c = 0; c < 3; c++)
+            {
+                if (!differential)
+                    q[s][c] = std::min(15, std::max(0, (int)std::lround(colors[s][c] * 15.0f / 255.0f)));
+                base[s][c] = differential ? expand5(q[s][c]) : expand4(q[s][c]);
+            }
+
+        int tables[2] = {0, 0}, indices[2][8] = {}, error = 0;
+        for (int s = 0; s < 2; s++)
+            error += fitSubblock(block, s, flip, base[s], exact, tables[s], indices[s], INT32_MAX);
+
+        bits = 0;
+        for (int c = 0; c < 3; c++)
+        {
+            int shift = 59 - c * 8;
+            if (differential)
+                bits |= (uint64_t)q[0][c] << shift | (uint64_t)((q[1][c] - q[0][c]) & 7) << (shift - 3);
+            else
+                bits |= (uint64_t)q[0][c] << (shift + 1) | (uint64_t)q[1][c] << (shift - 3);
+        }
+        bits |= (uint64_t)tables[0] << 37 | (uint64_t)tables[1] << 34 | (uint64_t)differential << 33 | (uint64_t)flip << 32;
+        for (int s = 0; s < 2; s++)
+            for (int i = 0; i < 8; i++)
+            {
+                int texel = subblockTexel(s, flip, i), p = (texel % 4) * 4 + texel / 4;
+                bits |= (uint64_t)(indices[s][i] >> 1) << (16 + p) | (uint64_t)(indices[s][i] & 1) << p;
+            }
+        return error;
+    }
+
+    static void subblockMeans(const uint8_t *block, bool flip, float colors[2][3])
+    {
+        for (int s = 0; s < 2; s++)
+            for (int c = 0; c < 3; c++)
+            {
+                colors[s][c] = 0;
+                for (int i = 0; i < 8; i++)
+                    colors[s][c] += block[subblockTexel(s, flip, i) * 4 + c] / 8.0f;
+            }
+    }
+
+    static float splitVariance(const uint8_t *block, bool flip, const float colors[2][3])
+    {
+        float variance = 0;
+        for (int s = 0; s < 2; s++)
+            for (int i = 0; i < 8; i++)
+                for (int c = 0; c < 3; c++)
+                {
+                    float d = block[subblockTexel(s, flip, i) * 4 + c] - colors[s][c];
+                    variance += d * d;
+                }
+        return variance;
+    }
+
+    // texel colours of a planar block, O + x (H - O) / 4 + y (V - O) / 4
+    static void planarColors(const int *o, const int *h, const int *v, uint8_t *block)
+    {
+        for (int y = 0; y < 4; y++)
+            for (int x = 0; x < 4; x++)
+                for (int c = 0; c < 3; c++)
+                    block[(y * 4 + x) * 4 + c] = (uint8_t)clamp255((x * (h[c] - o[c]) + y * (v[c] - o[c]) + 4 * o[c] + 2) >> 2);
+    }
+
+    static int expandPlanar(int value, int bits)
+    {
+        return bits == 6 ? (value << 2 | value >> 4) : (value << 1 | value >> 6);
+    }
+
+    // ETC2's planar mode: a least squares plane per channel, stored as the
+    // colours at (0, 0), (4, 0) and (0, 4) in 6:7:6 bits
+    static int encodePlanar(const uint8_t *block, uint64_t &bits)
+    {
+        static const int depth[3] = {6, 7, 6};
+        int q[3][3], colors[3][3];
+        for (int c = 0; c < 3; c++)
+        {
+            float mean = 0, dx = 0, dy = 0;
+            for (int y = 0; y < 4; y++)
+                for (int x = 0; x < 4; x++)
+                {
+                    float value = block[(y * 4 + x) * 4 + c];
+                    mean += value / 16.0f;
+                    dx += (x - 1.5f) * value / 20.0f;
+                    dy += (y - 1.5f) * value / 20.0f;
+                }
+            float o = mean - 1.5f * dx - 1.5f * dy;
+            float corner[3] = {o, o + 4.0f * dx, o + 4.0f * dy};
+            int levels = (1 << depth[c]) - 1;
+            for (int k = 0; k < 3; k++)
+            {
+                q[k][c] = std::min(levels, std::max(0, (int)std::lround(corner[k] * levels / 255.0f)));
+                colors[k][c] = expandPlanar(q[k][c], depth[c]);
+            }
+        }
+        uint8_t decoded[64];
+        planarColors(colors[0], colors[1], colors[2], decoded);
+        int error = 0;
+        for (int i = 0; i < 16; i++)
+            for (int c = 0; c < 3; c++)
+                error += square(decoded[i * 4 + c] - block[i * 4 + c]);
+
+        const int *o = q[0], *h = q[1], *v = q[2];
+        bits = (uint64_t)o[0] << 57 | (uint64_t)(o[1] >> 6) << 56 | (uint64_t)(o[1] & 63) << 49 | (uint64_t)(o[2] >> 5) << 48 |
+               (uint64_t)((o[2] >> 3) & 3) << 43 | (uint64_t)(o[2] & 7) << 39 | (uint64_t)(h[0] >> 1) << 34 | (uint64_t)1 << 33 |
+               (uint64_t)(h[0] & 1) << 32 | (uint64_t)h[1] << 25 | (uint64_t)h[2] << 19 | (uint64_t)v[0] << 13 | (uint64_t)v[1] << 6 |
+               (uint64_t)v[2];
+        // the unused bits make the red and green differentials fit and the
+        // blue one overflow, which is what marks a planar block
+        auto field = [&](int shift, int mask)
+        { return (int)((bits >> shift) & mask); };
+        auto signed3 = [](int value)
+        { return value >= 4 ? value - 8 : value; };
+        if (field(59, 15) + signed3(field(56, 7)) < 0)
+            bits |= (uint64_t)1 << 63;
+        if (field(51, 15) + signed3(field(48, 7)) < 0)
+            bits |= (uint64_t)1 << 55;
+        if (field(43, 3) + field(40, 3) >= 4)
+            bits |= (uint64_t)7 << 45;
+        else
+            bits |= (uint64_t)1 << 42;
+        return error;
+    }
+
+    static void encodeETC(const uint8_t *block, BlockQuality quality, uint8_t *out)
+    {
+        float colors[2][2][3];
+        subblockMeans(block, false, colors[0]);
+        subblockMeans(block, true, colors[1]);
+        uint64_t bits = 0;
+        int best = INT32_MAX;
+        for (int flip = 0; flip < 2; flip++)
+        {
+            // fast: only the split whose halves are more uniform
+            if (quality == BLOCK_QUALITY_FAST && flip == (splitVariance(block, true, colors[1]) < splitVariance(block, false, colors[0]) ? 0 : 1))
+                continue;
+            uint64_t trial = 0;
+            int error = encodeETCColors(block, flip == 1, colors[flip], quality != BLOCK_QUALITY_FAST, trial);
+            if (quality == BLOCK_QUALITY_HIGH && error > 0)
+            {
+                // move each base colour to the mean of what its texels want
+                // before the modifiers are added, then fit again
+                uint8_t decoded[64];
+                decodeETC(trial, decoded);
+                float refined[2][3];
+                for (int s = 0; s < 2; s++)
+                    for (int c = 0; c < 3; c++)
+                    {
+                        refined[s][c] = colors[flip][s][c];
+                        for (int i = 0; i < 8; i++)
+                        {
+                            int texel = subblockTexel(s, flip == 1, i) * 4 + c;
+                            refined[s][c] += (block[texel] - decoded[texel]) / 8.0f;
+                        }
+                    }
+                uint64_t second = 0;
+                int secondError = encodeETCColors(block, flip == 1, refined, true, second);
+                if (secondError < error)
+                {
+                    error = secondError;
+                    trial = second;
+                }
+            }
+            if (error < best)
+            {
+                best = error;
+                bits = trial;
+            }
+        }
+        if (quality == BLOCK_QUALITY_HIGH && best > 0)
+        {
+            uint64_t planar = 0;
+            if (encodePlanar(block, planar) < best)
+                bits = planar;
+        }
+        storeBigEndian(bits, out);
+    }
+
+    static void decodeETC(uint64_t bits, uint8_t *block)
+    {
+        int base[2][3];
+        bool flip = (bits >> 32) & 1;
+        if ((bits >> 33) & 1)
+        {
+            int overflow = -1;
+            for (int c = 0; c < 3; c++)
+            {
+                int shift = 59 - c * 8, first = (bits >> shift) & 31, delta = (bits >> (shift - 3)) & 7;
+                int second = first + (delta >= 4 ? delta - 8 : delta);
+                if ((second < 0 || second > 31) && overflow < 0)
+                    overflow = c;
+                base[0][c] = expand5(first);
+                base[1][c] = expand5(second & 31);
+            }
+            if (overflow == 2)
+            {
+                int o[3] = {expandPlanar((bits >> 57) & 63, 6), expandPlanar((int)((bits >> 56) & 1) << 6 | (int)((bits >> 49) & 63), 7),
+                            expandPlanar((int)((bits >> 48) & 1) << 5 | (int)((bits >> 43) & 3) << 3 | (int)((bits >> 39) & 7), 6)};
+                int h[3] = {expandPlanar((int)((bits >> 34) & 31) << 1 | (int)((bits >> 32) & 1), 6), expandPlanar((bits >> 25) & 127, 7),
+                            expandPlanar((bits >> 19) & 63, 6)};
+                int v[3] = {expandPlanar((bits >> 13) & 63, 6), expandPlanar((bits >> 6) & 127, 7), expandPlanar(bits & 63, 6)};
+                planarColors(o, h, v, block);
+                return;
+            }
+            if (overflow >= 0)
+            {
+                for (int i = 0; i < 16; i++)
+                    block[i * 4] = block[i * 4 + 1] = block[i * 4 + 2] = 0;
+                return;
+            }
+        }
+        else
+            for (int c = 0; c < 3; c++)
+            {
+                int shift = 60 - c * 8;
+                base[0][c] = expand4((bits >> shift) & 15);
+                base[1][c] = expand4((bits >> (shift - 4)) & 15);
+            }
+        int tables[2] = {(int)((bits >> 37) & 7), (int)((bits >> 34) & 7)};
+        for (int s = 0; s < 2; s++)
+            for (int i = 0; i < 8; i++)
+            {
+                int texel = subblockTexel(s, flip, i), p = (texel % 4) * 4 + texel / 4;
+                int index = (int)((bits >> (16 + p)) & 1) << 1 | (int)((bits >> p) & 1);
+                int modifier = index & 1 ? etcTables[tables[s]][1] : etcTables[tables[s]][0];
+                if (index & 2)
+                    modifier = -modifier;
+                for (int c = 0; c < 3; c++)
+                    block[texel * 4 + c] = (uint8_t)clamp255(base[s][c] + modifier);
+            }
+    }
+
+    static void decodeETC(const uint8_t *in, uint8_t *block)
+    {
+        decodeETC(loadBigEndian(in), block);
+    }
+
+    static int eacFit(const int *alphas, int base, int multiplier, int table, uint64_t &indices, int bound)
+    {
+        int values[8];
+        for (int s = 0; s < 8; s++)
+            values[s] = clamp255(base + eacTables[table][s] * multiplier);
+        int error = 0;
+        indices = 0;
+        for (int i = 0; i < 16 && error < bound; i++)
+        {
+            int best = 0, bestError = INT32_MAX;
+            for (int s = 0; s < 8; s++)
+                if (square(values[s] - alphas[i]) < bestError)
+                {
+                    bestError = square(values[s] - alphas[i]);
+                    best = s;
+                }
+            int p = (i % 4) * 4 + i / 4;
+            indices |= (uint64_t)best << (45 - p * 3);
+            error += bestError;
+        }
+        return error;
+    }
+
+    // ETC2 RGBA's alpha half. Tables are tried with the multiplier that
+    // spans the block's range; high also tries the neighbouring base values
+    // and multipliers.
+    static void encodeEAC(const uint8_t *block, BlockQuality quality, uint8_t *out)
+    {
+        int lo = 255, hi = 0, alphas[16];
+        for (int i = 0; i < 16; i++)
+        {
+            alphas[i] = block[i * 4 + 3];
+            lo = std::min(lo, alphas[i]);
+            hi = std::max(hi, alphas[i]);
+        }
+        int best = INT32_MAX, bestBase = lo, bestMultiplier = 1, bestTable = 13;
+        uint64_t bestIndices = 0;
+        int reach = quality == BLOCK_QUALITY_HIGH ? 1 : 0;
+        // fast settles for an average error of two steps per texel
+        int goodEnough = quality == BLOCK_QUALITY_FAST ? 64 : 0;
+        for (int t = 0; t < 16 && best > goodEnough; t++)
+        {
+            int span = eacTables[t][7] - eacTables[t][3];
+            int multiplier = std::max(1, std::min(15, (hi - lo + span / 2) / span));
+            int center = (lo + hi + 1) / 2 - (eacTables[t][7] + eacTables[t][3]) * multiplier / 2;
+            for (int m = std::max(1, multiplier - reach); m <= std::min(15, multiplier + reach); m++)
+                for (int b = center - reach; b <= center + reach; b++)
+                {
+                    uint64_t indices = 0;
+                    int error = eacFit(alphas, clamp255(b), m, t, indices, best);
+                    if (error < best)
+                    {
+                        best = error;
+                        bestBase = clamp255(b);
+                        bestMultiplier = m;
+                        bestTable = t;
+                        bestIndices = indices;
+                    }
+                }
+        }
+        storeBigEndian((uint64_t)bestBase << 56 | (uint64_t)bestMultiplier << 52 | (uint64_t)bestTable << 48 | bestIndices, out);
+    }
+
+    static void decodeEAC(const uint8_t *in, uint8_t *block)
+    {
+        uint64_t bits = loadBigEndian(in);
+        int base = (int)(bits >> 56), multiplier = (int)((bits >> 52) & 15), table = (int)((bits >> 48) & 15);
+        for (int i = 0; i < 16; i++)
+        {
+            int p = (i % 4) * 4 + i / 4;
+            block[i * 4 + 3] = (uint8_t)clamp255(base + eacTables[table][(bits >> (45 - p * 3)) & 7] * multiplier);
+        }
+    }
+
+    // ---- benchmark ------------------------------------------------------
+
+    static void compressParallel(ThreadPool &pool, const uint8_t *pixels, int width, int height, int channels, BlockFormat format,
+                                 BlockQuality quality, uint8_t *out)
+    {
+        const int band = 16;
+        int blocksY = (height + 3) / 4;
+        std::atomic<int> remaining{(blocksY + band - 1) / band};
+        for (int row = 0; row < blocksY; row += band)
+            pool.submit([=, &remaining]
+                        {
+                            compress(pixels, width, height, channels, format, quality, out, row, band);
+                            remaining--; });
+        while (remaining.load() > 0)
+            std::this_thread::yield();
+    }
+
+    static std::vector<uint8_t> testImage(int size)
+    {
+        std::vector<uint8_t> pixels((size_t)size * size * 4);
+        for (int y = 0; y < size; y++)
+            for (int x = 0; x < size; x++)
+            {
+                uint8_t *p = &pixels[((size_t)y * size + x) * 4];
+                int noise = (int)((uint32_t)(x * 73856093u ^ y * 19349663u) * 2654435761u >> 27);
+                float u = (float)x / size, v = (float)y / size;
+                p[0] = (uint8_t)(110 + 100 * std::sin(u * 40.0f + v * 7.0f) + noise);
+                p[1] = (uint8_t)(200 * v + noise);
+                p[2] = (uint8_t)(180 * (1 - u) + (x / 64 + y / 64) % 2 * 40 + noise);
+                p[3] = (uint8_t)(255 * std::min(1.0f, 2 * std::fabs(u - 0.5f) + v * 0.3f));
+            }
+        return pixels;
+    }
+
+    // over rgb, plus alpha for the formats that store it
+    static double psnr(const uint8_t *pixels, int width, int height, BlockFormat format, const uint8_t *blocks)
+    {
+        int channels = format == BLOCK_FORMAT_BC3 || format == BLOCK_FORMAT_ETC2_RGBA ? 4 : 3;
+        int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+        double sum = 0;
+        uint8_t block[64], decoded[64];
+        for (int by = 0; by < blocksY; by++)
+            for (int bx = 0; bx < blocksX; bx++)
+            {
+                loadBlock(pixels, width, height, 4, bx, by, block);
+                decodeBlock(blocks + ((size_t)by * blocksX + bx) * blockBytes(format), format, decoded);
+                for (int i = 0; i < 16; i++)
+                    for (int c = 0; c < channels; c++)
+                        sum += square(block[i * 4 + c] - decoded[i * 4 + c]);
+            }
+        double mse = sum / ((double)blocksX * blocksY * 16 * channels);
+        return mse > 0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : 99.0;
+    }
+};
+#endif
@@ -0,0 +1,290 @@
+#ifndef CLUSTERED_LIGHTS_H
+#define CLUSTERED_LIGHTS_H
+
+#ifdef __EMSCRIPTEN__
+#include <GLES3/gl3.h>
+#else
+#include <glad/glad.h>
+#endif
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "frame_stats.h"
+#include "gl_state.h"
+#include "shader.h"
+
+// Uniform block binding point for ClusterBlock, see clustered_lights.glsl
+const unsigned int CLUSTER_BLOCK_BINDING = 1;
+
+struct PointLight
+{
+    glm::vec3 position;
+    // no light reaches past this distance
+    float radius;
+    glm::vec3 color;
+    float intensity;
+};
+
+// Clustered forward shading for many point lights.
+//   - the view frustum is cut into CLUSTERS_X x CLUSTERS_Y screen tiles and
+//     CLUSTERS_Z depth slices, exponentially spaced so clusters stay roughly
+//     cube shaped
+//   - every frame the lights are binned on the cpu: each one only visits the
+//     clusters its sphere's screen and depth bounds touch, then is tested
+//     against their view space boxes
+//   - the lights, the per cluster (first, count) ranges and the flat list
+//     of light ids go up in three data textures, which WebGL2 can sample
+//     as well as desktop GL
+//   - shaders that include clustered_lights.glsl find their cluster from
+//     gl_FragCoord and loop over only its lights
+class ClusteredLights
+{
+public:
+    static const int CLUSTERS_X = 16;
+    static const int CLUSTERS_Y = 9;
+    static const int CLUSTERS_Z = 24;
+    static const int CLUSTER_COUNT = CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z;
+    // 2 texels a light in one row; 2048 is the smallest MAX_TEXTURE_SIZE
+    // WebGL2 allows
+    static const int MAX_LIGHTS = 1024;
+    // light ids are stored this many to a row, see CLUSTER_INDEX_WIDTH
+    static const int INDEX_WIDTH = 1024;
+    static const int MAX_INDICES = INDEX_WIDTH * 64;
+    // texture units the cluster data stays bound to, above the materials'
+    static const int LIGHT_UNIT = 12;
+    static const int GRID_UNIT = 13;
+    static const int INDEX_UNIT = 14;
+
+    // lights past MAX_LIGHTS are ignored
+    std::vector<PointLight> lights;
+
+    ClusteredLights()
+    {
+        glGenTextures(1, &lightTexture);
+        glGenTextures(1, &gridTexture);
+        glGenTextures(1, &indexTexture);
+        createTexture(LIGHT_UNIT, lightTexture, GL_RGBA32F, 2 * MAX_LIGHTS, 1, GL_RGBA, GL_FLOAT);
+        createTexture(GRID_UNIT, gridTexture, GL_RG32UI, CLUSTERS_X * CLUSTERS_Y, CLUSTERS_Z, GL_RG_INTEGER, GL_UNSIGNED_INT);
+        createTexture(INDEX_UNIT, indexTexture, GL_R32UI, INDEX_WIDTH, MAX_INDICES / INDEX_WIDTH, GL_RED_INTEGER, GL_UNSIGNED_INT);
+        glGenBuffers(1, &UBO);
+        glState.bindBuffer(GL_UNIFORM_BUFFER, UBO);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(ClusterUniforms), nullptr, GL_DYNAMIC_DRAW);
+        ranges.resize(CLUSTER_COUNT);
+        counts.resize(CLUSTER_COUNT);
+    }
+
+    ~ClusteredLights()
+    {
+        for (GLuint texture : {lightTexture, gridTexture, indexTexture})
+            glState.forgetTexture(texture);
+        glState.forgetBuffer(UBO);
+        glDeleteTextures(1, &lightTexture);
+        glDeleteTextures(1, &gridTexture);
+        glDeleteTextures(1, &indexTexture);
+        glDeleteBuffers(1, &UBO);
+    }
+
+    ClusteredLights(const ClusteredLights &) = delete;
+    ClusteredLights &operator=(const ClusteredLights &) = delete;
+
+    // points a shader that includes clustered_lights.glsl at the data
+    void attach(const Shader &shader) const
+    {
+        shader.use();
+        shader.setInt("clusterLights", LIGHT_UNIT);
+        shader.setInt("clusterGrid", GRID_UNIT);
+        shader.setInt("clusterIndices", INDEX_UNIT);
+        shader.bindUniformBlock("ClusterBlock", CLUSTER_BLOCK_BINDING);
+    }
+
+    // bins the lights for this view and uploads the result. The projection
+    // must be a symmetric perspective one, as glm::perspective makes; call
+    // with the scene's viewport current.
+    void update(const glm::mat4 &view, const glm::mat4 &projection)
+    {
+        auto start = std::chrono::steady_clock::now();
+        if (projection != clusterProjection)
+            buildClusters(projection);
+
+        // (cluster, light) pairs, then counting sorted into per cluster ranges
+        pairs.clear();
+        int lightCount = std::min((int)lights.size(), MAX_LIGHTS);
+        for (int i = 0; i < lightCount; i++)
+            binLight(view, i);
+        std::fill(counts.begin(), counts.end(), 0u);
+        for (const glm::uvec2 &pair : pairs)
+            counts[pair.x]++;
+        uint32_t first = 0, maxCount = 0;
+        for (int c = 0; c < CLUSTER_COUNT; c++)
+        {
+            // whatever doesn't fit in the index texture is dropped
+            uint32_t count = std::min(counts[c], (uint32_t)MAX_INDICES - first);
+            ranges[c] = glm::uvec2(first, count);
+            counts[c] = first;
+            first += count;
+            maxCount = std::max(maxCount, count);
+        }
+        size_t rows = (first + INDEX_WIDTH - 1) / INDEX_WIDTH;
+        indices.assign(std::max<size_t>(rows, 1) * INDEX_WIDTH, 0u);
+        for (const glm::uvec2 &pair : pairs)
+        {
+            uint32_t &next = counts[pair.x];
+            if (next < ranges[pair.x].x + ranges[pair.x].y)
+                indices[next++] = pair.y;
+        }
+
+        texels.resize(2 * lightCount);
+        for (int i = 0; i < lightCount; i++)
+        {
+            texels[2 * i] = glm::vec4(lights[i].position, lights[i].radius);
+            texels[2 * i + 1] = glm::vec4(lights[i].color, lights[i].intensity);
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        if (lightCount > 0)
+        {
+            glState.bindTexture(LIGHT_UNIT, GL_TEXTURE_2D, lightTexture);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 2 * lightCount, 1, GL_RGBA, GL_FLOAT, texels.data());
+        }
+        glState.bindTexture(GRID_UNIT, GL_TEXTURE_2D, gridTexture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, CLUSTERS_X * CLUSTERS_Y, CLUSTERS_Z, GL_RG_INTEGER, GL_UNSIGNED_INT, ranges.data());
+        glState.bindTexture(INDEX_UNIT, GL_TEXTURE_2D, indexTexture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, INDEX_WIDTH, (GLsizei)(indices.size() / INDEX_WIDTH), GL_RED_INTEGER, GL_UNSIGNED_INT,
+                        indices.data());
+
+        GLint viewport[4] = {0, 0, 1, 1};
+        glState.currentViewport(viewport);
+        ClusterUniforms uniforms;
+        uniforms.counts = glm::ivec4(CLUSTERS_X, CLUSTERS_Y, CLUSTERS_Z, lightCount);
+        uniforms.viewport = glm::vec4((float)viewport[2], (float)viewport[3], nearPlane, farPlane);
+        glState.bindBuffer(GL_UNIFORM_BUFFER, UBO);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(uniforms), &uniforms);
+        glState.bindUniformRange(CLUSTER_BLOCK_BINDING, UBO, 0, sizeof(uniforms));
+
+        frameStats.lights = lightCount;
+        frameStats.lightClusterRefs = first;
+        frameStats.lightMaxPerCluster = maxCount;
+        frameStats.lightBinMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+private:
+    // mirrors `layout (std140) uniform ClusterBlock`
+    struct ClusterUniforms
+    {
+        glm::ivec4 counts;
+        // viewport size, near and far planes
+        glm::vec4 viewport;
+    };
+
+    GLuint lightTexture = 0, gridTexture = 0, indexTexture = 0, UBO = 0;
+    glm::mat4 clusterProjection = glm::mat4(0.0f);
+    float nearPlane = 0.1f, farPlane = 100.0f;
+    // ndc scale of the projection, view x and y times these over depth
+    glm::vec2 focal = glm::vec2(1.0f);
+    // view space boxes, depth along -z as in view space
+    std::vector<glm::vec3> clusterMin, clusterMax;
+    std::vector<glm::uvec2> pairs;
+    std::vector<uint32_t> counts;
+    std::vector<glm::uvec2> ranges;
+    std::vector<uint32_t> indices;
+    std::vector<glm::vec4> texels;
+
+    static void createTexture(int unit, GLuint texture, GLint internalFormat, GLsizei width, GLsizei height, GLenum format, GLenum type)
+    {
+        glState.bindTexture(unit, GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, nullptr);
+        // integer and float32 textures can't be filtered, texelFetch only
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+
+    float sliceDepth(int slice) const
+    {
+        return nearPlane * std::pow(farPlane / nearPlane, (float)slice / CLUSTERS_Z);
+    }
+
+    int slice(float depth) const
+    {
+        int z = (int)(std::log(depth / nearPlane) / std::log(farPlane / nearPlane) * CLUSTERS_Z);
+        return std::clamp(z, 0, CLUSTERS_Z - 1);
+    }
+
+    // the cluster boxes only change with the projection
+    void buildClusters(const glm::mat4 &projection)
+    {
+        clusterProjection = projection;
+        nearPlane = projection[3][2] / (projection[2][2] - 1.0f);
+        farPlane = projection[3][2] / (projection[2][2] + 1.0f);
+        focal = glm::vec2(projection[0][0], projection[1][1]);
+        clusterMin.resize(CLUSTER_COUNT);
+        clusterMax.resize(CLUSTER_COUNT);
+        for (int z = 0; z < CLUSTERS_Z; z++)
+        {
+            float depths[2] = {sliceDepth(z), sliceDepth(z + 1)};
+            for (int y = 0; y < CLUSTERS_Y; y++)
+                for (int x = 0; x < CLUSTERS_X; x++)
+                {
+                    glm::vec3 low(1e30f), high(-1e30f);
+                    for (float depth : depths)
+                        for (int corner = 0; corner < 4; corner++)
+                        {
+                            glm::vec2 ndc(-1.0f + 2.0f * (x + (corner & 1)) / CLUSTERS_X, -1.0f + 2.0f * (y + (corner >> 1)) / CLUSTERS_Y);
+                            glm::vec3 point(ndc * depth / focal, -depth);
+                            low = glm::min(low, point);
+                            high = glm::max(high, point);
+                        }
+                    int c = x + y * CLUSTERS_X + z * CLUSTERS_X * CLUSTERS_Y;
+                    clusterMin[c] = low;
+                    clusterMax[c] = high;
+                }
+        }
+    }
+
+    static int tile(float ndc, int tiles)
+    {
+        return std::clamp((int)std::floor((ndc + 1.0f) * 0.5f * tiles), 0, tiles - 1);
+    }
+
+    void binLight(const glm::mat4 &view, int light)
+    {
+        glm::vec3 center = glm::vec3(view * glm::vec4(lights[light].position, 1.0f));
+        float radius = lights[light].radius;
+        float depth = -center.z;
+        float nearDepth = std::max(depth - radius, nearPlane);
+        float farDepth = std::min(depth + radius, farPlane);
+        if (nearDepth > farDepth)
+            return;
+        // screen bounds: x / depth over the sphere's box peaks at its corners
+        glm::vec2 low(1e30f), high(-1e30f);
+        for (float d : {nearDepth, farDepth})
+            for (float sx : {-radius, radius})
+                for (float sy : {-radius, radius})
+                {
+                    glm::vec2 ndc = (glm::vec2(center) + glm::vec2(sx, sy)) * focal / d;
+                    low = glm::min(low, ndc);
+                    high = glm::max(high, ndc);
+                }
+        if (low.x > 1.0f || high.x < -1.0f || low.y > 1.0f || high.y < -1.0f)
+            return;
+        int x0 = tile(low.x, CLUSTERS_X), x1 = tile(high.x, CLUSTERS_X);
+        int y0 = tile(low.y, CLUSTERS_Y), y1 = tile(high.y, CLUSTERS_Y);
+        float radiusSquared = radius * radius;
+        for (int z = slice(nearDepth); z <= slice(farDepth); z++)
+            for (int y = y0; y <= y1; y++)
+                for (int x = x0; x <= x1; x++)
+                {
+                    int c = x + y * CLUSTERS_X + z * CLUSTERS_X * CLUSTERS_Y;
+                    glm::vec3 closest = glm::clamp(center, clusterMin[c], clusterMax[c]);
+                    glm::vec3 offset = closest - center;
+                    if (glm::dot(offset, offset) <= radiusSquared)
+                        pairs.push_back(glm::uvec2((uint32_t)c, (uint32_t)light));
+                }
+    }
+};
+#endif
@@ -0,0 +1,174 @@
+#ifndef COMMAND_LIST_H
+#define COMMAND_LIST_H
+
+#ifdef __EMSCRIPTEN__
+#include <GLES3/gl3.h>
+#else
+#include <glad/glad.h>
+#endif
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "instance_buffer.h"
+#include "material.h"
+#include "transform_batch.h"
+
+// One draw. The program comes from the material; slot is the TransformBatch
+// slot bound to ObjectBlock.
+struct DrawPacket
+{
+    uint64_t key;
+    const Material *material;
+    GLuint vao;
+    GLenum mode;
+    GLsizei count;
+    bool indexed;
+    // 0 for a plain draw, else the glDrawElementsInstanced count
+    GLsizei instances;
+    unsigned int slot;
+    float screenPixels;
+    // when set, the instance count is this buffer's size at replay, after
+    // the frame's uploads; nothing is drawn if it is empty
+    const InstanceBuffer *instanceBuffer;
+    // the draw's own uniforms, a range of its list's, set after the material
+    uint32_t firstUniform;
+    uint32_t uniformCount;
+};
+
+// A uniform value set for a single draw
+struct UniformPacket
+{
+    GLint location;
+    // GL_INT, GL_FLOAT or GL_FLOAT_VEC4
+    GLenum type;
+    GLint intValue;
+    glm::vec4 value;
+};
+
+// Instances a list appended to a buffer; every list's run for the buffer is
+// concatenated, in list order, into what it holds for the frame
+struct UploadPacket
+{
+    InstanceBuffer *buffer;
+    std::vector<InstanceData> instances;
+};
+
+// Draw, uniform and instance upload packets recorded without touching GL,
+// so any thread can fill one; the GL thread replays it through
+// RenderQueue::add(). A list is only read by the transforms it was made
+// with, which must be computed before recording starts.
+class CommandList
+{
+public:
+    explicit CommandList(const TransformBatch &transforms)
+        : transforms(&transforms)
+    {
+    }
+
+    // drops the last frame's packets; depth in the keys is measured from eye
+    void begin(const glm::vec3 &eyePosition)
+    {
+        eye = eyePosition;
+        draws.clear();
+        uniforms.clear();
+        // the runs keep their storage from frame to frame
+        for (UploadPacket &upload : uploads)
+            upload.instances.clear();
+        pendingUniforms = 0;
+    }
+
+    void draw(unsigned int pass, const Material &material, GLuint vao, GLenum mode, GLsizei count, bool indexed,
+              unsigned int slot, float screenPixels = TextureManager::FULL_COVERAGE, GLsizei instances = 0)
+    {
+        float depth = glm::length(glm::vec3(transforms->models[slot][3]) - eye);
+        uint32_t firstUniform = (uint32_t)uniforms.size() - pendingUniforms;
+        draws.push_back({makeKey(pass, material.program, material.key(), vao, depth), &material, vao, mode, count,
+                         indexed, instances, slot, screenPixels, nullptr, firstUniform, pendingUniforms});
+        pendingUniforms = 0;
+    }
+
+    // an indexed triangle draw of whatever `buffer` holds once the frame's
+    // lists have been replayed
+    void drawInstances(unsigned int pass, const Material &material, GLuint vao, GLsizei count,
+                       const InstanceBuffer &buffer, unsigned int slot, float screenPixels = TextureManager::FULL_COVERAGE)
+    {
+        draw(pass, material, vao, GL_TRIANGLES, count, true, slot, screenPixels);
+        draws.back().instanceBuffer = &buffer;
+    }
+
+    // uniforms for the next draw recorded
+    void uniform(GLint location, int value)
+    {
+        uniforms.push_back({location, GL_INT, value, glm::vec4(0.0f)});
+        pendingUniforms++;
+    }
+    void uniform(GLint location, float value)
+    {
+        uniforms.push_back({location, GL_FLOAT, 0, glm::vec4(value)});
+        pendingUniforms++;
+    }
+    void uniform(GLint location, const glm::vec4 &value)
+    {
+        uniforms.push_back({location, GL_FLOAT_VEC4, 0, value});
+        pendingUniforms++;
+    }
+
+    void append(InstanceBuffer &buffer, const InstanceData &instance)
+    {
+        if (lastUpload >= uploads.size() || uploads[lastUpload].buffer != &buffer)
+        {
+            lastUpload = 0;
+            while (lastUpload < uploads.size() && uploads[lastUpload].buffer != &buffer)
+                lastUpload++;
+            if (lastUpload == uploads.size())
+                uploads.push_back({&buffer, {}});
+        }
+        uploads[lastUpload].instances.push_back(instance);
+    }
+
+    size_t drawCount() const
+    {
+        return draws.size();
+    }
+
+    bool empty() const
+    {
+        for (const UploadPacket &upload : uploads)
+            if (!upload.instances.empty())
+                return false;
+        return draws.empty();
+    }
+
+    // From the top bit down the key holds
+    //   pass (4) | program (10) | material (14) | vao (12) | depth (24)
+    // so passes run in order and, inside a pass, draws sharing a program,
+    // material and vertex array end up next to each other, nearest first.
+    // Fields are truncated to their width: a collision only costs a rebind,
+    // the replay compares the real values.
+    static uint64_t makeKey(unsigned int pass, GLuint program, unsigned int material, GLuint vao, float depth)
+    {
+        // a non-negative float's bit pattern sorts like its value
+        uint32_t depthBits;
+        depth = depth > 0.0f ? depth : 0.0f;
+        memcpy(&depthBits, &depth, sizeof(depthBits));
+        return (uint64_t)(pass & 0xF) << 60 | (uint64_t)(program & 0x3FF) << 50 | (uint64_t)(material & 0x3FFF) << 36 |
+               (uint64_t)(vao & 0xFFF) << 24 | depthBits >> 8;
+    }
+
+private:
+    friend class RenderQueue;
+
+    const TransformBatch *transforms;
+    glm::vec3 eye = glm::vec3(0.0f);
+    std::vector<DrawPacket> draws;
+    std::vector<UniformPacket> uniforms;
+    // one per buffer appended to
+    std::vector<UploadPacket> uploads;
+    size_t lastUpload = 0;
+    // uniforms recorded since the last draw
+    uint32_t pendingUniforms = 0;
+};
+#endif
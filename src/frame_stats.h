@@ -0,0 +1,200 @@
+#ifndef FRAME_STATS_H
+#define FRAME_STATS_H
+
+#include <cstddef>
+#include <iostream>
+
+// Per-frame counters and timings. Systems bump the fields during a frame,
+// main_loop calls endFrame() once and a summary is printed about once a second.
+struct FrameStats
+{
+    // gpu time of the scene pass, from GpuTimer (-1 when unsupported)
+    float gpuSceneMs = -1.0f;
+    // cpu time spent in TransformBatch::compute
+    float transformMs = 0.0f;
+    unsigned int objectsTransformed = 0;
+    // cpu time of SceneBVH::update (refit or rebuild) and SceneBVH::cull,
+    // and how many of the culled objects were left
+    float bvhUpdateMs = 0.0f;
+    float cullMs = 0.0f;
+    unsigned int cullObjects = 0;
+    unsigned int cullVisible = 0;
+
+    // per-frame counters, reset by endFrame()
+    unsigned int materialSwitches = 0;
+    unsigned int textureBinds = 0;
+    unsigned int textureBindsSkipped = 0;
+    // state calls glState issued and the redundant ones it dropped
+    unsigned int glCalls = 0;
+    unsigned int glCallsSkipped = 0;
+    // glDrawElementsInstanced calls and the copies they drew
+    unsigned int instancedDraws = 0;
+    unsigned int instances = 0;
+    // RenderQueue packets and the program / vertex array binds they needed
+    unsigned int drawPackets = 0;
+    unsigned int programBinds = 0;
+    unsigned int vaoBinds = 0;
+    // occlusion queries issued and the proxies they hid, with rough pixel
+    // counts for the boxes tested and the objects not drawn
+    unsigned int occlusionQueries = 0;
+    unsigned int occlusionCulled = 0;
+    float occlusionProxyPixels = 0.0f;
+    float occlusionPixelsSaved = 0.0f;
+    // SoftwareOcclusion: triangles drawn, boxes tested and found hidden, and
+    // the time spent on each
+    unsigned int softOccluderTriangles = 0;
+    unsigned int softTests = 0;
+    unsigned int softCulled = 0;
+    float softRasterMs = 0.0f;
+    float softTestMs = 0.0f;
+    // GpuInstanceCuller: instances tested, and how many of the ones drawn
+    // went to each level of detail
+    unsigned int gpuCullInstances = 0;
+    unsigned int gpuCullLodInstances[3] = {};
+    // ClusteredLights: lights binned, light ids across all clusters and the
+    // most any one cluster holds, and the binning and upload time
+    unsigned int lights = 0;
+    unsigned int lightClusterRefs = 0;
+    unsigned int lightMaxPerCluster = 0;
+    float lightBinMs = 0.0f;
+
+    // summed over the report interval
+    unsigned int mipUploads = 0;
+    size_t mipUploadBytes = 0;
+    // frames whose upload ring slot was still in use by the gpu
+    unsigned int uploadStalls = 0;
+    // virtual texture pages the feedback asked for, how many were already
+    // in the cache and how many were uploaded
+    unsigned int vtPageRequests = 0;
+    unsigned int vtPageHits = 0;
+    unsigned int vtPageUploads = 0;
+    // cache occupancy as of the last frame, 0 pages without virtual textures
+    unsigned int vtResidentPages = 0;
+    unsigned int vtCachePages = 0;
+    // cpu time RenderQueue spent sorting and issuing packets
+    float queueSortMs = 0.0f;
+    float queueSubmitMs = 0.0f;
+    // command lists recorded off the GL thread and replayed, the cpu time
+    // spent recording them and the instance data they uploaded
+    unsigned int commandLists = 0;
+    float recordMs = 0.0f;
+    size_t commandUploadBytes = 0;
+    unsigned int bvhRebuilds = 0;
+    // cpu time spent issuing occlusion queries
+    float occlusionIssueMs = 0.0f;
+
+    void endFrame(float currentTime)
+    {
+        frames++;
+        gpuSceneSum += gpuSceneMs > 0.0f ? gpuSceneMs : 0.0f;
+        transformSum += transformMs;
+        bvhUpdateSum += bvhUpdateMs;
+        cullSum += cullMs;
+
+        if (currentTime - lastReport < 1.0f)
+        {
+            resetCounters();
+            return;
+        }
+
+        std::cout << "[STATS] " << frames << " fps"
+                  << " | objects " << objectsTransformed
+                  << " | transforms " << transformSum / frames << " ms";
+        if (gpuSceneMs >= 0.0f)
+            std::cout << " | gpu scene " << gpuSceneSum / frames << " ms";
+        std::cout << std::endl;
+        std::cout << "        materials " << materialSwitches
+                  << " | texture binds " << textureBinds << " (" << textureBindsSkipped << " skipped)"
+                  << " | mip uploads " << mipUploads << " (" << mipUploadBytes / 1024 << " KB, "
+                  << uploadStalls << " stalled frames)"
+                  << std::endl;
+        std::cout << "        gl state calls " << glCalls << " (" << glCallsSkipped << " skipped)" << std::endl;
+        if (drawPackets > 0)
+            std::cout << "        queue " << drawPackets << " packets"
+                      << " | programs " << programBinds << " | vaos " << vaoBinds
+                      << " | sort " << queueSortMs / frames << " ms | submit " << queueSubmitMs / frames << " ms" << std::endl;
+        if (commandLists > 0)
+            std::cout << "        command lists " << commandLists << " | record " << recordMs / frames << " ms"
+                      << " | " << commandUploadBytes / 1024 << " KB instances uploaded" << std::endl;
+        if (cullObjects > 0)
+            std::cout << "        cull " << cullVisible << "/" << cullObjects << " visible"
+                      << " | bvh update " << bvhUpdateSum / frames << " ms (" << bvhRebuilds << " rebuilds)"
+                      << " | cull " << cullSum / frames << " ms" << std::endl;
+        if (occlusionQueries > 0 || occlusionCulled > 0)
+            std::cout << "        occlusion " << occlusionQueries << " queries (~" << (int)(occlusionProxyPixels / 1000.0f)
+                      << "K px tested, " << occlusionIssueMs / frames << " ms)"
+                      << " | " << occlusionCulled << " hidden (~" << (int)(occlusionPixelsSaved / 1000.0f) << "K px saved)" << std::endl;
+        if (softOccluderTriangles > 0)
+            std::cout << "        software occlusion " << softOccluderTriangles << " triangles in " << softRasterMs << " ms"
+                      << " | " << softCulled << "/" << softTests << " boxes hidden in " << softTestMs << " ms" << std::endl;
+        if (gpuCullInstances > 0)
+            std::cout << "        gpu cull " << gpuCullInstances << " instances -> lod " << gpuCullLodInstances[0] << " / "
+                      << gpuCullLodInstances[1] << " / " << gpuCullLodInstances[2] << std::endl;
+        if (lights > 0)
+            std::cout << "        lights " << lights << " | " << lightClusterRefs << " cluster refs, up to "
+                      << lightMaxPerCluster << " per cluster | bin " << lightBinMs << " ms" << std::endl;
+        if (instancedDraws > 0)
+            std::cout << "        instances " << instances << " in " << instancedDraws << " draws" << std::endl;
+        if (vtCachePages > 0)
+            std::cout << "        vt pages " << vtPageRequests << " wanted, "
+                      << (vtPageRequests ? 100 * vtPageHits / vtPageRequests : 100) << "% hit"
+                      << " | " << vtPageUploads << " uploaded"
+                      << " | " << vtResidentPages << "/" << vtCachePages << " resident" << std::endl;
+
+        resetCounters();
+        mipUploads = 0;
+        mipUploadBytes = 0;
+        uploadStalls = 0;
+        vtPageRequests = 0;
+        vtPageHits = 0;
+        vtPageUploads = 0;
+        queueSortMs = 0.0f;
+        queueSubmitMs = 0.0f;
+        commandLists = 0;
+        recordMs = 0.0f;
+        commandUploadBytes = 0;
+        bvhRebuilds = 0;
+        occlusionIssueMs = 0.0f;
+        frames = 0;
+        gpuSceneSum = 0.0f;
+        transformSum = 0.0f;
+        bvhUpdateSum = 0.0f;
+        cullSum = 0.0f;
+        lastReport = currentTime;
+    }
+
+private:
+    unsigned int frames = 0;
+    float gpuSceneSum = 0.0f;
+    float transformSum = 0.0f;
+    float bvhUpdateSum = 0.0f;
+    float cullSum = 0.0f;
+    float lastReport = 0.0f;
+
+    void resetCounters()
+    {
+        materialSwitches = 0;
+        textureBinds = 0;
+        textureBindsSkipped = 0;
+        glCalls = 0;
+        glCallsSkipped = 0;
+        instancedDraws = 0;
+        instances = 0;
+        drawPackets = 0;
+        programBinds = 0;
+        vaoBinds = 0;
+        occlusionQueries = 0;
+        occlusionCulled = 0;
+        occlusionProxyPixels = 0.0f;
+        occlusionPixelsSaved = 0.0f;
+        softTests = 0;
+        softCulled = 0;
+        softTestMs = 0.0f;
+        gpuCullInstances = 0;
+        for (unsigned int &lodInstances : gpuCullLodInstances)
+            lodInstances = 0;
+    }
+};
+
+inline FrameStats frameStats;
+#endif
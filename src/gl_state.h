@@ -0,0 +1,322 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#ifdef __EMSCRIPTEN__
+#include <GLES3/gl3.h>
+#else
+#include <glad/glad.h>
+#endif
+
+#include <glm/glm.hpp>
+#include <cassert>
+
+#include "frame_stats.h"
+
+// Shadows GL binding and fixed-function state so redundant calls can be
+// dropped: textures, program, vertex array, buffers, framebuffer, depth,
+// stencil, blend, color writes and viewport. Every such call in the project
+// should go through glState, otherwise the shadow copy goes stale; call
+// invalidate() after touching state behind its back. Issued and dropped
+// calls are counted in frameStats.
+class GLState
+{
+public:
+    static const int MAX_TEXTURE_UNITS = 16;
+    static const int MAX_UNIFORM_BINDINGS = 16;
+
+    // leaves `unit` active even when the bind is skipped, so glTex* calls
+    // that follow always reach `id`
+    void bindTexture(GLuint unit, GLenum target, GLuint id)
+    {
+        assert(unit < MAX_TEXTURE_UNITS);
+        activeTexture(unit);
+        GLuint &bound = textures[unit][targetIndex(target)];
+        if (bound == id)
+        {
+            frameStats.textureBindsSkipped++;
+            frameStats.glCallsSkipped++;
+            return;
+        }
+        glBindTexture(target, id);
+        bound = id;
+        frameStats.textureBinds++;
+        frameStats.glCalls++;
+    }
+
+    void activeTexture(GLuint unit)
+    {
+        if (!changed(activeUnit, unit))
+            return;
+        glActiveTexture(GL_TEXTURE0 + unit);
+    }
+
+    void useProgram(GLuint id)
+    {
+        if (changed(program, id))
+            glUseProgram(id);
+    }
+
+    void bindVertexArray(GLuint id)
+    {
+        if (changed(vertexArray, id))
+            glBindVertexArray(id);
+    }
+
+    // GL_ELEMENT_ARRAY_BUFFER belongs to the bound vertex array, so it is
+    // passed straight through
+    void bindBuffer(GLenum target, GLuint id)
+    {
+        int index = bufferIndex(target);
+        if (index < 0)
+        {
+            glBindBuffer(target, id);
+            frameStats.glCalls++;
+            return;
+        }
+        if (changed(buffers[index], id))
+            glBindBuffer(target, id);
+    }
+
+    // also binds the generic GL_UNIFORM_BUFFER point, like GL does
+    void bindUniformRange(GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+    {
+        UniformRange range = {buffer, offset, size};
+        if (!changed(uniformRanges[index], range))
+            return;
+        glBindBufferRange(GL_UNIFORM_BUFFER, index, buffer, offset, size);
+        buffers[bufferIndex(GL_UNIFORM_BUFFER)] = buffer;
+    }
+
+    void bindFramebuffer(GLuint id)
+    {
+        if (changed(framebuffer, id))
+            glBindFramebuffer(GL_FRAMEBUFFER, id);
+    }
+
+    // GL_DEPTH_TEST, GL_STENCIL_TEST, GL_BLEND, GL_CULL_FACE,
+    // GL_RASTERIZER_DISCARD and, on desktop, GL_TEXTURE_CUBE_MAP_SEAMLESS are
+    // shadowed; anything else is passed straight through
+    void setEnabled(GLenum capability, bool enabled)
+    {
+        int index = capabilityIndex(capability);
+        if (index < 0)
+            frameStats.glCalls++;
+        else if (!changed(capabilities[index], (GLuint)enabled))
+            return;
+        if (enabled)
+            glEnable(capability);
+        else
+            glDisable(capability);
+    }
+
+    void depthMask(bool write)
+    {
+        if (changed(depthWrite, (GLuint)write))
+            glDepthMask(write ? GL_TRUE : GL_FALSE);
+    }
+
+    // all four channels together
+    void colorMask(bool write)
+    {
+        if (changed(colorWrite, (GLuint)write))
+            glColorMask(write, write, write, write);
+    }
+
+    void depthFunc(GLenum func)
+    {
+        if (changed(depthCompare, func))
+            glDepthFunc(func);
+    }
+
+    void blendFunc(GLenum source, GLenum destination)
+    {
+        if (changed(blend, glm::uvec2(source, destination)))
+            glBlendFunc(source, destination);
+    }
+
+    void stencilFunc(GLenum func, GLint ref, GLuint mask)
+    {
+        if (changed(stencilTest, glm::uvec3(func, (GLuint)ref, mask)))
+            glStencilFunc(func, ref, mask);
+    }
+
+    void stencilMask(GLuint mask)
+    {
+        if (changed(stencilWrite, mask))
+            glStencilMask(mask);
+    }
+
+    void stencilOp(GLenum stencilFail, GLenum depthFail, GLenum pass)
+    {
+        if (changed(stencilOps, glm::uvec3(stencilFail, depthFail, pass)))
+            glStencilOp(stencilFail, depthFail, pass);
+    }
+
+    void viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+    {
+        if (changed(viewportRect, glm::ivec4(x, y, width, height)))
+            glViewport(x, y, width, height);
+    }
+
+    // the tracked viewport, false until one has been set through glState
+    bool currentViewport(GLint rect[4]) const
+    {
+        if (viewportRect == glm::ivec4(-1))
+            return false;
+        for (int i = 0; i < 4; i++)
+            rect[i] = viewportRect[i];
+        return true;
+    }
+
+    // deleting a bound object unbinds it, so the shadow has to follow
+    void forgetBuffer(GLuint id)
+    {
+        for (GLuint &bound : buffers)
+            if (bound == id)
+                bound = 0;
+        for (UniformRange &range : uniformRanges)
+            if (range.buffer == id)
+                range = UniformRange();
+    }
+
+    void forgetVertexArray(GLuint id)
+    {
+        if (vertexArray == id)
+            vertexArray = 0;
+    }
+
+    // forget a deleted texture so a recycled name isn't mistaken for bound
+    void forgetTexture(GLuint id)
+    {
+        for (auto &unit : textures)
+            for (GLuint &bound : unit)
+                if (bound == id)
+                    bound = 0;
+    }
+
+    void invalidate()
+    {
+        for (auto &unit : textures)
+            for (GLuint &bound : unit)
+                bound = INVALID;
+        activeUnit = INVALID;
+        program = vertexArray = framebuffer = INVALID;
+        for (GLuint &bound : buffers)
+            bound = INVALID;
+        for (UniformRange &range : uniformRanges)
+            range = UniformRange();
+        for (GLuint &enabled : capabilities)
+            enabled = INVALID;
+        depthWrite = depthCompare = stencilWrite = colorWrite = INVALID;
+        blend = glm::uvec2(INVALID);
+        stencilTest = stencilOps = glm::uvec3(INVALID);
+        viewportRect = glm::ivec4(-1);
+    }
+
+    GLState()
+    {
+        invalidate();
+    }
+
+private:
+    static const GLuint INVALID = 0xFFFFFFFFu;
+    static const int TARGET_COUNT = 4;
+    static const int BUFFER_TARGET_COUNT = 4;
+    static const int CAPABILITY_COUNT = 6;
+
+    struct UniformRange
+    {
+        GLuint buffer = INVALID;
+        GLintptr offset = 0;
+        GLsizeiptr size = 0;
+
+        bool operator==(const UniformRange &other) const
+        {
+            return buffer == other.buffer && offset == other.offset && size == other.size;
+        }
+        bool operator!=(const UniformRange &other) const { return !(*this == other); }
+    };
+
+    GLuint textures[MAX_TEXTURE_UNITS][TARGET_COUNT];
+    GLuint activeUnit;
+    GLuint program, vertexArray, framebuffer;
+    GLuint buffers[BUFFER_TARGET_COUNT];
+    UniformRange uniformRanges[MAX_UNIFORM_BINDINGS];
+    GLuint capabilities[CAPABILITY_COUNT];
+    GLuint depthWrite, depthCompare, stencilWrite, colorWrite;
+    glm::uvec2 blend;
+    glm::uvec3 stencilTest, stencilOps;
+    glm::ivec4 viewportRect;
+
+    // updates the shadow copy and says whether the GL call is needed
+    template <typename T>
+    static bool changed(T &shadow, const T &value)
+    {
+        if (shadow == value)
+        {
+            frameStats.glCallsSkipped++;
+            return false;
+        }
+        shadow = value;
+        frameStats.glCalls++;
+        return true;
+    }
+
+    static int bufferIndex(GLenum target)
+    {
+        switch (target)
+        {
+        case GL_ARRAY_BUFFER:
+            return 0;
+        case GL_UNIFORM_BUFFER:
+            return 1;
+        case GL_PIXEL_PACK_BUFFER:
+            return 2;
+        case GL_PIXEL_UNPACK_BUFFER:
+            return 3;
+        default:
+            return -1;
+        }
+    }
+
+    static int capabilityIndex(GLenum capability)
+    {
+        switch (capability)
+        {
+        case GL_DEPTH_TEST:
+            return 0;
+        case GL_STENCIL_TEST:
+            return 1;
+        case GL_BLEND:
+            return 2;
+        case GL_CULL_FACE:
+            return 3;
+        case GL_RASTERIZER_DISCARD:
+            return 4;
+#ifndef __EMSCRIPTEN__
+        case GL_TEXTURE_CUBE_MAP_SEAMLESS:
+            return 5;
+#endif
+        default:
+            return -1;
+        }
+    }
+
+    static int targetIndex(GLenum target)
+    {
+        switch (target)
+        {
+        case GL_TEXTURE_CUBE_MAP:
+            return 1;
+        case GL_TEXTURE_2D_ARRAY:
+            return 2;
+        case GL_TEXTURE_3D:
+            return 3;
+        default:
+            return 0;
+        }
+    }
+};
+
+inline GLState glState;
+#endif
@@ -0,0 +1,213 @@
+#ifndef GPU_INSTANCE_CULLER_H
+#define GPU_INSTANCE_CULLER_H
+
+#ifdef __EMSCRIPTEN__
+#include <GLES3/gl3.h>
+#else
+#include <glad/glad.h>
+#endif
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "frame_stats.h"
+#include "gl_state.h"
+#include "instance_buffer.h"
+#include "shader.h"
+
+// Culls a static instance set on the gpu, one transform feedback pass per
+// level of detail:
+//   - a vertex pass moves every instance (an optional orbit around the local
+//     y axis) and tests it against the frustum, a distance limit and a mask
+//     of ring sectors; instances outside this pass's LOD keep a zero scale
+//   - on desktop a geometry shader drops the zero-scale instances, so the
+//     LOD buffer is tightly packed; WebGL2 has no geometry shaders, there
+//     every instance is captured and the rejected ones draw as degenerate
+//     triangles
+//   - the captured buffers are laid out as InstanceData and feed instanced
+//     draws directly. The instance counts come from feedback queries that
+//     are only read once available, so the buffers drawn are the ones
+//     captured the frame before and nothing waits on the gpu.
+class GpuInstanceCuller
+{
+public:
+    static const int LODS = 3;
+    static const int RING_SIZE = 2;
+
+    explicit GpuInstanceCuller(const std::vector<InstanceData> &instances)
+        : program("res/shaders/instance_cull.vs", "res/shaders/instance_cull.fs",
+#ifdef __EMSCRIPTEN__
+                  nullptr, {"vPositionScale", "vRotation", "vMaterial"}
+#else
+                  "res/shaders/instance_cull.gs", {"cPositionScale", "cRotation", "cMaterial"}
+#endif
+          )
+    {
+        count = (GLsizei)instances.size();
+        glGenBuffers(1, &sourceVBO);
+        glGenVertexArrays(1, &sourceVAO);
+        glState.bindVertexArray(sourceVAO);
+        glState.bindBuffer(GL_ARRAY_BUFFER, sourceVBO);
+        glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(InstanceData), instances.data(), GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void *)offsetof(InstanceData, position));
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void *)offsetof(InstanceData, rotation));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void *)offsetof(InstanceData, material));
+        glState.bindVertexArray(0);
+
+        for (Capture &capture : captures)
+        {
+            glGenQueries(LODS, capture.queries);
+            for (int lod = 0; lod < LODS; lod++)
+            {
+                capture.lods[lod] = new InstanceBuffer();
+                capture.lods[lod]->reserve(count);
+            }
+        }
+    }
+
+    ~GpuInstanceCuller()
+    {
+        for (Capture &capture : captures)
+        {
+            glDeleteQueries(LODS, capture.queries);
+            for (InstanceBuffer *buffer : capture.lods)
+                delete buffer;
+        }
+        glState.forgetVertexArray(sourceVAO);
+        glState.forgetBuffer(sourceVBO);
+        glDeleteVertexArrays(1, &sourceVAO);
+        glDeleteBuffers(1, &sourceVBO);
+    }
+
+    GpuInstanceCuller(const GpuInstanceCuller &) = delete;
+    GpuInstanceCuller &operator=(const GpuInstanceCuller &) = delete;
+
+    // angular speed at local radius 1; an instance at radius r turns at
+    // rate / r^1.5. 0 leaves the instances where they are.
+    float orbitRate = 0.0f;
+    // bounding radius of the mesh at scale 1
+    float boundRadius = 1.0f;
+    // world distances where LOD 1 and 2 start and past which nothing is drawn
+    glm::vec3 lodDistances = glm::vec3(10.0f, 25.0f, 100.0f);
+
+    // captures this frame's survivors; `model` places the instances in the
+    // world and sector bit i keeps the i-th of `sectors` slices of the ring
+    // around the local y axis
+    void cull(const glm::mat4 &model, const glm::mat4 &viewProjection, const glm::vec3 &eye, float time,
+              uint32_t sectorMask = 0xFFFFFFFFu, int sectors = 1)
+    {
+        collect();
+        int target = -1;
+        for (int i = 0; i < RING_SIZE; i++)
+            if (i != drawn && !captures[i].pending)
+                target = i;
+        // every other capture is still in flight: keep drawing the last one
+        if (target < 0)
+            return;
+
+        glm::vec4 planes[6];
+        frustumPlanes(viewProjection, planes);
+        program.use();
+        program.setMat4("model", model);
+        glUniform4fv(glGetUniformLocation(program.ID, "planes"), 6, &planes[0][0]);
+        program.setVec3("eye", eye);
+        program.setFloat("time", time);
+        program.setFloat("orbitRate", orbitRate);
+        program.setFloat("boundRadius", boundRadius);
+        program.setVec3("lodDistances", lodDistances);
+        glUniform1ui(glGetUniformLocation(program.ID, "sectorMask"), sectorMask);
+        program.setInt("sectors", sectors);
+        glState.bindVertexArray(sourceVAO);
+        glState.setEnabled(GL_RASTERIZER_DISCARD, true);
+        Capture &capture = captures[target];
+        for (int lod = 0; lod < LODS; lod++)
+        {
+            program.setInt("lod", lod);
+            glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, capture.lods[lod]->id());
+            glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, capture.queries[lod]);
+            glBeginTransformFeedback(GL_POINTS);
+            glDrawArrays(GL_POINTS, 0, count);
+            glEndTransformFeedback();
+            glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+        }
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+        glState.setEnabled(GL_RASTERIZER_DISCARD, false);
+        capture.pending = true;
+        capture.serial = ++serial;
+        frameStats.gpuCullInstances += count;
+    }
+
+    // the newest finished capture of a LOD, empty until the first arrives
+    const InstanceBuffer &lod(int level) const
+    {
+        return drawn < 0 ? empty : *captures[drawn].lods[level];
+    }
+
+private:
+    struct Capture
+    {
+        InstanceBuffer *lods[LODS] = {};
+        GLuint queries[LODS] = {};
+        bool pending = false;
+        unsigned int serial = 0;
+    };
+
+    Shader program;
+    GLuint sourceVAO = 0, sourceVBO = 0;
+    GLsizei count = 0;
+    Capture captures[RING_SIZE];
+    // capture lod() hands out, -1 before the first finishes
+    int drawn = -1;
+    unsigned int serial = 0;
+    InstanceBuffer empty;
+
+    // switches to the newest capture whose counts have all come back
+    void collect()
+    {
+        for (int i = 0; i < RING_SIZE; i++)
+        {
+            Capture &capture = captures[i];
+            if (!capture.pending)
+                continue;
+            GLuint available = 1;
+            for (int lod = 0; lod < LODS && available; lod++)
+                glGetQueryObjectuiv(capture.queries[lod], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                continue;
+            for (int lod = 0; lod < LODS; lod++)
+            {
+                GLuint written = 0;
+                glGetQueryObjectuiv(capture.queries[lod], GL_QUERY_RESULT, &written);
+                capture.lods[lod]->setSize((GLsizei)written);
+            }
+            capture.pending = false;
+            if (drawn < 0 || capture.serial > captures[drawn].serial)
+                drawn = i;
+        }
+        if (drawn >= 0)
+            for (int lod = 0; lod < LODS; lod++)
+                frameStats.gpuCullLodInstances[lod] += captures[drawn].lods[lod]->size();
+    }
+
+    // world space planes, inside where dot(xyz, p) + w >= 0
+    static void frustumPlanes(const glm::mat4 &m, glm::vec4 planes[6])
+    {
+        glm::vec4 row[4];
+        for (int i = 0; i < 4; i++)
+            row[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+        planes[0] = row[3] + row[0];
+        planes[1] = row[3] - row[0];
+        planes[2] = row[3] + row[1];
+        planes[3] = row[3] - row[1];
+        planes[4] = row[3] + row[2];
+        planes[5] = row[3] - row[2];
+        for (int i = 0; i < 6; i++)
+            planes[i] /= glm::length(glm::vec3(planes[i]));
+    }
+};
+#endif
@@ -0,0 +1,93 @@
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+#ifdef __EMSCRIPTEN__
+#include <GLES3/gl3.h>
+#else
+#include <glad/glad.h>
+#endif
+#include <string.h>
+
+// GL_TIME_ELAPSED is core on desktop; WebGL2 exposes the same enum through
+// EXT_disjoint_timer_query_webgl2.
+#ifndef GL_TIME_ELAPSED
+#define GL_TIME_ELAPSED 0x88BF
+#endif
+
+// Measures gpu time between begin() and end() without stalling: queries are
+// kept in a small ring and only read back once the driver reports them ready.
+class GpuTimer
+{
+public:
+    static const int RING_SIZE = 4;
+
+    bool supported = false;
+    float lastMs = -1.0f;
+
+    GpuTimer()
+    {
+#ifdef __EMSCRIPTEN__
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (GLint i = 0; i < count && !supported; i++)
+        {
+            const char *ext = (const char *)glGetStringi(GL_EXTENSIONS, i);
+            if (ext && strstr(ext, "disjoint_timer_query"))
+                supported = true;
+        }
+#else
+        supported = true;
+#endif
+        if (supported)
+            glGenQueries(RING_SIZE, queries);
+    }
+
+    void begin()
+    {
+        if (!supported)
+            return;
+        // collect here too: if the whole ring is in flight no query starts,
+        // and end() would never get to poll again
+        poll();
+        if (pending[head])
+            return;
+        glBeginQuery(GL_TIME_ELAPSED, queries[head]);
+        running = true;
+    }
+
+    void end()
+    {
+        if (!running)
+            return;
+        glEndQuery(GL_TIME_ELAPSED);
+        running = false;
+        pending[head] = true;
+        head = (head + 1) % RING_SIZE;
+        poll();
+    }
+
+private:
+    GLuint queries[RING_SIZE] = {};
+    bool pending[RING_SIZE] = {};
+    int head = 0;
+    int tail = 0;
+    bool running = false;
+
+    // collect every finished query, oldest first
+    void poll()
+    {
+        while (pending[tail])
+        {
+            GLuint available = 0;
+            glGetQueryObjectuiv(queries[tail], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                return;
+            GLuint ns = 0;
+            glGetQueryObjectuiv(queries[tail], GL_QUERY_RESULT, &ns);
+            lastMs = ns / 1000000.0f;
+            pending[tail] = false;
+            tail = (tail + 1) % RING_SIZE;
+        }
+    }
+};
+#endif
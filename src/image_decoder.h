@@ -0,0 +1,578 @@
+#ifndef IMAGE_DECODER_H
+#define IMAGE_DECODER_H
+
+#include "stb_image.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "block_compress.h"
+#include "ktx2.h"
+#include "lockfree_queue.h"
+#include "mip_generator.h"
+#include "pixel_convert.h"
+#include "thread_pool.h"
+
+// Fills width x height RGBA8 pixels, bottom row first, on a decode worker.
+using TextureGenerator = std::function<void(unsigned char *rgba, int width, int height)>;
+
+struct DecodeRequest
+{
+    // opaque ids the caller uses to match results to its textures
+    unsigned int slot = 0;
+    unsigned int generation = 0;
+    std::string path;
+    // 0 keeps the file's channel count
+    int channels = 0;
+    bool flipVertically = true;
+    bool premultiplyAlpha = false;
+    // quality cap on the longest edge, 0 for none
+    int maxSize = 0;
+    // build the full mip chain on the worker, down to 1x1
+    bool mipmaps = true;
+    // filter for the chain and for dropped levels
+    MipOptions mipOptions;
+    // CompressedFamily bits the GL context supports, for KTX2 files
+    unsigned int compressedFamilies = 0;
+    // set for texture arrays and atlases: the images to pack, in layer or
+    // rect order. `path` is then only a name for error messages.
+    std::vector<std::string> paths;
+    // arrays: every layer is resampled to this size
+    int layerWidth = 0;
+    int layerHeight = 0;
+    // atlases: edge length (a power of two) and gutter around each image
+    int atlasSize = 0;
+    int atlasPadding = 0;
+    // resample the equirectangular image at `path` into the six faces of a
+    // cube map; cubeFaceSize 0 picks a quarter of the image width
+    bool cubemap = false;
+    int cubeFaceSize = 0;
+    // makes the pixels instead of decoding `path`, which is then a name
+    TextureGenerator generator;
+    int generatedWidth = 0;
+    int generatedHeight = 0;
+    // block compress the finished chain: BC1/BC3 when compressedFamilies
+    // has S3TC, else ETC2
+    bool compress = false;
+    BlockQuality compressQuality = BLOCK_QUALITY_NORMAL;
+};
+
+// Where an image landed in an atlas, in uv units, gutter excluded. A [0, 1]
+// uv maps into it as rect.xy + uv * rect.zw; the default covers the whole
+// texture, which is what a placeholder wants.
+struct AtlasRect
+{
+    float u = 0.0f;
+    float v = 0.0f;
+    float width = 1.0f;
+    float height = 1.0f;
+};
+
+struct DecodedImage
+{
+    unsigned int slot = 0;
+    unsigned int generation = 0;
+    std::string path;
+    bool ok = false;
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    int dropLevels = 0;
+    std::vector<unsigned char> pixels;
+    // compressed internal format (KTX2 only, 0 if uncompressed)
+    GLenum compressedFormat = 0;
+    // the mip chain inside pixels, largest first; at least one level. For
+    // arrays and cube maps each level holds all layers (faces) back to back.
+    std::vector<ImageLevel> levels;
+    int layers = 1;
+    // atlases only, one per request path
+    std::vector<AtlasRect> rects;
+    std::string error;
+};
+
+// Decodes images on a worker pool and hands the pixels back to the GL thread
+// through a lock-free queue. stb only decodes; channel conversion and the
+// vertical flip run through PixelConvert in a single pass.
+class ImageDecoder
+{
+public:
+    ImageDecoder() : finished(128) {}
+
+    void start(int threads)
+    {
+        // restarting drops whatever the old workers hadn't picked up
+        stop();
+        pool.start(threads);
+    }
+
+    void stop()
+    {
+        // dropped requests never reach poll(), which is what balances inFlight
+        inFlight -= (int)pool.stop();
+    }
+
+    int threadCount() const
+    {
+        return pool.threadCount();
+    }
+
+    void submit(DecodeRequest request)
+    {
+        inFlight++;
+        pool.submit([this, request]
+                    { deliver(decode(request)); });
+    }
+
+    // called on the GL thread; returns false once nothing is ready
+    bool poll(DecodedImage &image)
+    {
+        if (!overflow.empty())
+        {
+            image = std::move(overflow.front());
+            overflow.pop_front();
+        }
+        else if (!finished.pop(image))
+            return false;
+        inFlight--;
+        return true;
+    }
+
+    bool busy() const
+    {
+        return inFlight.load() > 0;
+    }
+
+private:
+    ThreadPool pool;
+    LockFreeQueue<DecodedImage> finished;
+    // only used when the pool runs inline and the queue is full
+    std::deque<DecodedImage> overflow;
+    std::atomic<int> inFlight{0};
+
+    static DecodedImage decode(const DecodeRequest &request)
+    {
+        DecodedImage image;
+        image.slot = request.slot;
+        image.generation = request.generation;
+        image.path = request.path;
+
+        if (!request.generator && isKtx2(request.path))
+        {
+            decodeKtx2(request, image);
+            return image;
+        }
+
+        if (request.cubemap)
+        {
+            decodeCubemap(request, image);
+            return image;
+        }
+        if (!request.paths.empty())
+        {
+            if (request.atlasSize > 0)
+                decodeAtlas(request, image);
+            else
+                decodeArray(request, image);
+            return image;
+        }
+
+        if (request.generator)
+            generatePixels(request, image);
+        else if (!loadPixels(request.path, request, image.pixels, image.width, image.height, image.channels, image.error))
+            return image;
+        limitSize(request, image);
+
+        image.levels.push_back({0, image.pixels.size(), image.width, image.height});
+        if (request.mipmaps)
+            MipGenerator::buildChain(image.pixels, image.levels, image.channels, request.mipOptions);
+        if (request.compress)
+            compressChain(request, image);
+        image.ok = true;
+        return image;
+    }
+
+    static void generatePixels(const DecodeRequest &request, DecodedImage &image)
+    {
+        image.width = request.generatedWidth;
+        image.height = request.generatedHeight;
+        image.channels = 4;
+        image.pixels.resize((size_t)image.width * image.height * 4);
+        request.generator(image.pixels.data(), image.width, image.height);
+        if (request.premultiplyAlpha)
+            PixelConvert::premultiplyAlpha(image.pixels.data(), (size_t)image.width * image.height);
+    }
+
+    // Re-encodes the chain into GPU blocks, with alpha only when some texel
+    // uses it. WebGL wants block aligned levels (or 1 and 2 texels for the
+    // last mips), so other sizes stay uncompressed, as do grey images.
+    static void compressChain(const DecodeRequest &request, DecodedImage &image)
+    {
+        auto aligned = [](int size)
+        { return size % 4 == 0 || size < 3; };
+        for (const ImageLevel &level : image.levels)
+            if (!aligned(level.width) || !aligned(level.height))
+                return;
+        if (image.channels < 3)
+            return;
+        bool alpha = false;
+        for (size_t i = 3; image.channels == 4 && !alpha && i < image.levels[0].size; i += 4)
+            alpha = image.pixels[i] != 255;
+
+        BlockFormat format;
+        GLenum glFormat;
+        if (request.compressedFamilies & FAMILY_S3TC)
+        {
+            format = alpha ? BLOCK_FORMAT_BC3 : BLOCK_FORMAT_BC1;
+            glFormat = alpha ? 0x83F3 : 0x83F0;
+        }
+        else if (request.compressedFamilies & FAMILY_ETC2)
+        {
+            format = alpha ? BLOCK_FORMAT_ETC2_RGBA : BLOCK_FORMAT_ETC2_RGB;
+            glFormat = alpha ? 0x9278 : 0x9274;
+        }
+        else
+            return;
+
+        std::vector<unsigned char> blocks;
+        std::vector<ImageLevel> levels;
+        for (const ImageLevel &level : image.levels)
+        {
+            size_t offset = blocks.size(), size = BlockCompress::compressedSize(format, level.width, level.height);
+            blocks.resize(offset + size);
+            BlockCompress::compress(image.pixels.data() + level.offset, level.width, level.height, image.channels, format,
+                                    request.compressQuality, blocks.data() + offset);
+            levels.push_back({offset, size, level.width, level.height});
+        }
+        image.pixels.swap(blocks);
+        image.levels.swap(levels);
+        image.compressedFormat = glFormat;
+    }
+
+    // decodes one file into the requested channel layout
+    static bool loadPixels(const std::string &path, const DecodeRequest &request, std::vector<unsigned char> &pixels,
+                           int &width, int &height, int &channels, std::string &error)
+    {
+        stbi_set_flip_vertically_on_load_thread(false);
+        int fileChannels = 0;
+        unsigned char *data = stbi_load(path.c_str(), &width, &height, &fileChannels, 0);
+        if (!data)
+        {
+            error = stbi_failure_reason() ? stbi_failure_reason() : "decode failed";
+            return false;
+        }
+        channels = request.channels ? request.channels : fileChannels;
+        pixels.resize((size_t)width * height * channels);
+        PixelConvert::convertImage(data, fileChannels, pixels.data(), channels, width, height, request.flipVertically);
+        stbi_image_free(data);
+        if (request.premultiplyAlpha && channels == 4)
+            PixelConvert::premultiplyAlpha(pixels.data(), (size_t)width * height);
+        return true;
+    }
+
+    // Scales an image over the quality cap down in one filtered pass, so a
+    // 3000 px image becomes 2048 rather than 1500. Counts as skipped levels.
+    static void limitSize(const DecodeRequest &request, DecodedImage &image)
+    {
+        int longest = std::max(image.width, image.height);
+        if (request.maxSize <= 0 || longest <= request.maxSize)
+            return;
+        int width = std::max(1, (int)((int64_t)image.width * request.maxSize / longest));
+        int height = std::max(1, (int)((int64_t)image.height * request.maxSize / longest));
+        std::vector<unsigned char> scaled((size_t)width * height * image.channels);
+        MipGenerator::resample(image.pixels.data(), image.width, image.height, scaled.data(), width, height, image.channels, request.mipOptions);
+        image.pixels.swap(scaled);
+        while (longest > request.maxSize)
+        {
+            longest /= 2;
+            image.dropLevels++;
+        }
+        image.width = width;
+        image.height = height;
+    }
+
+    // Every image becomes one layer of layerWidth x layerHeight with its own
+    // chain. The result is level major, the layout glTexImage3D takes: level
+    // n holds level n of every layer back to back.
+    static void decodeArray(const DecodeRequest &request, DecodedImage &image)
+    {
+        int layers = (int)request.paths.size();
+        std::vector<std::vector<unsigned char>> layerPixels(layers);
+        std::vector<std::vector<ImageLevel>> chains(layers);
+        for (int i = 0; i < layers; i++)
+        {
+            std::vector<unsigned char> &pixels = layerPixels[i];
+            int width = 0, height = 0;
+            if (!loadPixels(request.paths[i], request, pixels, width, height, image.channels, image.error))
+            {
+                image.error = request.paths[i] + ": " + image.error;
+                return;
+            }
+            if (width != request.layerWidth || height != request.layerHeight)
+            {
+                std::vector<unsigned char> resized((size_t)request.layerWidth * request.layerHeight * image.channels);
+                MipGenerator::resample(pixels.data(), width, height, resized.data(), request.layerWidth, request.layerHeight,
+                                       image.channels, request.mipOptions);
+                pixels.swap(resized);
+            }
+            chains[i].push_back({0, pixels.size(), request.layerWidth, request.layerHeight});
+            if (request.mipmaps)
+                MipGenerator::buildChain(pixels, chains[i], image.channels, request.mipOptions);
+        }
+        interleaveLayers(layerPixels, chains, image);
+    }
+
+    // level major, the layout glTexImage3D takes: level n holds level n of
+    // every layer back to back
+    static void interleaveLayers(const std::vector<std::vector<unsigned char>> &layerPixels, const std::vector<std::vector<ImageLevel>> &chains,
+                                 DecodedImage &image)
+    {
+        int layers = (int)chains.size();
+        for (size_t level = 0; level < chains[0].size(); level++)
+        {
+            ImageLevel info = chains[0][level];
+            info.offset = image.pixels.size();
+            info.size *= layers;
+            for (int i = 0; i < layers; i++)
+            {
+                const ImageLevel &part = chains[i][level];
+                image.pixels.insert(image.pixels.end(), layerPixels[i].begin() + part.offset, layerPixels[i].begin() + part.offset + part.size);
+            }
+            image.levels.push_back(info);
+        }
+        image.width = chains[0][0].width;
+        image.height = chains[0][0].height;
+        image.layers = layers;
+        image.ok = true;
+    }
+
+    // Resamples an equirectangular map onto the six faces of a cube map, in
+    // GL face order. A quarter of the width per face keeps the texel density
+    // of the equator and drops the oversampled rows near the poles: 6/16 of
+    // the texels of a 2:1 map. Each face texel averages 3x3 bilinear samples
+    // in linear light; u wraps around the date line.
+    //
+    // Directions follow the planet sphere's uvs: u = 0 along -x, turning
+    // towards +z, and v = 0 at the south pole (-y), the first row of the
+    // flipped image.
+    static void decodeCubemap(const DecodeRequest &request, DecodedImage &image)
+    {
+        std::vector<unsigned char> equirect;
+        int width = 0, height = 0, channels = 0;
+        if (!loadPixels(request.path, request, equirect, width, height, channels, image.error))
+            return;
+        int size = request.cubeFaceSize > 0 ? request.cubeFaceSize : std::max(1, width / 4);
+        if (request.maxSize > 0)
+            size = std::min(size, request.maxSize);
+
+        std::vector<float> linear((size_t)width * height * channels);
+        if (request.mipOptions.srgb)
+            PixelConvert::srgbToLinear(equirect.data(), linear.data(), (size_t)width * height, channels);
+        else
+            PixelConvert::unormToFloat(equirect.data(), linear.data(), linear.size());
+        std::vector<unsigned char>().swap(equirect);
+
+        const int SUBSAMPLES = 3;
+        const float pi = 3.14159265f;
+        std::vector<std::vector<unsigned char>> faces(6);
+        std::vector<std::vector<ImageLevel>> chains(6);
+        std::vector<float> row((size_t)size * channels);
+        for (int face = 0; face < 6; face++)
+        {
+            std::vector<unsigned char> &pixels = faces[face];
+            pixels.resize((size_t)size * size * channels);
+            for (int y = 0; y < size; y++)
+            {
+                std::fill(row.begin(), row.end(), 0.0f);
+                for (int x = 0; x < size; x++)
+                    for (int sy = 0; sy < SUBSAMPLES; sy++)
+                        for (int sx = 0; sx < SUBSAMPLES; sx++)
+                        {
+                            float sc = 2.0f * (x + (sx + 0.5f) / SUBSAMPLES) / size - 1.0f;
+                            float tc = 2.0f * (y + (sy + 0.5f) / SUBSAMPLES) / size - 1.0f;
+                            float d[3];
+                            faceDirection(face, sc, tc, d);
+                            float length = std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+                            float theta = std::atan2(d[2], -d[0]);
+                            if (theta < 0.0f)
+                                theta += 2.0f * pi;
+                            float phi = std::acos(std::min(std::max(-d[1] / length, -1.0f), 1.0f));
+                            sampleBilinear(linear, width, height, channels, theta / (2.0f * pi) * width - 0.5f, phi / pi * height - 0.5f,
+                                           1.0f / (SUBSAMPLES * SUBSAMPLES), &row[(size_t)x * channels]);
+                        }
+                unsigned char *dst = pixels.data() + (size_t)y * size * channels;
+                if (request.mipOptions.srgb)
+                    PixelConvert::linearToSrgb(row.data(), dst, (size_t)size, channels);
+                else
+                    PixelConvert::floatToUnorm(row.data(), dst, row.size());
+            }
+            chains[face].push_back({0, pixels.size(), size, size});
+            if (request.mipmaps)
+            {
+                MipOptions options = request.mipOptions;
+                options.wrapU = options.wrapV = false;
+                MipGenerator::buildChain(pixels, chains[face], channels, options);
+            }
+        }
+        image.channels = channels;
+        interleaveLayers(faces, chains, image);
+    }
+
+    // GL's cube map convention: face major axis and the (sc, tc) face
+    // coordinates, with tc growing along the rows in memory
+    static void faceDirection(int face, float sc, float tc, float *d)
+    {
+        // per face: which of (1, sc, tc) goes into x, y and z, and its sign
+        static const int axis[6][3] = {{0, 2, 1}, {0, 2, 1}, {1, 0, 2}, {1, 0, 2}, {1, 2, 0}, {1, 2, 0}};
+        static const float sign[6][3] = {{1, -1, -1}, {-1, -1, 1}, {1, 1, 1}, {1, -1, -1}, {1, -1, 1}, {-1, -1, -1}};
+        const float values[3] = {1.0f, sc, tc};
+        for (int i = 0; i < 3; i++)
+            d[i] = values[axis[face][i]] * sign[face][i];
+    }
+
+    // dst += weight * image(x, y), wrapping x and clamping y
+    static void sampleBilinear(const std::vector<float> &image, int width, int height, int channels, float x, float y, float weight, float *dst)
+    {
+        int x0 = (int)std::floor(x), y0 = (int)std::floor(y);
+        float fx = x - x0, fy = y - y0;
+        int columns[2] = {((x0 % width) + width) % width, ((x0 + 1) % width + width) % width};
+        int rows[2] = {std::min(std::max(y0, 0), height - 1), std::min(std::max(y0 + 1, 0), height - 1)};
+        float weights[4] = {(1 - fx) * (1 - fy), fx * (1 - fy), (1 - fx) * fy, fx * fy};
+        for (int i = 0; i < 4; i++)
+        {
+            const float *texel = &image[((size_t)rows[i / 2] * width + columns[i % 2]) * channels];
+            for (int c = 0; c < channels; c++)
+                dst[c] += texel[c] * weights[i] * weight;
+        }
+    }
+
+    // Shelf packs the images into one atlasSize square, tallest first. Each
+    // image sits in a cell with atlasPadding texels of its own edge repeated
+    // around it, and cells are aligned to 2^maxLevel so that with a box
+    // filter every texel of every kept level averages texels of one cell
+    // only. Levels whose gutter would shrink below a texel are not built.
+    static void decodeAtlas(const DecodeRequest &request, DecodedImage &image)
+    {
+        int size = request.atlasSize, padding = request.atlasPadding;
+        int maxLevel = 0;
+        while ((2 << maxLevel) <= padding)
+            maxLevel++;
+        int align = 1 << maxLevel;
+
+        int count = (int)request.paths.size();
+        std::vector<std::vector<unsigned char>> sources(count);
+        std::vector<int> widths(count), heights(count), order(count);
+        for (int i = 0; i < count; i++)
+        {
+            if (!loadPixels(request.paths[i], request, sources[i], widths[i], heights[i], image.channels, image.error))
+            {
+                image.error = request.paths[i] + ": " + image.error;
+                return;
+            }
+            order[i] = i;
+        }
+        std::stable_sort(order.begin(), order.end(), [&](int a, int b)
+                         { return heights[a] > heights[b]; });
+
+        int channels = image.channels;
+        image.pixels.assign((size_t)size * size * channels, 0);
+        image.rects.resize(count);
+        int x = 0, y = 0, shelfHeight = 0;
+        for (int i : order)
+        {
+            int cellWidth = (widths[i] + 2 * padding + align - 1) / align * align;
+            int cellHeight = (heights[i] + 2 * padding + align - 1) / align * align;
+            if (x + cellWidth > size)
+            {
+                x = 0;
+                y += shelfHeight;
+                shelfHeight = 0;
+            }
+            if (cellWidth > size || y + cellHeight > size)
+            {
+                image.error = "atlas of " + std::to_string(size) + " is full at " + request.paths[i];
+                return;
+            }
+
+            // the cell is the image clamped to its edges
+            for (int row = 0; row < cellHeight; row++)
+            {
+                int sy = std::min(std::max(row - padding, 0), heights[i] - 1);
+                const unsigned char *src = sources[i].data() + (size_t)sy * widths[i] * channels;
+                unsigned char *dst = image.pixels.data() + ((size_t)(y + row) * size + x) * channels;
+                for (int column = 0; column < cellWidth; column++)
+                {
+                    int sx = std::min(std::max(column - padding, 0), widths[i] - 1);
+                    memcpy(dst + column * channels, src + sx * channels, channels);
+                }
+            }
+            image.rects[i] = {(float)(x + padding) / size, (float)(y + padding) / size, (float)widths[i] / size, (float)heights[i] / size};
+            std::vector<unsigned char>().swap(sources[i]);
+            x += cellWidth;
+            shelfHeight = std::max(shelfHeight, cellHeight);
+        }
+
+        image.width = size;
+        image.height = size;
+        image.levels.push_back({0, image.pixels.size(), size, size});
+        if (request.mipmaps)
+        {
+            MipOptions options = request.mipOptions;
+            options.filter = MIP_FILTER_BOX;
+            options.wrapU = options.wrapV = false;
+            MipGenerator::buildChain(image.pixels, image.levels, channels, options, maxLevel + 1);
+        }
+        image.ok = true;
+    }
+
+    static bool isKtx2(const std::string &path)
+    {
+        return path.size() > 5 && path.compare(path.size() - 5, 5, ".ktx2") == 0;
+    }
+
+    // KTX2 already stores its mip chain (and is usually block compressed), so
+    // there's nothing to decode: the quality cap just skips the top entries.
+    // Orientation is baked in when the file is cooked.
+    static void decodeKtx2(const DecodeRequest &request, DecodedImage &image)
+    {
+        Ktx2Image ktx;
+        if (!loadKtx2(request.path, request.compressedFamilies, ktx, image.error))
+            return;
+
+        size_t skip = 0;
+        // the quality cap can only skip stored levels
+        while (request.maxSize > 0 && skip + 1 < ktx.levels.size() &&
+               std::max(ktx.levels[skip].width, ktx.levels[skip].height) > request.maxSize)
+            skip++;
+        image.levels.assign(ktx.levels.begin() + skip, ktx.levels.end());
+        image.dropLevels = (int)skip;
+        image.width = image.levels[0].width;
+        image.height = image.levels[0].height;
+        image.channels = ktx.channels;
+        image.compressedFormat = ktx.glFormat;
+        image.pixels = std::move(ktx.data);
+        if (!image.compressedFormat && image.levels.size() == 1 && request.mipmaps)
+            MipGenerator::buildChain(image.pixels, image.levels, image.channels, request.mipOptions);
+        image.ok = true;
+    }
+
+    void deliver(DecodedImage &&image)
+    {
+        while (!finished.push(std::move(image)))
+        {
+            if (pool.threadCount() == 0)
+            {
+                overflow.push_back(std::move(image));
+                return;
+            }
+            std::this_thread::yield();
+        }
+    }
+};
+#endif
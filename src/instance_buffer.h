@@ -0,0 +1,115 @@
+#ifndef INSTANCE_BUFFER_H
+#define INSTANCE_BUFFER_H
+
+#ifdef __EMSCRIPTEN__
+#include <GLES3/gl3.h>
+#else
+#include <glad/glad.h>
+#endif
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <cstddef>
+#include <vector>
+
+#include "gl_state.h"
+
+// First vertex attribute used by instance data; Mesh takes 0-2 for position,
+// normal and texture coordinates. Instanced shaders declare
+//   layout (location = 3) in vec4 iPositionScale;
+//   layout (location = 4) in vec4 iRotation;
+//   layout (location = 5) in float iMaterial;
+const GLuint INSTANCE_ATTRIB_LOCATION = 3;
+
+// One copy of a mesh, 36 bytes instead of a 64 byte model matrix. Positions
+// are relative to the model matrix of the ObjectBlock slot bound for the draw.
+struct InstanceData
+{
+    glm::vec3 position;
+    float scale;
+    // unit quaternion, xyz then w
+    glm::vec4 rotation;
+    // texture array layer
+    float material;
+
+    static InstanceData make(const glm::vec3 &position, float scale, const glm::quat &rotation, float material)
+    {
+        return {position, scale, glm::vec4(rotation.x, rotation.y, rotation.z, rotation.w), material};
+    }
+};
+
+// Per-instance vertex buffer. Its attributes advance once per instance
+// (glVertexAttribDivisor) and are hooked into a mesh VAO by attach().
+class InstanceBuffer
+{
+public:
+    InstanceBuffer()
+    {
+        glGenBuffers(1, &VBO);
+    }
+
+    ~InstanceBuffer()
+    {
+        glState.forgetBuffer(VBO);
+        glDeleteBuffers(1, &VBO);
+    }
+
+    InstanceBuffer(const InstanceBuffer &) = delete;
+    InstanceBuffer &operator=(const InstanceBuffer &) = delete;
+
+    // replaces the contents; a new store is allocated so draws still using
+    // the old data don't stall the upload
+    void upload(const std::vector<InstanceData> &instances, GLenum usage = GL_STATIC_DRAW)
+    {
+        glState.bindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(InstanceData), instances.data(), usage);
+        count = (GLsizei)instances.size();
+    }
+
+    // sizes the store for `capacity` instances without filling it, for
+    // buffers the gpu writes (transform feedback); size() stays 0 until
+    // setSize()
+    void reserve(GLsizei capacity, GLenum usage = GL_STREAM_COPY)
+    {
+        glState.bindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)capacity * sizeof(InstanceData), nullptr, usage);
+        count = 0;
+    }
+
+    // fills part of a reserved store; size() is the caller's to set
+    void write(GLsizei first, const InstanceData *instances, GLsizei count)
+    {
+        glState.bindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)first * sizeof(InstanceData), (GLsizeiptr)count * sizeof(InstanceData), instances);
+    }
+
+    // how many instances a gpu written buffer holds
+    void setSize(GLsizei instances)
+    {
+        count = instances;
+    }
+
+    // points the instance attributes of the bound VAO at this buffer
+    void attach() const
+    {
+        glState.bindBuffer(GL_ARRAY_BUFFER, VBO);
+        GLuint location = INSTANCE_ATTRIB_LOCATION;
+        glEnableVertexAttribArray(location);
+        glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void *)offsetof(InstanceData, position));
+        glVertexAttribDivisor(location, 1);
+        glEnableVertexAttribArray(location + 1);
+        glVertexAttribPointer(location + 1, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void *)offsetof(InstanceData, rotation));
+        glVertexAttribDivisor(location + 1, 1);
+        glEnableVertexAttribArray(location + 2);
+        glVertexAttribPointer(location + 2, 1, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void *)offsetof(InstanceData, material));
+        glVertexAttribDivisor(location + 2, 1);
+    }
+
+    GLuint id() const { return VBO; }
+    GLsizei size() const { return count; }
+
+private:
+    GLuint VBO = 0;
+    GLsizei count = 0;
+};
+#endif
@@ -0,0 +1,329 @@
+#ifndef KTX2_H
+#define KTX2_H
+
+#ifdef __EMSCRIPTEN__
+#include <GLES3/gl3.h>
+#else
+#include <glad/glad.h>
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifdef SOLAR_HAS_BASISU
+#include "basisu/transcoder/basisu_transcoder.h"
+#endif
+
+// Block-compressed formats this file knows how to upload, grouped by the
+// extension that enables them.
+enum CompressedFamily
+{
+    FAMILY_S3TC = 1 << 0, // BC1-BC3
+    FAMILY_BPTC = 1 << 1, // BC7
+    FAMILY_ETC2 = 1 << 2, // ETC2 and EAC
+    FAMILY_ASTC = 1 << 3  // ASTC LDR
+};
+
+// Queries which compressed families the current context can sample. Must run
+// on the GL thread; the result is a plain bitmask that workers can use.
+inline unsigned int queryCompressedFamilies()
+{
+    unsigned int families = 0;
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; i++)
+    {
+        const char *ext = (const char *)glGetStringi(GL_EXTENSIONS, i);
+        if (!ext)
+            continue;
+        if (strstr(ext, "compressed_texture_s3tc") || strstr(ext, "texture_compression_s3tc"))
+            families |= FAMILY_S3TC;
+        if (strstr(ext, "texture_compression_bptc"))
+            families |= FAMILY_BPTC;
+        if (strstr(ext, "compressed_texture_etc") && !strstr(ext, "etc1"))
+            families |= FAMILY_ETC2;
+        if (strstr(ext, "ES3_compatibility"))
+            families |= FAMILY_ETC2;
+        if (strstr(ext, "texture_compression_astc") || strstr(ext, "compressed_texture_astc"))
+            families |= FAMILY_ASTC;
+    }
+#ifndef __EMSCRIPTEN__
+    // ETC2/EAC are core from GL 4.3
+    GLint major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    if (major > 4 || (major == 4 && minor >= 3))
+        families |= FAMILY_ETC2;
+#endif
+    return families;
+}
+
+struct CompressedFormatInfo
+{
+    uint32_t vkFormat;
+    GLenum glFormat;
+    unsigned int family;
+    int blockWidth;
+    int blockHeight;
+    int blockBytes;
+    const char *name;
+};
+
+inline const CompressedFormatInfo *findCompressedFormat(uint32_t vkFormat)
+{
+    static const CompressedFormatInfo formats[] = {
+        {131, 0x83F0, FAMILY_S3TC, 4, 4, 8, "bc1"},
+        {132, 0x8C4C, FAMILY_S3TC, 4, 4, 8, "bc1 srgb"},
+        {133, 0x83F1, FAMILY_S3TC, 4, 4, 8, "bc1a"},
+        {134, 0x8C4D, FAMILY_S3TC, 4, 4, 8, "bc1a srgb"},
+        {135, 0x83F2, FAMILY_S3TC, 4, 4, 16, "bc2"},
+        {136, 0x8C4E, FAMILY_S3TC, 4, 4, 16, "bc2 srgb"},
+        {137, 0x83F3, FAMILY_S3TC, 4, 4, 16, "bc3"},
+        {138, 0x8C4F, FAMILY_S3TC, 4, 4, 16, "bc3 srgb"},
+        {145, 0x8E8C, FAMILY_BPTC, 4, 4, 16, "bc7"},
+        {146, 0x8E8D, FAMILY_BPTC, 4, 4, 16, "bc7 srgb"},
+        {147, 0x9274, FAMILY_ETC2, 4, 4, 8, "etc2 rgb"},
+        {148, 0x9275, FAMILY_ETC2, 4, 4, 8, "etc2 rgb srgb"},
+        {149, 0x9276, FAMILY_ETC2, 4, 4, 8, "etc2 rgba1"},
+        {150, 0x9277, FAMILY_ETC2, 4, 4, 8, "etc2 rgba1 srgb"},
+        {151, 0x9278, FAMILY_ETC2, 4, 4, 16, "etc2 rgba"},
+        {152, 0x9279, FAMILY_ETC2, 4, 4, 16, "etc2 rgba srgb"},
+        {153, 0x9270, FAMILY_ETC2, 4, 4, 8, "eac r11"},
+        {154, 0x9271, FAMILY_ETC2, 4, 4, 8, "eac r11 snorm"},
+        {155, 0x9272, FAMILY_ETC2, 4, 4, 16, "eac rg11"},
+        {156, 0x9273, FAMILY_ETC2, 4, 4, 16, "eac rg11 snorm"},
+        {157, 0x93B0, FAMILY_ASTC, 4, 4, 16, "astc 4x4"},
+        {158, 0x93D0, FAMILY_ASTC, 4, 4, 16, "astc 4x4 srgb"},
+        {159, 0x93B1, FAMILY_ASTC, 5, 4, 16, "astc 5x4"},
+        {160, 0x93D1, FAMILY_ASTC, 5, 4, 16, "astc 5x4 srgb"},
+        {161, 0x93B2, FAMILY_ASTC, 5, 5, 16, "astc 5x5"},
+        {162, 0x93D2, FAMILY_ASTC, 5, 5, 16, "astc 5x5 srgb"},
+        {163, 0x93B3, FAMILY_ASTC, 6, 5, 16, "astc 6x5"},
+        {164, 0x93D3, FAMILY_ASTC, 6, 5, 16, "astc 6x5 srgb"},
+        {165, 0x93B4, FAMILY_ASTC, 6, 6, 16, "astc 6x6"},
+        {166, 0x93D4, FAMILY_ASTC, 6, 6, 16, "astc 6x6 srgb"},
+        {167, 0x93B5, FAMILY_ASTC, 8, 5, 16, "astc 8x5"},
+        {168, 0x93D5, FAMILY_ASTC, 8, 5, 16, "astc 8x5 srgb"},
+        {169, 0x93B6, FAMILY_ASTC, 8, 6, 16, "astc 8x6"},
+        {170, 0x93D6, FAMILY_ASTC, 8, 6, 16, "astc 8x6 srgb"},
+        {171, 0x93B7, FAMILY_ASTC, 8, 8, 16, "astc 8x8"},
+        {172, 0x93D7, FAMILY_ASTC, 8, 8, 16, "astc 8x8 srgb"},
+        {173, 0x93B8, FAMILY_ASTC, 10, 5, 16, "astc 10x5"},
+        {174, 0x93D8, FAMILY_ASTC, 10, 5, 16, "astc 10x5 srgb"},
+        {175, 0x93B9, FAMILY_ASTC, 10, 6, 16, "astc 10x6"},
+        {176, 0x93D9, FAMILY_ASTC, 10, 6, 16, "astc 10x6 srgb"},
+        {177, 0x93BA, FAMILY_ASTC, 10, 8, 16, "astc 10x8"},
+        {178, 0x93DA, FAMILY_ASTC, 10, 8, 16, "astc 10x8 srgb"},
+        {179, 0x93BB, FAMILY_ASTC, 10, 10, 16, "astc 10x10"},
+        {180, 0x93DB, FAMILY_ASTC, 10, 10, 16, "astc 10x10 srgb"},
+        {181, 0x93BC, FAMILY_ASTC, 12, 10, 16, "astc 12x10"},
+        {182, 0x93DC, FAMILY_ASTC, 12, 10, 16, "astc 12x10 srgb"},
+        {183, 0x93BD, FAMILY_ASTC, 12, 12, 16, "astc 12x12"},
+        {184, 0x93DD, FAMILY_ASTC, 12, 12, 16, "astc 12x12 srgb"},
+    };
+    for (const CompressedFormatInfo &format : formats)
+        if (format.vkFormat == vkFormat)
+            return &format;
+    return nullptr;
+}
+
+inline const CompressedFormatInfo *findCompressedFormatByGL(GLenum glFormat)
+{
+    for (uint32_t vk = 131; vk <= 184; vk++)
+    {
+        const CompressedFormatInfo *format = findCompressedFormat(vk);
+        if (format && format->glFormat == glFormat)
+            return format;
+    }
+    return nullptr;
+}
+
+struct ImageLevel
+{
+    size_t offset;
+    size_t size;
+    int width;
+    int height;
+};
+
+// A KTX2 file read into memory, ready for upload. For compressed formats
+// glFormat is the compressed internal format; otherwise channels says how
+// many 8-bit channels each texel has.
+struct Ktx2Image
+{
+    GLenum glFormat = 0;
+    int channels = 0;
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned char> data;
+    // largest level first
+    std::vector<ImageLevel> levels;
+};
+
+// Reads a KTX2 file. Block-compressed payloads that the context supports are
+// passed through as-is. Basis Universal payloads (BasisLZ/ETC1S or UASTC) are
+// transcoded to the best supported family, or RGBA8 as a last resort, when the
+// project is built with SOLAR_HAS_BASISU. Safe to call from worker threads.
+inline bool loadKtx2(const std::string &path, unsigned int families, Ktx2Image &image, std::string &error)
+{
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file.is_open())
+    {
+        error = "could not open file";
+        return false;
+    }
+    std::vector<unsigned char> bytes((size_t)file.tellg());
+    file.seekg(0, std::ios::beg);
+    file.read((char *)bytes.data(), bytes.size());
+
+    static const unsigned char identifier[12] = {0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A};
+    if (bytes.size() < 80 || memcmp(bytes.data(), identifier, 12) != 0)
+    {
+        error = "not a KTX2 file";
+        return false;
+    }
+    auto u32 = [&](size_t offset)
+    {
+        uint32_t value;
+        memcpy(&value, &bytes[offset], 4);
+        return value;
+    };
+    auto u64 = [&](size_t offset)
+    {
+        uint64_t value;
+        memcpy(&value, &bytes[offset], 8);
+        return value;
+    };
+
+    uint32_t vkFormat = u32(12);
+    uint32_t width = u32(20);
+    uint32_t height = u32(24);
+    uint32_t depth = u32(28);
+    uint32_t layers = u32(32);
+    uint32_t faces = u32(36);
+    uint32_t levelCount = u32(40) ? u32(40) : 1;
+    uint32_t supercompression = u32(44);
+    if (depth > 1 || layers > 1 || faces != 1)
+    {
+        error = "only single 2D images are supported";
+        return false;
+    }
+    if (bytes.size() < 80 + (size_t)levelCount * 24)
+    {
+        error = "truncated level index";
+        return false;
+    }
+
+    image.width = (int)width;
+    image.height = (int)height;
+
+    if (vkFormat == 0)
+    {
+#ifdef SOLAR_HAS_BASISU
+        static bool initialised = (basist::basisu_transcoder_init(), true);
+        (void)initialised;
+
+        basist::ktx2_transcoder transcoder;
+        if (!transcoder.init(bytes.data(), (uint32_t)bytes.size()) || !transcoder.start_transcoding())
+        {
+            error = "basis transcoder rejected the file";
+            return false;
+        }
+
+        // best quality per byte first, RGBA8 when nothing compressed is available
+        basist::transcoder_texture_format target = basist::transcoder_texture_format::cTFRGBA32;
+        GLenum glFormat = 0;
+        if (families & FAMILY_ASTC)
+            target = basist::transcoder_texture_format::cTFASTC_4x4_RGBA, glFormat = 0x93B0;
+        else if (families & FAMILY_BPTC)
+            target = basist::transcoder_texture_format::cTFBC7_RGBA, glFormat = 0x8E8C;
+        else if (families & FAMILY_ETC2)
+            target = basist::transcoder_texture_format::cTFETC2_RGBA, glFormat = 0x9278;
+        else if (families & FAMILY_S3TC)
+            target = basist::transcoder_texture_format::cTFBC3_RGBA, glFormat = 0x83F3;
+
+        uint32_t unitBytes = basist::basis_get_bytes_per_block_or_pixel(target);
+        for (uint32_t level = 0; level < transcoder.get_levels(); level++)
+        {
+            basist::ktx2_image_level_info info;
+            if (!transcoder.get_image_level_info(info, level, 0, 0))
+                break;
+            uint32_t units = glFormat ? info.m_total_blocks : info.m_orig_width * info.m_orig_height;
+            ImageLevel out = {image.data.size(), (size_t)units * unitBytes, (int)info.m_orig_width, (int)info.m_orig_height};
+            image.data.resize(out.offset + out.size);
+            if (!transcoder.transcode_image_level(level, 0, 0, &image.data[out.offset], units, target))
+            {
+                error = "basis transcode failed";
+                return false;
+            }
+            image.levels.push_back(out);
+        }
+        image.glFormat = glFormat;
+        image.channels = glFormat ? 0 : 4;
+        return !image.levels.empty();
+#else
+        (void)families;
+        error = "Basis Universal payload, build with WITH_BASISU to transcode it";
+        return false;
+#endif
+    }
+
+    if (supercompression != 0)
+    {
+        error = "supercompressed KTX2 needs the Basis transcoder";
+        return false;
+    }
+
+    int channels = 0;
+    switch (vkFormat)
+    {
+    case 9: // R8_UNORM
+        channels = 1;
+        break;
+    case 16: // R8G8_UNORM
+        channels = 2;
+        break;
+    case 23: // R8G8B8_UNORM
+    case 29: // R8G8B8_SRGB
+        channels = 3;
+        break;
+    case 37: // R8G8B8A8_UNORM
+    case 43: // R8G8B8A8_SRGB
+        channels = 4;
+        break;
+    }
+
+    const CompressedFormatInfo *format = findCompressedFormat(vkFormat);
+    if (!channels && !format)
+    {
+        error = "unsupported vkFormat " + std::to_string(vkFormat);
+        return false;
+    }
+    if (format && !(families & format->family))
+    {
+        error = std::string("this context cannot sample ") + format->name;
+        return false;
+    }
+
+    for (uint32_t level = 0; level < levelCount; level++)
+    {
+        uint64_t offset = u64(80 + level * 24);
+        uint64_t length = u64(80 + level * 24 + 8);
+        if (offset + length > bytes.size())
+        {
+            error = "level data out of range";
+            return false;
+        }
+        ImageLevel out = {image.data.size(), (size_t)length, std::max(1, (int)width >> level), std::max(1, (int)height >> level)};
+        image.data.insert(image.data.end(), bytes.begin() + offset, bytes.begin() + offset + length);
+        image.levels.push_back(out);
+    }
+    image.glFormat = format ? format->glFormat : 0;
+    image.channels = channels;
+    return true;
+}
+#endif
@@ -15,6 +15,20 @@
 #include "camera.h"
 #include "model.h"
 #include "mesh.h"
+#include "transform_batch.h"
+#include "gpu_timer.h"
+#include "frame_stats.h"
+#include "pixel_convert.h"
+#include "block_compress.h"
+#include "virtual_texture.h"
+#include "render_queue.h"
+#include "command_list.h"
+#include "outline_pass.h"
+#include "scene_bvh.h"
+#include "occlusion_culler.h"
+#include "software_occlusion.h"
+#include "gpu_instance_culler.h"
+#include "clustered_lights.h"
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
@@ -26,6 +40,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <random>
+#include <chrono>
 GLFWwindow *window;
 Camera camera(glm::vec3(0.0f, 3.0f, 33.0f));
 
@@ -38,21 +53,130 @@ bool firstMouse = true;
 
 const unsigned int SCR_WIDTH = 800;
 const unsigned int SCR_HEIGHT = 600;
+const unsigned int TEXTURE_BUDGET_MB = 256;
+const unsigned int UPLOAD_BUDGET_KB_PER_FRAME = 4096;
+const int VT_PAGES_PER_FRAME = 8;
+// the gas giant's ring: rocks of each shape go out in one instanced draw
+const int BELT_ROCKS = 100000;
+const int ROCK_SHAPES = 3;
+// rock meshes per shape, 3, 2 and 1 subdivisions, used by the gpu culled belt
+const int ROCK_LODS = GpuInstanceCuller::LODS;
+// the belt is occlusion tested in this many slices rather than rock by rock
+const int BELT_SECTORS = 32;
+// small moving lights around the planets, the ring and the floor;
+// SOLAR_LIGHTS changes the count
+const int CRAFT_LIGHTS = 256;
+// baked from the Mercury diffuse map on first run; SOLAR_VT_SOURCE bakes
+// another image (say a 16K planet map) in its place
+const char *VT_PAGE_FILE = "res/textures/planet.vtex";
+const char *VT_DEFAULT_SOURCE = "res/models/mercury/Textures/Diffuse_1K.png";
 
 unsigned int InteriorWallTexture;
 unsigned int quadVBO[1];
 unsigned int cubeVBO[1];
 unsigned int planeVBO[1];
 unsigned int cubeVAO, planeVAO, quadVAO;
+unsigned int sphereVAO, sphereVBO, sphereEBO, sphereIndexCount;
+unsigned int cubeSphereVAO, cubeSphereVBO, cubeSphereEBO, cubeSphereIndexCount;
 Shader *shader = nullptr;
-Shader *shaderSingleColor = nullptr;
+Shader *planetShader = nullptr;
+Shader *planetCubeShader = nullptr;
+Shader *gasGiantShader = nullptr;
+Shader *instancedShader = nullptr;
+VirtualTexture *planetSurface = nullptr;
+TransformBatch *transforms = nullptr;
+GpuTimer *sceneTimer = nullptr;
+unsigned int floorSlot, cubeSlots[2], planetSlot, venusSlot, gasGiantSlot, beltSlot;
+Mesh *rocks[ROCK_SHAPES][ROCK_LODS];
+InstanceBuffer *rockInstances[ROCK_SHAPES];
+// the belt culled by transform feedback instead of through sceneBVH; the
+// rocks then never touch the cpu after startup
+bool gpuCull = false;
+GpuInstanceCuller *rockCullers[ROCK_SHAPES] = {};
+// bounding spheres of the slots above and then of every rock; a slot's id is
+// its TransformBatch slot, rock i is firstRockId + i
+SceneBVH *sceneBVH = nullptr;
+ThreadPool *cullPool = nullptr;
+unsigned int firstRockId;
+// the rocks as last moved, their orbits (radius, start angle, angular speed)
+// and the radius of a unit rock mesh
+std::vector<InstanceData> beltRocks;
+std::vector<glm::vec3> beltOrbits;
+float rockRadius = 1.0f;
+// world space bounding spheres, written by the cull pool
+std::vector<glm::vec4> rockBounds;
+std::vector<uint32_t> visibleIds;
+// per id, whether it survived this frame's cull
+std::vector<unsigned char> idVisible;
+// the frame's draws, recorded on the cull pool a slice of the visible set
+// each and replayed by the render queue
+std::vector<CommandList *> sceneLists;
+// occlusion proxies: one per slot, same ids, then one per belt sector
+OcclusionCuller *occlusion = nullptr;
+unsigned int firstSectorProxy;
+std::vector<unsigned char> rockSector;
+// per sector, whether any of its rocks passed the frustum / occlusion tests
+unsigned char sectorInFrustum[BELT_SECTORS], sectorVisible[BELT_SECTORS];
+glm::vec3 sectorCenter[BELT_SECTORS], sectorExtent[BELT_SECTORS];
+// the planets rasterized on the cpu, so what they hide is dropped the same
+// frame instead of a frame after the queries notice
+SoftwareOcclusion *softOcclusion = nullptr;
+OccluderMesh planetOccluder;
+bool softOcclusionEnabled = true;
+// point lights shaded through clusters, one per craft; each craft circles
+// `center` in the plane of axisU and axisV
+struct CraftOrbit
+{
+    glm::vec3 center;
+    glm::vec3 axisU, axisV;
+    float speed;
+    float phase;
+};
+ClusteredLights *clusteredLights = nullptr;
+std::vector<CraftOrbit> craftOrbits;
 void framebuffer_size_callback(GLFWwindow *window, int width, int height);
 void mouse_callback(GLFWwindow *window, double xpos, double ypos);
 void scroll_callback(GLFWwindow *window, double xoffset, double yoffset);
 void processInput(GLFWwindow *window);
-unsigned int loadTexture(const char *path);
-unsigned int cubeTexture, floorTexture;
+// one texture array for the whole scene, so draws only switch layers
+TextureHandle sceneTextures;
+TextureHandle venusSurface;
+// made on a decode worker and block compressed there
+TextureHandle gasGiantSurface;
+enum SceneLayer
+{
+    LAYER_METAL = 0,
+    LAYER_MERCURY = 1
+};
+// render queue passes, drawn in this order
+enum ScenePass
+{
+    PASS_OPAQUE = 0
+};
+RenderQueue *renderQueue = nullptr;
+OutlinePass *outline = nullptr;
+// cubes drawn with the selection outline
+std::vector<unsigned int> selectedCubes;
+// the floor and cubes share a material and pick their layer per draw
+GLint sceneLayerLocation = -1;
+Material *sceneMaterial, *planetMaterial, *venusMaterial, *gasGiantMaterial, *beltMaterial;
 void genVertexAttribs(GLuint *VAO, float *verticesName, GLuint *VBO, int size);
+float screenCoverage(unsigned int slot, float radius);
+unsigned int genSphere(unsigned int *VAO, unsigned int *VBO, unsigned int *EBO, int segments, int rings);
+unsigned int genCubeSphere(unsigned int *VAO, unsigned int *VBO, unsigned int *EBO, int subdivisions);
+void generateGasGiant(unsigned char *rgba, int width, int height);
+Mesh genRock(unsigned int seed, int subdivisions);
+std::vector<InstanceData> genBelt(int count, unsigned int seed);
+glm::mat4 beltModel();
+unsigned int addBody(const glm::mat4 &model, float radius);
+void moveBelt(float time);
+void addBeltSectors();
+void addCraftLights(int count, unsigned int seed);
+void moveCraftLights(float time);
+void benchmarkInstancing();
+void recordScene(ThreadPool &pool, std::vector<CommandList *> &lists);
+void recordBody(CommandList &list, unsigned int slot);
+void benchmarkRecording();
 
 void main_loop()
 {
@@ -61,55 +185,117 @@ void main_loop()
     lastFrame = currentFrame;
     processInput(window);
     glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT); // don't forget to clear the stencil buffer!
-    // set uniforms
-    shaderSingleColor->use();
-    glm::mat4 model = glm::mat4(1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    // per-object matrices are computed once on the cpu and shared through ObjectBlock
     glm::mat4 view = camera.GetViewMatrix();
     glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-    shaderSingleColor->setMat4("view", view);
-    shaderSingleColor->setMat4("projection", projection);
-    shader->use();
-    shader->setMat4("view", view);
-    shader->setMat4("projection", projection);
-    glStencilMask(0x00);
-    glBindVertexArray(planeVAO);
-    glBindTexture(GL_TEXTURE_2D, floorTexture);
-    shader->setMat4("model", glm::mat4(1.0f));
-    glDrawArrays(GL_TRIANGLES, 0, 6);
-    glBindVertexArray(0);
-    glStencilFunc(GL_ALWAYS, 1, 0xFF);
-    glStencilMask(0xFF);
-
-    // cubes
-    glBindVertexArray(cubeVAO);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, cubeTexture);
-    model = glm::translate(model, glm::vec3(-1.0f, 0.0f, -1.0f));
-    shader->setMat4("model", model);
-    glDrawArrays(GL_TRIANGLES, 0, 36);
-    model = glm::mat4(1.0f);
-    model = glm::translate(model, glm::vec3(2.0f, 0.0f, 0.0f));
-    shader->setMat4("model", model);
-    glDrawArrays(GL_TRIANGLES, 0, 36);
-    glStencilFunc(GL_NOTEQUAL, 1, 0xFF);
-    glStencilMask(0x00);
-    glDisable(GL_DEPTH_TEST);
-    shaderSingleColor->use();
-    float scale = 1.1f;
-    // cubes PULLED CHANGES
-    glBindVertexArray(cubeVAO);
-    glBindTexture(GL_TEXTURE_2D, cubeTexture);
-    model = glm::mat4(1.0f);
-    model = glm::translate(model, glm::vec3(-1.0f, 0.0f, -1.0f));
-    model = glm::scale(model, glm::vec3(scale, scale, scale));
-    shaderSingleColor->setMat4("model", model);
-    glDrawArrays(GL_TRIANGLES, 0, 36);
-
-    glBindVertexArray(0);
-    glStencilMask(0xFF);
-    glStencilFunc(GL_ALWAYS, 0, 0xFF);
-    glEnable(GL_DEPTH_TEST);
+    transforms->compute(view, projection);
+    transforms->upload();
+    occlusion->beginFrame();
+    renderQueue->setEye(camera.Position);
+
+    // the rocks orbit on their own, so the hierarchy is refitted every frame
+    // before the cull
+    if (!gpuCull)
+        moveBelt(currentFrame);
+    sceneBVH->update();
+    sceneBVH->cull(projection * view, visibleIds, cullPool);
+    // then whatever is in view is checked against the planets' cpu depth and
+    // last frame's occlusion queries; the belt goes by sector
+    if (softOcclusionEnabled)
+    {
+        softOcclusion->clear();
+        // only what will really be drawn may hide anything
+        if (planetSurface->ready())
+            softOcclusion->addOccluder(planetOccluder, transforms->models[planetSlot]);
+        for (unsigned int slot : {venusSlot, gasGiantSlot})
+            softOcclusion->addOccluder(planetOccluder, transforms->models[slot]);
+        softOcclusion->rasterize(projection * view, cullPool);
+    }
+    std::fill(idVisible.begin(), idVisible.end(), 0);
+    // gpu culled rocks aren't in the BVH: every sector goes on to the
+    // occlusion tests and the cull pass drops what is off screen
+    memset(sectorInFrustum, gpuCull ? 1 : 0, sizeof(sectorInFrustum));
+    for (uint32_t id : visibleIds)
+    {
+        if (id < firstRockId)
+        {
+            glm::vec4 bounds = sceneBVH->sphere(id);
+            idVisible[id] = (!softOcclusionEnabled || softOcclusion->visible(glm::vec3(bounds), glm::vec3(bounds.w))) &&
+                            occlusion->visible(id, screenCoverage(id, bounds.w));
+        }
+        else
+            sectorInFrustum[rockSector[id - firstRockId]] = 1;
+    }
+    for (int i = 0; i < BELT_SECTORS; i++)
+        sectorVisible[i] = sectorInFrustum[i] &&
+                           (!softOcclusionEnabled || softOcclusion->visible(sectorCenter[i], sectorExtent[i])) &&
+                           occlusion->visible(firstSectorProxy + i, screenCoverage(beltSlot, 0.3f));
+    if (gpuCull)
+    {
+        uint32_t sectorMask = 0;
+        for (int i = 0; i < BELT_SECTORS; i++)
+            sectorMask |= (uint32_t)sectorVisible[i] << i;
+        for (GpuInstanceCuller *culler : rockCullers)
+            culler->cull(transforms->models[beltSlot], projection * view, camera.Position, currentFrame, sectorMask, BELT_SECTORS);
+    }
+    // the workers can't touch GL, so the belt's buffers are paired with the
+    // rock VAOs here first
+    for (int i = 0; i < ROCK_SHAPES; i++)
+    {
+        if (gpuCull)
+            for (int lod = 0; lod < ROCK_LODS; lod++)
+                rocks[i][lod]->AttachInstances(rockCullers[i]->lod(lod));
+        else
+            rocks[i][0]->AttachInstances(*rockInstances[i]);
+    }
+    auto recordStart = std::chrono::steady_clock::now();
+    recordScene(*cullPool, sceneLists);
+    for (CommandList *list : sceneLists)
+        renderQueue->add(*list);
+    frameStats.recordMs += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - recordStart).count();
+
+    // the planet's virtual texture learns which pages it needs from a small
+    // feedback render, read back a frame later
+    if (planetSurface->ready())
+    {
+        planetSurface->beginFeedback(SCR_WIDTH, SCR_HEIGHT);
+        planetShader->use();
+        planetSurface->bind(*planetShader, 1, 2, true);
+        glState.bindVertexArray(sphereVAO);
+        transforms->bind(planetSlot);
+        glDrawElements(GL_TRIANGLES, sphereIndexCount, GL_UNSIGNED_INT, 0);
+        planetSurface->endFeedback();
+        planetSurface->update();
+    }
+
+    // bin the lights against this frame's view, with the scene viewport back
+    moveCraftLights(currentFrame);
+    clusteredLights->update(view, projection);
+
+    sceneTimer->begin();
+    renderQueue->flush();
+    // the depth buffer now holds everything drawn: test the hidden proxies
+    // and the visible ones due a recheck, read back next frame
+    occlusion->issue(projection * view, camera.Position, 0.1f);
+
+    // selection outline: selected objects only cover a mask, the outline
+    // itself costs the same full-screen passes however many there are
+    outline->beginMask();
+    glState.bindVertexArray(cubeVAO);
+    for (unsigned int slot : selectedCubes)
+    {
+        transforms->bind(slot);
+        glDrawArrays(GL_TRIANGLES, 0, 36);
+    }
+    outline->finish();
+    // the feedback render at the top of the next frame is depth tested
+    glState.setEnabled(GL_DEPTH_TEST, true);
+    sceneTimer->end();
+
+    textureManager().endFrame();
+    frameStats.gpuSceneMs = sceneTimer->lastMs;
+    frameStats.endFrame(currentFrame);
 
     glfwSwapBuffers(window);
     glfwPollEvents();
@@ -117,6 +303,20 @@ void main_loop()
 
 int main()
 {
+    // SOLAR_PIXEL_BENCH times the texture ingestion kernels on 1K-8K images
+    if (getenv("SOLAR_PIXEL_BENCH"))
+        PixelConvert::benchmark();
+    // SOLAR_BLOCK_BENCH times the runtime BC/ETC2 encoders at every quality
+    if (getenv("SOLAR_BLOCK_BENCH"))
+        BlockCompress::benchmark();
+    // SOLAR_CULL_BENCH times BVH builds, refits and frustum culls up to 100K objects
+    if (getenv("SOLAR_CULL_BENCH"))
+        SceneBVH::benchmark();
+    // SOLAR_TRANSFORM_BENCH times the batched MVP and normal matrices against
+    // computing them object by object
+    if (getenv("SOLAR_TRANSFORM_BENCH"))
+        TransformBatch::benchmark();
+
     if (!glfwInit())
         return -1;
 
@@ -146,17 +346,48 @@ int main()
         std::cout << "Failed to initialize GLAD" << std::endl;
         return -1;
     }
+    // cube maps filter across face edges, like WebGL always does
+    glState.setEnabled(GL_TEXTURE_CUBE_MAP_SEAMLESS, true);
 #endif
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+    int framebufferWidth, framebufferHeight;
+    glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+    glState.viewport(0, 0, framebufferWidth, framebufferHeight);
     glfwSetCursorPosCallback(window, mouse_callback);
     glfwSetScrollCallback(window, scroll_callback);
 
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
-    stbi_set_flip_vertically_on_load(true);
-
     shader = new Shader("res/shaders/5.1.framebuffers.vs", "res/shaders/5.1.framebuffers.fs");
-    shaderSingleColor = new Shader("res/shaders/5.1.framebuffers_screen.vs", "res/shaders/5.1.framebuffers_screen.fs");
+    shader->bindUniformBlock("ObjectBlock", OBJECT_BLOCK_BINDING);
+    planetShader = new Shader("res/shaders/planet.vs", "res/shaders/planet_vt.fs");
+    planetShader->bindUniformBlock("ObjectBlock", OBJECT_BLOCK_BINDING);
+    planetCubeShader = new Shader("res/shaders/planet_cube.vs", "res/shaders/planet_cube.fs");
+    planetCubeShader->bindUniformBlock("ObjectBlock", OBJECT_BLOCK_BINDING);
+    gasGiantShader = new Shader("res/shaders/planet.vs", "res/shaders/planet.fs");
+    gasGiantShader->bindUniformBlock("ObjectBlock", OBJECT_BLOCK_BINDING);
+    instancedShader = new Shader("res/shaders/instanced.vs", "res/shaders/instanced.fs");
+    instancedShader->bindUniformBlock("ObjectBlock", OBJECT_BLOCK_BINDING);
+    instancedShader->use();
+    instancedShader->setVec3("lightDirection", glm::normalize(glm::vec3(0.4f, 1.0f, 0.3f)));
+    clusteredLights = new ClusteredLights();
+    for (Shader *lit : {shader, planetShader, planetCubeShader, gasGiantShader, instancedShader})
+        clusteredLights->attach(*lit);
+
+    transforms = new TransformBatch();
+    sceneTimer = new GpuTimer();
+    sceneBVH = new SceneBVH();
+    cullPool = new ThreadPool();
+    cullPool->start(ThreadPool::defaultThreadCount());
+    floorSlot = addBody(glm::mat4(1.0f), 7.1f);
+    cubeSlots[0] = addBody(glm::translate(glm::mat4(1.0f), glm::vec3(-1.0f, 0.0f, -1.0f)), 0.87f);
+    cubeSlots[1] = addBody(glm::translate(glm::mat4(1.0f), glm::vec3(2.0f, 0.0f, 0.0f)), 0.87f);
+    selectedCubes.push_back(cubeSlots[0]);
+    planetSlot = addBody(glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(-6.0f, 3.0f, -4.0f)), glm::vec3(2.5f)), 2.5f);
+    venusSlot = addBody(glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(6.0f, 3.0f, -4.0f)), glm::vec3(2.5f)), 2.5f);
+    gasGiantSlot = addBody(glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 7.0f, -12.0f)), glm::vec3(3.0f)), 3.0f);
+    // the rocks are culled one by one, the slot itself is never drawn
+    beltSlot = addBody(beltModel(), 0.0f);
 
     // --- VERTEX DATA ---
     float cubeVertices[] = {
@@ -215,29 +446,181 @@ int main()
 
     glGenVertexArrays(1, &cubeVAO);
     glGenBuffers(1, cubeVBO);
-    glBindVertexArray(cubeVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, *cubeVBO);
+    glState.bindVertexArray(cubeVAO);
+    glState.bindBuffer(GL_ARRAY_BUFFER, *cubeVBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(cubeVertices), &cubeVertices, GL_STATIC_DRAW);
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void *)0);
     glEnableVertexAttribArray(1);
     glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void *)(3 * sizeof(float)));
-    glBindVertexArray(0);
+    glState.bindVertexArray(0);
     // plane VAO
 
     glGenVertexArrays(1, &planeVAO);
     glGenBuffers(1, planeVBO);
-    glBindVertexArray(planeVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, *planeVBO);
+    glState.bindVertexArray(planeVAO);
+    glState.bindBuffer(GL_ARRAY_BUFFER, *planeVBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(planeVertices), &planeVertices, GL_STATIC_DRAW);
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void *)0);
     glEnableVertexAttribArray(1);
     glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void *)(3 * sizeof(float)));
-    glBindVertexArray(0);
+    glState.bindVertexArray(0);
+    sphereIndexCount = genSphere(&sphereVAO, &sphereVBO, &sphereEBO, 64, 32);
+    cubeSphereIndexCount = genCubeSphere(&cubeSphereVAO, &cubeSphereVBO, &cubeSphereEBO, 16);
+    beltRocks = genBelt(BELT_ROCKS, 7);
+    for (int i = 0; i < ROCK_SHAPES; i++)
+    {
+        for (int lod = 0; lod < ROCK_LODS; lod++)
+        {
+            rocks[i][lod] = new Mesh(genRock(i + 1, 3 - lod));
+            for (const Vertex &vertex : rocks[i][lod]->vertices)
+                rockRadius = std::max(rockRadius, glm::length(vertex.Position));
+        }
+        rockInstances[i] = new InstanceBuffer();
+    }
+    // SOLAR_GPU_CULL=1|0 culls the belt with transform feedback or on the
+    // cpu; the gpu by default on desktop, where the output is compacted
+#ifdef __EMSCRIPTEN__
+    gpuCull = false;
+#else
+    gpuCull = true;
+#endif
+    if (const char *gpuCullMode = getenv("SOLAR_GPU_CULL"))
+        gpuCull = atoi(gpuCullMode) != 0;
+    firstRockId = (unsigned int)sceneBVH->size();
+    if (gpuCull)
+    {
+        std::vector<InstanceData> shapeRocks[ROCK_SHAPES];
+        for (int i = 0; i < BELT_ROCKS; i++)
+            shapeRocks[i % ROCK_SHAPES].push_back(beltRocks[i]);
+        for (int i = 0; i < ROCK_SHAPES; i++)
+        {
+            rockCullers[i] = new GpuInstanceCuller(shapeRocks[i]);
+            // the same orbits moveBelt() follows
+            rockCullers[i]->orbitRate = 0.1f;
+            rockCullers[i]->boundRadius = rockRadius;
+            rockCullers[i]->lodDistances = glm::vec3(6.0f, 14.0f, 60.0f);
+        }
+    }
+    else
+    {
+        // closer rocks go round faster, as in a real ring
+        for (const InstanceData &rock : beltRocks)
+        {
+            float radius = glm::length(glm::vec2(rock.position.x, rock.position.z));
+            beltOrbits.push_back(glm::vec3(radius, std::atan2(rock.position.z, rock.position.x), 0.1f / (radius * std::sqrt(radius))));
+            sceneBVH->add(glm::vec3(0.0f), 0.0f);
+        }
+        moveBelt(0.0f);
+    }
+    std::cout << "[CULL] belt of " << BELT_ROCKS << " rocks culled on the " << (gpuCull ? "gpu" : "cpu") << std::endl;
+    idVisible.resize(sceneBVH->size());
+    occlusion = new OcclusionCuller();
+    softOcclusion = new SoftwareOcclusion(256, 192);
+    // every vertex is one of the 64 x 32 render sphere's, so it stays inside
+    // it; shrunk a little for the cube mapped planet's different tessellation
+    planetOccluder = OccluderMesh::sphere(16, 8);
+    for (glm::vec3 &position : planetOccluder.positions)
+        position *= 0.98f;
+    // SOLAR_OCCLUSION=gpu|cpu picks one occlusion culler, 0 turns both off
+    // to compare; both run by default
+    if (const char *occlusionMode = getenv("SOLAR_OCCLUSION"))
+    {
+        occlusion->enabled = strcmp(occlusionMode, "0") != 0 && strcmp(occlusionMode, "cpu") != 0;
+        softOcclusionEnabled = strcmp(occlusionMode, "0") != 0 && strcmp(occlusionMode, "gpu") != 0;
+    }
+    std::cout << "[OCCLUSION] gpu queries " << (occlusion->enabled ? "on" : "off") << ", cpu rasterizer "
+              << (softOcclusionEnabled ? "on" : "off") << " (" << SoftwareOcclusion::simdName() << ")" << std::endl;
+    for (unsigned int id = 0; id < firstRockId; id++)
+    {
+        glm::vec4 bounds = sceneBVH->sphere(id);
+        occlusion->add(glm::vec3(bounds), glm::vec3(bounds.w));
+    }
+    addBeltSectors();
+    int craftLights = CRAFT_LIGHTS;
+    if (const char *lightCount = getenv("SOLAR_LIGHTS"))
+        craftLights = std::clamp(atoi(lightCount), 0, ClusteredLights::MAX_LIGHTS);
+    addCraftLights(craftLights, 11);
+    std::cout << "[LIGHTS] " << craftLights << " point lights in " << ClusteredLights::CLUSTERS_X << "x"
+              << ClusteredLights::CLUSTERS_Y << "x" << ClusteredLights::CLUSTERS_Z << " clusters" << std::endl;
+
+    // SOLAR_DECODE_THREADS overrides the decode pool size to compare startup times
+    int decodeThreads = ThreadPool::defaultThreadCount();
+    if (const char *threads = getenv("SOLAR_DECODE_THREADS"))
+        decodeThreads = atoi(threads);
+    textureManager().setDecodeThreads(decodeThreads);
+    // SOLAR_TEXTURE_QUALITY=low|medium|high overrides the detected tier
+    TextureQuality quality = TextureQuality::choose(TEXTURE_BUDGET_MB * 1024u * 1024u, getenv("SOLAR_TEXTURE_QUALITY"));
+    quality.log();
+    textureManager().setQuality(quality);
+    textureManager().setBudget(quality.budgetBytes);
+    textureManager().setUploadBudget(UPLOAD_BUDGET_KB_PER_FRAME * 1024u);
+
+    auto loadStart = std::chrono::steady_clock::now();
+    // layers in SceneLayer order, resampled to a common size on the workers
+    sceneTextures = textureManager().acquireArray({"res/textures/metal.jpeg", "res/models/mercury/Textures/Diffuse_1K.png"}, 1024, 1024);
+    venusSurface = textureManager().acquireCubemap("res/textures/venus.jpg");
+    // SOLAR_BLOCK_QUALITY=fast|normal|high trades encode time for quality
+    TextureDesc generated = TextureDesc::equirect();
+    generated.compress = true;
+    if (const char *blockQuality = getenv("SOLAR_BLOCK_QUALITY"))
+        BlockCompress::parseQuality(blockQuality, generated.compressQuality);
+    gasGiantSurface = textureManager().acquireGenerated("gas giant", 2048, 1024, generateGasGiant, generated);
+    textureManager().waitForLoads();
+    std::cout << "[TEXTURES] startup decode took "
+              << std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - loadStart).count()
+              << " ms on " << textureManager().decodeThreads() << " decode threads" << std::endl;
+    textureManager().dumpInventory();
 
-    cubeTexture = loadTexture("res/textures/metal.jpeg");
-    floorTexture = loadTexture("res/textures/metal.jpeg");
+    // src/res ships a page file baked from VT_DEFAULT_SOURCE, which the web
+    // build preloads; desktop rebakes it from SOLAR_VT_SOURCE when set, or
+    // when the file is missing
+    const char *vtSource = getenv("SOLAR_VT_SOURCE");
+#ifndef __EMSCRIPTEN__
+    if (vtSource || !std::ifstream(VT_PAGE_FILE))
+    {
+        std::string error;
+        auto bakeStart = std::chrono::steady_clock::now();
+        if (PageFile::bake(vtSource ? vtSource : VT_DEFAULT_SOURCE, VT_PAGE_FILE, error))
+            std::cout << "[VT] baked " << VT_PAGE_FILE << " in "
+                      << std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - bakeStart).count() << " ms" << std::endl;
+        else
+            std::cout << "[VT] bake failed: " << error << std::endl;
+    }
+#endif
+    planetSurface = new VirtualTexture();
+    planetSurface->setPageBudget(VT_PAGES_PER_FRAME);
+    if (!planetSurface->open(VT_PAGE_FILE, quality.vtCacheSide))
+        std::cout << "[VT] ERROR: can't open " << VT_PAGE_FILE << ", the planet won't be drawn" << std::endl;
+
+    renderQueue = new RenderQueue(*transforms);
+    outline = new OutlinePass();
+    outline->maskShader().bindUniformBlock("ObjectBlock", OBJECT_BLOCK_BINDING);
+    // SOLAR_OUTLINE_WIDTH sets the outline width in pixels
+    if (const char *outlineWidth = getenv("SOLAR_OUTLINE_WIDTH"))
+        outline->setWidth((float)atof(outlineWidth));
+    sceneMaterial = new Material(*shader);
+    sceneMaterial->addTexture(0, GL_TEXTURE_2D_ARRAY, sceneTextures.id());
+    sceneLayerLocation = glGetUniformLocation(shader->ID, "layer");
+    for (int i = 0; i <= cullPool->threadCount(); i++)
+        sceneLists.push_back(new CommandList(*transforms));
+    planetMaterial = new Material(*planetShader);
+    planetMaterial->onBind = []
+    { planetSurface->bind(*planetShader, 1, 2, false); };
+    venusMaterial = new Material(*planetCubeShader);
+    venusMaterial->addTexture(0, GL_TEXTURE_CUBE_MAP, venusSurface.id());
+    gasGiantMaterial = new Material(*gasGiantShader);
+    gasGiantMaterial->addTexture(0, GL_TEXTURE_2D, gasGiantSurface.id());
+    beltMaterial = new Material(*instancedShader);
+    beltMaterial->addTexture(0, GL_TEXTURE_2D_ARRAY, sceneTextures.id());
+
+    // SOLAR_INSTANCE_BENCH compares one draw per rock with instanced draws
+    if (getenv("SOLAR_INSTANCE_BENCH"))
+        benchmarkInstancing();
+    // SOLAR_RECORD_BENCH times command list recording against thread count
+    if (getenv("SOLAR_RECORD_BENCH"))
+        benchmarkRecording();
 
 // --- The Main Loop Swap ---
 #ifdef __EMSCRIPTEN__
@@ -249,6 +632,8 @@ int main()
     }
 #endif
 
+    planetSurface->shutdown();
+    textureManager().shutdown();
     glfwTerminate();
     return 0;
 }
@@ -265,6 +650,13 @@ void processInput(GLFWwindow *window)
         camera.ProcessKeyboard(LEFT, deltaTime);
     if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
         camera.ProcessKeyboard(RIGHT, deltaTime);
+
+    // I: print the texture inventory
+    static bool inventoryKeyDown = false;
+    bool inventoryKey = glfwGetKey(window, GLFW_KEY_I) == GLFW_PRESS;
+    if (inventoryKey && !inventoryKeyDown)
+        textureManager().dumpInventory();
+    inventoryKeyDown = inventoryKey;
 }
 
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
@@ -273,7 +665,7 @@ void framebuffer_size_callback(GLFWwindow *window, int width, int height)
 {
     // make sure the viewport matches the new window dimensions; note that width and
     // height will be significantly larger than specified on retina displays.
-    glViewport(0, 0, width, height);
+    glState.viewport(0, 0, width, height);
 }
 
 // glfw: whenever the mouse moves, this callback is called
@@ -306,41 +698,565 @@ void scroll_callback(GLFWwindow *window, double xoffset, double yoffset)
     camera.ProcessMouseScroll(static_cast<float>(yoffset));
 }
 
-// utility function for loading a 2D texture from file
-// ---------------------------------------------------
-unsigned int loadTexture(char const *path)
+// rough on-screen diameter of an object's bounding sphere, drives mip streaming
+// -----------------------------------------------------------------------------
+float screenCoverage(unsigned int slot, float radius)
+{
+    glm::vec3 center = glm::vec3(transforms->models[slot][3]);
+    return TextureManager::screenCoverage(radius, glm::length(camera.Position - center), glm::radians(camera.Zoom), (float)SCR_HEIGHT);
+}
+
+// Records the frame's draws on `pool`, a slice of visibleIds into each of
+// `lists`: bodies as draw packets, cpu culled rocks as instances for their
+// shape's buffer. The belt's own draws go into the last list. Reads the
+// cull results, touches no GL.
+// -----------------------------------------------------------------------
+void recordScene(ThreadPool &pool, std::vector<CommandList *> &lists)
+{
+    size_t slices = lists.size();
+    pool.parallelFor(slices, 1, [&](size_t begin, size_t end)
+                     {
+        for (size_t slice = begin; slice < end; slice++)
+        {
+            CommandList &list = *lists[slice];
+            renderQueue->begin(list);
+            size_t first = visibleIds.size() * slice / slices, last = visibleIds.size() * (slice + 1) / slices;
+            for (size_t i = first; i < last; i++)
+            {
+                uint32_t id = visibleIds[i];
+                if (id < firstRockId)
+                {
+                    if (idVisible[id])
+                        recordBody(list, id);
+                }
+                else if (sectorVisible[rockSector[id - firstRockId]])
+                {
+                    idVisible[id] = 1;
+                    list.append(*rockInstances[(id - firstRockId) % ROCK_SHAPES], beltRocks[id - firstRockId]);
+                }
+            }
+            if (slice + 1 < slices)
+                continue;
+            // asteroid belt, the visible rocks in a draw per shape (and LOD
+            // when gpu culled); textures sized for about the biggest rock at
+            // the ring's distance
+            for (int i = 0; i < ROCK_SHAPES; i++)
+            {
+                if (gpuCull)
+                    for (int lod = 0; lod < ROCK_LODS; lod++)
+                        rocks[i][lod]->RecordInstanced(list, *beltMaterial, rockCullers[i]->lod(lod), PASS_OPAQUE, beltSlot,
+                                                       screenCoverage(beltSlot, 0.1f));
+                else
+                    rocks[i][0]->RecordInstanced(list, *beltMaterial, *rockInstances[i], PASS_OPAQUE, beltSlot, screenCoverage(beltSlot, 0.1f));
+            }
+        } });
+}
+
+// the draw of a visible body; the belt's slot has none of its own
+// -----------------------------------------------------------------------
+void recordBody(CommandList &list, unsigned int slot)
 {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(path, &width, &height, &nrComponents, 0);
-    if (data)
-    {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
+    if (slot == floorSlot)
+    {
+        // the floor texture repeats twice across the plane
+        list.uniform(sceneLayerLocation, LAYER_METAL);
+        list.draw(PASS_OPAQUE, *sceneMaterial, planeVAO, GL_TRIANGLES, 6, false, floorSlot, screenCoverage(floorSlot, 7.1f) / 2.0f);
     }
-    else
+    else if (slot == planetSlot)
+    {
+        if (planetSurface->ready())
+            list.draw(PASS_OPAQUE, *planetMaterial, sphereVAO, GL_TRIANGLES, sphereIndexCount, true, planetSlot);
+    }
+    // cube mapped planet: no pole pinching and no uv seam
+    else if (slot == venusSlot)
+        list.draw(PASS_OPAQUE, *venusMaterial, cubeSphereVAO, GL_TRIANGLES, cubeSphereIndexCount, true, venusSlot,
+                  screenCoverage(venusSlot, 2.5f));
+    else if (slot == gasGiantSlot)
+        list.draw(PASS_OPAQUE, *gasGiantMaterial, sphereVAO, GL_TRIANGLES, sphereIndexCount, true, gasGiantSlot,
+                  screenCoverage(gasGiantSlot, 3.0f));
+    else if (slot == cubeSlots[0] || slot == cubeSlots[1])
+    {
+        list.uniform(sceneLayerLocation, LAYER_MERCURY);
+        list.draw(PASS_OPAQUE, *sceneMaterial, cubeVAO, GL_TRIANGLES, 36, false, slot, screenCoverage(slot, 0.87f));
+    }
+}
+
+// unit sphere with equirectangular uvs, as position + uv like the cube;
+// returns the index count
+// -----------------------------------------------------------------------
+unsigned int genSphere(unsigned int *VAO, unsigned int *VBO, unsigned int *EBO, int segments, int rings)
+{
+    std::vector<float> vertices;
+    std::vector<unsigned int> indices;
+    const float pi = 3.14159265f;
+    for (int ring = 0; ring <= rings; ring++)
+    {
+        float v = (float)ring / rings;
+        float phi = v * pi;
+        for (int segment = 0; segment <= segments; segment++)
+        {
+            float u = (float)segment / segments;
+            float theta = u * 2.0f * pi;
+            vertices.insert(vertices.end(), {-std::cos(theta) * std::sin(phi), -std::cos(phi), std::sin(theta) * std::sin(phi), u, v});
+        }
+    }
+    for (int ring = 0; ring < rings; ring++)
+        for (int segment = 0; segment < segments; segment++)
+        {
+            unsigned int a = ring * (segments + 1) + segment, b = a + segments + 1;
+            indices.insert(indices.end(), {a, a + 1, b, a + 1, b + 1, b});
+        }
+
+    glGenVertexArrays(1, VAO);
+    glGenBuffers(1, VBO);
+    glGenBuffers(1, EBO);
+    glState.bindVertexArray(*VAO);
+    glState.bindBuffer(GL_ARRAY_BUFFER, *VBO);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+    glState.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, *EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void *)0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void *)(3 * sizeof(float)));
+    glState.bindVertexArray(0);
+    return (unsigned int)indices.size();
+}
+
+// sphere made of a subdivided cube pushed out onto the unit sphere, so its
+// triangles stay about the same size everywhere; position + uv layout with
+// per-face uvs
+// -----------------------------------------------------------------------
+unsigned int genCubeSphere(unsigned int *VAO, unsigned int *VBO, unsigned int *EBO, int subdivisions)
+{
+    // per face: normal, then the axes a grid step moves along
+    static const glm::vec3 faces[6][3] = {
+        {glm::vec3(1, 0, 0), glm::vec3(0, 0, -1), glm::vec3(0, 1, 0)},
+        {glm::vec3(-1, 0, 0), glm::vec3(0, 0, 1), glm::vec3(0, 1, 0)},
+        {glm::vec3(0, 1, 0), glm::vec3(1, 0, 0), glm::vec3(0, 0, -1)},
+        {glm::vec3(0, -1, 0), glm::vec3(1, 0, 0), glm::vec3(0, 0, 1)},
+        {glm::vec3(0, 0, 1), glm::vec3(1, 0, 0), glm::vec3(0, 1, 0)},
+        {glm::vec3(0, 0, -1), glm::vec3(-1, 0, 0), glm::vec3(0, 1, 0)}};
+    std::vector<float> vertices;
+    std::vector<unsigned int> indices;
+    for (const auto &face : faces)
+    {
+        unsigned int first = (unsigned int)(vertices.size() / 5);
+        for (int j = 0; j <= subdivisions; j++)
+            for (int i = 0; i <= subdivisions; i++)
+            {
+                float u = (float)i / subdivisions, v = (float)j / subdivisions;
+                glm::vec3 p = face[0] + face[1] * (2.0f * u - 1.0f) + face[2] * (2.0f * v - 1.0f);
+                // equal-area-ish spherified cube, evens out the corners
+                glm::vec3 s = p * glm::sqrt(glm::vec3(1.0f) - glm::vec3(p.y * p.y + p.z * p.z, p.z * p.z + p.x * p.x, p.x * p.x + p.y * p.y) / 2.0f +
+                                            glm::vec3(p.y * p.y * p.z * p.z, p.z * p.z * p.x * p.x, p.x * p.x * p.y * p.y) / 3.0f);
+                vertices.insert(vertices.end(), {s.x, s.y, s.z, u, v});
+            }
+        for (int j = 0; j < subdivisions; j++)
+            for (int i = 0; i < subdivisions; i++)
+            {
+                unsigned int a = first + j * (subdivisions + 1) + i, b = a + subdivisions + 1;
+                indices.insert(indices.end(), {a, a + 1, b + 1, a, b + 1, b});
+            }
+    }
+
+    glGenVertexArrays(1, VAO);
+    glGenBuffers(1, VBO);
+    glGenBuffers(1, EBO);
+    glState.bindVertexArray(*VAO);
+    glState.bindBuffer(GL_ARRAY_BUFFER, *VBO);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+    glState.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, *EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void *)0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void *)(3 * sizeof(float)));
+    glState.bindVertexArray(0);
+    return (unsigned int)indices.size();
+}
+
+// Banded gas giant as an equirectangular map, south pole in the first row.
+// Value noise with a period of the full width, so the date line has no seam.
+// ---------------------------------------------------------------------------
+void generateGasGiant(unsigned char *rgba, int width, int height)
+{
+    auto hash = [](int x, int y)
+    { return (float)((uint32_t)(x * 73856093 ^ y * 19349663) * 2654435761u >> 8) / 16777216.0f; };
+    auto noise = [&](float x, float y, int period)
     {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
+        int x0 = (int)std::floor(x), y0 = (int)std::floor(y);
+        float fx = x - x0, fy = y - y0;
+        fx = fx * fx * (3.0f - 2.0f * fx);
+        fy = fy * fy * (3.0f - 2.0f * fy);
+        int xa = ((x0 % period) + period) % period, xb = (xa + 1) % period;
+        float top = hash(xa, y0) + (hash(xb, y0) - hash(xa, y0)) * fx;
+        float bottom = hash(xa, y0 + 1) + (hash(xb, y0 + 1) - hash(xa, y0 + 1)) * fx;
+        return top + (bottom - top) * fy;
+    };
+    const glm::vec3 light(0.93f, 0.86f, 0.72f), dark(0.70f, 0.45f, 0.28f), storm(0.78f, 0.32f, 0.20f);
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+        {
+            float u = (float)x / width, v = (float)y / height;
+            // a few octaves of turbulence bend the latitude bands
+            float turbulence = 0.0f, amplitude = 0.5f;
+            for (int octave = 0, period = 8; octave < 5; octave++, period *= 2, amplitude *= 0.5f)
+                turbulence += amplitude * noise(u * period, v * period * 0.5f, period);
+            float band = 0.5f + 0.5f * std::sin(v * 3.14159265f * 18.0f + turbulence * 4.0f);
+            glm::vec3 color = glm::mix(dark, light, band);
+            // one oval storm in the southern hemisphere
+            glm::vec2 offset((u - 0.3f) / 0.06f, (v - 0.35f) / 0.03f);
+            float spot = std::max(0.0f, 1.0f - glm::dot(offset, offset));
+            color = glm::mix(color, storm, spot * (0.7f + 0.3f * turbulence));
+            unsigned char *p = rgba + ((size_t)y * width + x) * 4;
+            p[0] = (unsigned char)(glm::clamp(color.r, 0.0f, 1.0f) * 255.0f);
+            p[1] = (unsigned char)(glm::clamp(color.g, 0.0f, 1.0f) * 255.0f);
+            p[2] = (unsigned char)(glm::clamp(color.b, 0.0f, 1.0f) * 255.0f);
+            p[3] = 255;
+        }
+}
+
+// lumpy rock: a spherified cube pushed in and out by a few random bulges and
+// stretched along random axes, smooth normals
+// -----------------------------------------------------------------------
+Mesh genRock(unsigned int seed, int subdivisions)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    glm::vec3 bulges[8];
+    float heights[8];
+    for (int i = 0; i < 8; i++)
+    {
+        bulges[i] = glm::normalize(glm::vec3(unit(rng), unit(rng), unit(rng)) + glm::vec3(0.001f));
+        heights[i] = 0.25f * unit(rng);
     }
+    glm::vec3 stretch(1.0f + 0.3f * unit(rng), 0.8f + 0.2f * unit(rng), 1.0f + 0.3f * unit(rng));
 
-    return textureID;
-}
\ No newline at end of file
+    static const glm::vec3 faces[6][3] = {
+        {glm::vec3(1, 0, 0), glm::vec3(0, 0, -1), glm::vec3(0, 1, 0)},
+        {glm::vec3(-1, 0, 0), glm::vec3(0, 0, 1), glm::vec3(0, 1, 0)},
+        {glm::vec3(0, 1, 0), glm::vec3(1, 0, 0), glm::vec3(0, 0, -1)},
+        {glm::vec3(0, -1, 0), glm::vec3(1, 0, 0), glm::vec3(0, 0, 1)},
+        {glm::vec3(0, 0, 1), glm::vec3(1, 0, 0), glm::vec3(0, 1, 0)},
+        {glm::vec3(0, 0, -1), glm::vec3(-1, 0, 0), glm::vec3(0, 1, 0)}};
+    vector<Vertex> vertices;
+    vector<unsigned int> indices;
+    for (const auto &face : faces)
+    {
+        unsigned int first = (unsigned int)vertices.size();
+        for (int j = 0; j <= subdivisions; j++)
+            for (int i = 0; i <= subdivisions; i++)
+            {
+                float u = (float)i / subdivisions, v = (float)j / subdivisions;
+                glm::vec3 direction = glm::normalize(face[0] + face[1] * (2.0f * u - 1.0f) + face[2] * (2.0f * v - 1.0f));
+                float radius = 1.0f;
+                for (int k = 0; k < 8; k++)
+                {
+                    float d = std::max(0.0f, glm::dot(direction, bulges[k]));
+                    radius += heights[k] * d * d * d;
+                }
+                Vertex vertex = {};
+                vertex.Position = direction * radius * stretch;
+                vertex.TexCoords = glm::vec2(u, v);
+                vertices.push_back(vertex);
+            }
+        for (int j = 0; j < subdivisions; j++)
+            for (int i = 0; i < subdivisions; i++)
+            {
+                unsigned int a = first + j * (subdivisions + 1) + i, b = a + subdivisions + 1;
+                indices.insert(indices.end(), {a, a + 1, b + 1, a, b + 1, b});
+            }
+    }
+    // area weighted face normals; vertices on cube edges are duplicated, so
+    // they are matched up by position to keep the shading seamless
+    for (size_t t = 0; t < indices.size(); t += 3)
+    {
+        Vertex &a = vertices[indices[t]], &b = vertices[indices[t + 1]], &c = vertices[indices[t + 2]];
+        glm::vec3 normal = glm::cross(b.Position - a.Position, c.Position - a.Position);
+        a.Normal += normal;
+        b.Normal += normal;
+        c.Normal += normal;
+    }
+    vector<glm::vec3> normals(vertices.size());
+    for (size_t i = 0; i < vertices.size(); i++)
+        for (size_t j = 0; j < vertices.size(); j++)
+            if (glm::all(glm::lessThan(glm::abs(vertices[i].Position - vertices[j].Position), glm::vec3(1e-5f))))
+                normals[i] += vertices[j].Normal;
+    for (size_t i = 0; i < vertices.size(); i++)
+        vertices[i].Normal = glm::normalize(normals[i]);
+    return Mesh(vertices, indices, {});
+}
+
+// rocks scattered through a flat ring around the origin of beltSlot, radii
+// in gas giant units; small rocks are far more common than big ones
+// -----------------------------------------------------------------------
+std::vector<InstanceData> genBelt(int count, unsigned int seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    std::normal_distribution<float> thickness(0.0f, 0.05f);
+    std::vector<InstanceData> instances;
+    instances.reserve(count);
+    for (int i = 0; i < count; i++)
+    {
+        float angle = uniform(rng) * 6.2831853f;
+        // denser towards the middle of the ring
+        float radius = 1.8f + 0.5f * (uniform(rng) + uniform(rng));
+        glm::vec3 position(std::cos(angle) * radius, thickness(rng), std::sin(angle) * radius);
+        float size = uniform(rng);
+        float scale = 0.004f + 0.02f * size * size * size;
+        glm::quat rotation = glm::normalize(glm::quat(uniform(rng) - 0.5f, uniform(rng) - 0.5f, uniform(rng) - 0.5f, uniform(rng) - 0.5f));
+        float material = uniform(rng) < 0.7f ? LAYER_MERCURY : LAYER_METAL;
+        instances.push_back(InstanceData::make(position, scale, rotation, material));
+    }
+    return instances;
+}
+
+// the ring sits on the gas giant, tilted
+glm::mat4 beltModel()
+{
+    glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 7.0f, -12.0f));
+    model = glm::rotate(model, glm::radians(20.0f), glm::vec3(1.0f, 0.0f, 0.3f));
+    return glm::scale(model, glm::vec3(3.0f));
+}
+
+// a TransformBatch slot that is also culled, with the world space radius of
+// its bounding sphere
+unsigned int addBody(const glm::mat4 &model, float radius)
+{
+    unsigned int slot = transforms->add(model);
+    sceneBVH->add(glm::vec3(model[3]), radius);
+    return slot;
+}
+
+// occlusion proxies for the belt: world boxes around equal slices of the
+// ring, every rock counted in the slice its orbit angle falls in
+void addBeltSectors()
+{
+    const glm::mat4 &model = transforms->models[beltSlot];
+    // widest the ring gets in belt units, rock sizes included
+    const float inner = 1.7f, outer = 2.9f, height = 0.3f;
+    // the arc between the sampled angles bulges a little past them
+    glm::vec3 margin = glm::vec3(0.05f * glm::length(glm::vec3(model[0])));
+    for (int i = 0; i < BELT_SECTORS; i++)
+    {
+        glm::vec3 low(1e30f), high(-1e30f);
+        for (int edge = 0; edge <= 2; edge++)
+        {
+            float angle = (i + edge * 0.5f) * 6.2831853f / BELT_SECTORS;
+            for (float radius : {inner, outer})
+                for (float y : {-height, height})
+                {
+                    glm::vec3 corner = glm::vec3(model * glm::vec4(std::cos(angle) * radius, y, std::sin(angle) * radius, 1.0f));
+                    low = glm::min(low, corner);
+                    high = glm::max(high, corner);
+                }
+        }
+        sectorCenter[i] = (low + high) * 0.5f;
+        sectorExtent[i] = (high - low) * 0.5f + margin;
+        unsigned int proxy = occlusion->add(sectorCenter[i], sectorExtent[i]);
+        if (i == 0)
+            firstSectorProxy = proxy;
+    }
+}
+
+// puts every rock where its orbit has it at `time` and hands the new world
+// space bounds to the BVH
+void moveBelt(float time)
+{
+    const glm::mat4 &model = transforms->models[beltSlot];
+    // the belt matrix scales uniformly
+    float scale = glm::length(glm::vec3(model[0])) * rockRadius;
+    rockBounds.resize(beltRocks.size());
+    rockSector.resize(beltRocks.size());
+    cullPool->parallelFor(beltRocks.size(), 4096, [&](size_t begin, size_t end)
+                          {
+        for (size_t i = begin; i < end; i++)
+        {
+            const glm::vec3 &orbit = beltOrbits[i];
+            float angle = orbit.y + orbit.z * time;
+            InstanceData &rock = beltRocks[i];
+            rock.position = glm::vec3(std::cos(angle) * orbit.x, rock.position.y, std::sin(angle) * orbit.x);
+            float turns = angle / 6.2831853f;
+            rockSector[i] = (unsigned char)((int)((turns - std::floor(turns)) * BELT_SECTORS) % BELT_SECTORS);
+            rockBounds[i] = glm::vec4(glm::vec3(model * glm::vec4(rock.position, 1.0f)), rock.scale * scale);
+        } });
+    for (size_t i = 0; i < rockBounds.size(); i++)
+        sceneBVH->set(firstRockId + (uint32_t)i, glm::vec3(rockBounds[i]), rockBounds[i].w);
+}
+
+// circles around the three planets, through the ring and low over the floor,
+// in random colours
+void addCraftLights(int count, unsigned int seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    const glm::mat4 &belt = transforms->models[beltSlot];
+    clusteredLights->lights.clear();
+    craftOrbits.clear();
+    for (int i = 0; i < count; i++)
+    {
+        CraftOrbit orbit;
+        int group = i % 5;
+        if (group < 3)
+        {
+            // a tilted circle a little above the planet's surface
+            unsigned int slot = group == 0 ? planetSlot : group == 1 ? venusSlot : gasGiantSlot;
+            float bodyRadius = sceneBVH->sphere(slot).w;
+            float radius = bodyRadius * (1.15f + 0.35f * uniform(rng));
+            glm::vec3 normal = glm::normalize(glm::vec3(uniform(rng) - 0.5f, 1.0f, uniform(rng) - 0.5f));
+            glm::vec3 axisU = glm::normalize(glm::cross(normal, glm::vec3(0.0f, 0.0f, 1.0f)));
+            orbit.center = glm::vec3(transforms->models[slot][3]);
+            orbit.axisU = axisU * radius;
+            orbit.axisV = glm::cross(normal, axisU) * radius;
+        }
+        else if (group == 3)
+        {
+            // in the ring's plane, the belt matrix carries its tilt and scale
+            float radius = 1.8f + uniform(rng);
+            orbit.center = glm::vec3(belt[3]);
+            orbit.axisU = glm::vec3(belt[0]) * radius;
+            orbit.axisV = glm::vec3(belt[2]) * radius;
+        }
+        else
+        {
+            float radius = 1.0f + 5.0f * uniform(rng);
+            orbit.center = glm::vec3(0.0f, 0.2f + 1.0f * uniform(rng), 0.0f);
+            orbit.axisU = glm::vec3(radius, 0.0f, 0.0f);
+            orbit.axisV = glm::vec3(0.0f, 0.0f, radius);
+        }
+        orbit.speed = (0.2f + 0.6f * uniform(rng)) * (uniform(rng) < 0.5f ? -1.0f : 1.0f);
+        orbit.phase = uniform(rng) * 6.2831853f;
+        craftOrbits.push_back(orbit);
+
+        PointLight light;
+        light.position = orbit.center;
+        light.radius = 1.0f + uniform(rng);
+        // a saturated hue
+        float hue = uniform(rng) * 6.0f;
+        light.color = glm::clamp(glm::vec3(std::abs(hue - 3.0f) - 1.0f, 2.0f - std::abs(hue - 2.0f), 2.0f - std::abs(hue - 4.0f)),
+                                 0.0f, 1.0f);
+        light.intensity = 1.5f;
+        clusteredLights->lights.push_back(light);
+    }
+}
+
+void moveCraftLights(float time)
+{
+    for (size_t i = 0; i < craftOrbits.size(); i++)
+    {
+        const CraftOrbit &orbit = craftOrbits[i];
+        float angle = orbit.phase + orbit.speed * time;
+        clusteredLights->lights[i].position = orbit.center + orbit.axisU * std::cos(angle) + orbit.axisV * std::sin(angle);
+    }
+}
+
+// Draw throughput for the belt: one glDrawElements per rock, its instance
+// data set as constant vertex attributes, against a single instanced draw.
+// Both sides wait on glFinish so gpu time is included.
+// -----------------------------------------------------------------------
+void benchmarkInstancing()
+{
+    const int REPEATS = 5;
+    // separate meshes, the instanced one keeps its VAO wired to the buffer
+    Mesh single = genRock(1, 3), instanced = genRock(1, 3);
+    InstanceBuffer buffer;
+    glm::mat4 view = camera.GetViewMatrix();
+    glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+    transforms->compute(view, projection);
+    transforms->upload();
+    instancedShader->use();
+    glState.bindTexture(0, GL_TEXTURE_2D_ARRAY, sceneTextures.id());
+    transforms->bind(beltSlot);
+    glState.setEnabled(GL_DEPTH_TEST, true);
+
+    auto time = [&](auto &&draw)
+    {
+        draw();
+        glFinish();
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < REPEATS; i++)
+            draw();
+        glFinish();
+        return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count() / REPEATS;
+    };
+    const GLsizei indexCount = (GLsizei)single.indices.size();
+    for (int count : {1000, 10000, 100000})
+    {
+        std::vector<InstanceData> instances = genBelt(count, 7);
+        buffer.upload(instances);
+        auto perObject = [&]()
+        {
+            glState.bindVertexArray(single.VAO);
+            for (const InstanceData &rock : instances)
+            {
+                glVertexAttrib4f(INSTANCE_ATTRIB_LOCATION, rock.position.x, rock.position.y, rock.position.z, rock.scale);
+                glVertexAttrib4fv(INSTANCE_ATTRIB_LOCATION + 1, &rock.rotation.x);
+                glVertexAttrib1f(INSTANCE_ATTRIB_LOCATION + 2, rock.material);
+                glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
+            }
+        };
+        auto instancedDraw = [&]()
+        { instanced.DrawInstanced(*instancedShader, buffer); };
+        float perObjectMs = time(perObject);
+        float instancedMs = time(instancedDraw);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        std::cout << "[INSTANCING] " << count << " rocks: " << count << " draws " << perObjectMs << " ms ("
+                  << count / perObjectMs / 1000.0f << " M rocks/s) | 1 instanced draw " << instancedMs << " ms ("
+                  << count / instancedMs / 1000.0f << " M rocks/s), " << perObjectMs / instancedMs << "x" << std::endl;
+    }
+    for (Mesh *mesh : {&single, &instanced})
+    {
+        glState.forgetVertexArray(mesh->VAO);
+        glState.forgetBuffer(mesh->VBO);
+        glDeleteVertexArrays(1, &mesh->VAO);
+        glDeleteBuffers(1, &mesh->VBO);
+        glDeleteBuffers(1, &mesh->EBO);
+    }
+}
+
+// Command list recording for a frame with every body and rock in view, as
+// the recording threads go from the caller alone up to the whole cull pool.
+// Only recording is timed, the lists are never replayed. The gpu culled belt
+// records no rocks, so it wants SOLAR_GPU_CULL=0.
+// -----------------------------------------------------------------------
+void benchmarkRecording()
+{
+    const int REPEATS = 20;
+    std::vector<uint32_t> frameIds;
+    frameIds.swap(visibleIds);
+    for (uint32_t id = 0; id < (uint32_t)sceneBVH->size(); id++)
+        visibleIds.push_back(id);
+    std::fill(idVisible.begin(), idVisible.end(), 1);
+    memset(sectorVisible, 1, sizeof(sectorVisible));
+    transforms->compute(camera.GetViewMatrix(), glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f));
+    renderQueue->setEye(camera.Position);
+
+    float singleMs = 0.0f;
+    int maxThreads = cullPool->threadCount() + 1;
+    for (int threads = 1;; threads = std::min(threads * 2, maxThreads))
+    {
+        ThreadPool pool;
+        pool.start(threads - 1);
+        std::vector<CommandList> storage(threads, CommandList(*transforms));
+        std::vector<CommandList *> lists;
+        for (CommandList &list : storage)
+            lists.push_back(&list);
+        recordScene(pool, lists);
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < REPEATS; i++)
+            recordScene(pool, lists);
+        float ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count() / REPEATS;
+        if (threads == 1)
+            singleMs = ms;
+        size_t draws = 0;
+        for (const CommandList &list : storage)
+            draws += list.drawCount();
+        std::cout << "[RECORD] " << threads << " threads: " << ms << " ms for " << visibleIds.size() << " ids, " << draws
+                  << " draws, " << singleMs / ms << "x" << std::endl;
+        if (threads == maxThreads)
+            break;
+    }
+    visibleIds.swap(frameIds);
+}
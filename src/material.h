@@ -0,0 +1,178 @@
+#ifndef MATERIAL_H
+#define MATERIAL_H
+
+#ifdef __EMSCRIPTEN__
+#include <GLES3/gl3.h>
+#else
+#include <glad/glad.h>
+#endif
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "shader.h"
+#include "gl_state.h"
+#include "texture_manager.h"
+#include "frame_stats.h"
+
+// Each texture type owns a fixed range of units: the n-th texture of a type
+// goes to slot * UNITS_PER_SLOT + n and its sampler is material.<type> for
+// the first, material.<type>2 and on for the rest. Because every material on
+// a program agrees on these, sampler uniforms only have to be set once per
+// program.
+enum MaterialSlot
+{
+    SLOT_DIFFUSE = 0,
+    SLOT_SPECULAR = 1,
+    SLOT_NORMAL = 2,
+    SLOT_HEIGHT = 3,
+    SLOT_COUNT
+};
+static const int UNITS_PER_SLOT = 3;
+
+struct TextureBinding
+{
+    GLuint unit;
+    GLenum target;
+    GLuint id;
+};
+
+// Resolves a mesh's textures against a shader once: sampler locations and
+// texture units are looked up at creation, so bind() is just a short array of
+// glBindTexture calls that glState can skip when they are already bound.
+// Switches between materials are counted in frameStats.
+class Material
+{
+public:
+    unsigned int program = 0;
+    std::vector<TextureBinding> bindings;
+
+    Material() {}
+
+    // textures are (id, type) pairs such as {7, "texture_diffuse"}
+    Material(const Shader &shader, const std::vector<std::pair<GLuint, std::string>> &textures)
+        : Material(shader.ID, textures)
+    {
+    }
+
+    Material(GLuint shaderProgram, const std::vector<std::pair<GLuint, std::string>> &textures)
+        : program(shaderProgram), id(nextId()++)
+    {
+        // sampler units are program state, set once here
+        glState.useProgram(program);
+        int used[SLOT_COUNT] = {};
+        for (const auto &texture : textures)
+        {
+            int slot = slotForType(texture.second);
+            if (slot < 0 || used[slot] == UNITS_PER_SLOT)
+                continue;
+            int index = used[slot]++;
+            GLuint unit = (GLuint)(slot * UNITS_PER_SLOT + index);
+            GLint location = glGetUniformLocation(program, samplerName(slot, index).c_str());
+            if (location >= 0)
+                glUniform1i(location, (GLint)unit);
+            bindings.push_back({unit, GL_TEXTURE_2D, texture.first});
+        }
+    }
+
+    // for draws that aren't meshes: textures and uniforms are added by hand
+    explicit Material(const Shader &shader)
+        : program(shader.ID), id(nextId()++)
+    {
+    }
+
+    // the sampler uniform for `unit` is the shader's business
+    void addTexture(GLuint unit, GLenum target, GLuint texture)
+    {
+        bindings.push_back({unit, target, texture});
+    }
+
+    // set on every bind, for values that differ between materials sharing
+    // a program such as texture array layers
+    void setInt(const char *name, int value)
+    {
+        ints.push_back({glGetUniformLocation(program, name), value});
+    }
+
+    // screenPixels is the on-screen size of the draw, used to stream mips.
+    // The program must already be in use.
+    void bind(float screenPixels = TextureManager::FULL_COVERAGE) const
+    {
+        if (current() != id)
+        {
+            current() = id;
+            frameStats.materialSwitches++;
+        }
+        // other draws may have rebound these units since, glState drops the
+        // binds that are still in place
+        for (const TextureBinding &binding : bindings)
+            glState.bindTexture(binding.unit, binding.target, binding.id);
+        for (const IntUniform &uniform : ints)
+            glUniform1i(uniform.location, uniform.value);
+        if (onBind)
+            onBind();
+        touch(screenPixels);
+    }
+
+    // tells the texture manager the textures are on screen without binding
+    void touch(float screenPixels) const
+    {
+        for (const TextureBinding &binding : bindings)
+            textureManager().touch(binding.id, screenPixels);
+    }
+
+    bool valid() const
+    {
+        return id != 0;
+    }
+
+    unsigned int key() const
+    {
+        return id;
+    }
+
+    // uniforms that are not plain ints, such as the virtual texture's
+    std::function<void()> onBind;
+
+    static int slotForType(const std::string &type)
+    {
+        if (type == "texture_diffuse")
+            return SLOT_DIFFUSE;
+        if (type == "texture_specular")
+            return SLOT_SPECULAR;
+        if (type == "texture_normal")
+            return SLOT_NORMAL;
+        if (type == "texture_height")
+            return SLOT_HEIGHT;
+        return -1;
+    }
+
+private:
+    struct IntUniform
+    {
+        GLint location;
+        GLint value;
+    };
+
+    unsigned int id = 0;
+    std::vector<IntUniform> ints;
+
+    static std::string samplerName(int slot, int index)
+    {
+        static const char *names[SLOT_COUNT] = {"material.diffuse", "material.specular", "material.normal", "material.height"};
+        return index == 0 ? names[slot] : names[slot] + std::to_string(index + 1);
+    }
+
+    static unsigned int &nextId()
+    {
+        static unsigned int counter = 1;
+        return counter;
+    }
+
+    static unsigned int &current()
+    {
+        static unsigned int bound = 0;
+        return bound;
+    }
+};
+#endif
@@ -10,6 +10,11 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include "stb_image.h"
 #include "shader.h"
+#include "material.h"
+#include "texture_manager.h"
+#include "instance_buffer.h"
+#include "render_queue.h"
+#include "frame_stats.h"
 
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
@@ -49,6 +54,8 @@ struct Texture
     unsigned int id;
     string type;
     string path;
+    // keeps the managed texture alive while a mesh references it
+    TextureHandle handle;
 };
 
 class Mesh
@@ -67,42 +74,111 @@ public:
         setupMesh();
     }
 
-    void Draw(Shader &shader)
+    void Draw(Shader &shader, float screenPixels = TextureManager::FULL_COVERAGE)
     {
-        for (unsigned int i = 0; i < textures.size(); i++)
-        {
-            glActiveTexture(GL_TEXTURE0 + i);
-            string name = textures[i].type;
-
-            const char *uniformName = nullptr;
-            if (name == "texture_diffuse")
-                uniformName = "material.diffuse";
-            else if (name == "texture_specular")
-                uniformName = "material.specular";
-
-            if (uniformName)
-                shader.setInt(uniformName, i);
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
-        }
-
-        glBindVertexArray(VAO);
+        // samplers and units are resolved once per program, not per draw
+        materialFor(shader).bind(screenPixels);
+
+        glState.bindVertexArray(VAO);
         glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(indices.size()), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
-        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // draws every instance in `instances` with a single call; the shader
+    // reads the per-instance attributes described in instance_buffer.h
+    void DrawInstanced(Shader &shader, const InstanceBuffer &instances, float screenPixels = TextureManager::FULL_COVERAGE)
+    {
+        if (instances.size() == 0)
+            return;
+        materialFor(shader).bind(screenPixels);
+
+        glState.bindVertexArray(VAO);
+        attachInstances(instances);
+        glDrawElementsInstanced(GL_TRIANGLES, static_cast<unsigned int>(indices.size()), GL_UNSIGNED_INT, 0, instances.size());
+        frameStats.instancedDraws++;
+        frameStats.instances += instances.size();
+    }
+
+    // queued versions of Draw and DrawInstanced; the mesh must outlive the
+    // queue's next flush
+    void Submit(RenderQueue &queue, Shader &shader, unsigned int pass, unsigned int slot, float screenPixels = TextureManager::FULL_COVERAGE)
+    {
+        queue.submit(pass, materialFor(shader), VAO, GL_TRIANGLES, static_cast<GLsizei>(indices.size()), true, slot, screenPixels);
+    }
+
+    // pairs `instances` with the VAO for RecordInstanced; GL thread only,
+    // and nothing happens while the pairing holds
+    void AttachInstances(const InstanceBuffer &instances)
+    {
+        if (attachedInstances == instances.id())
+            return;
+        glState.bindVertexArray(VAO);
+        attachInstances(instances);
+    }
+
+    // instanced groups usually share a material picked by the caller (a
+    // texture array, say) instead of the mesh's own textures. The instance
+    // count is the buffer's at the queue's flush, so command lists can
+    // still be filling it. Makes no GL calls, so any thread may record it
+    // once AttachInstances has run for the buffer.
+    void RecordInstanced(CommandList &list, const Material &groupMaterial, const InstanceBuffer &instances, unsigned int pass,
+                         unsigned int slot, float screenPixels = TextureManager::FULL_COVERAGE)
+    {
+        list.drawInstances(pass, groupMaterial, VAO, static_cast<GLsizei>(indices.size()), instances, slot, screenPixels);
+    }
+
+    // safe between a submit and the queue's flush: the materials are
+    // rebuilt where they are, so queued draws pick up the new textures
+    void SetTextures(vector<Texture> textures)
+    {
+        this->textures = textures;
+        for (auto &item : materials)
+            item.second = Material(item.first, typedTextures());
     }
 
 private:
+    // one per program the mesh is drawn with (scene pass and outline mask,
+    // say), so alternating programs doesn't rebuild it; map nodes stay put,
+    // which queued draws pointing at them rely on
+    map<GLuint, Material> materials;
+    GLuint attachedInstances = 0;
+
+    // the attribute pointers are VAO state, so this only runs when the mesh
+    // is paired with a different buffer; expects VAO to be bound
+    void attachInstances(const InstanceBuffer &instances)
+    {
+        if (attachedInstances == instances.id())
+            return;
+        instances.attach();
+        attachedInstances = instances.id();
+    }
+
+    Material &materialFor(const Shader &shader)
+    {
+        auto found = materials.find(shader.ID);
+        if (found != materials.end())
+            return found->second;
+        return materials.emplace(shader.ID, Material(shader, typedTextures())).first->second;
+    }
+
+    vector<pair<GLuint, string>> typedTextures() const
+    {
+        vector<pair<GLuint, string>> typed;
+        for (const Texture &texture : textures)
+            typed.push_back({texture.id, texture.type});
+        return typed;
+    }
+
     void setupMesh()
     {
         glGenVertexArrays(1, &VAO);
         glGenBuffers(1, &VBO);
         glGenBuffers(1, &EBO);
 
-        glBindVertexArray(VAO);
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glState.bindVertexArray(VAO);
+        glState.bindBuffer(GL_ARRAY_BUFFER, VBO);
         glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
 
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glState.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
         glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
 
         glEnableVertexAttribArray(0);
@@ -111,7 +187,7 @@ private:
         glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, Normal));
         glEnableVertexAttribArray(2);
         glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, TexCoords));
-        glBindVertexArray(0);
+        glState.bindVertexArray(0);
     }
 };
 #endif
\ No newline at end of file
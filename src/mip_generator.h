@@ -0,0 +1,266 @@
+#ifndef MIP_GENERATOR_H
+#define MIP_GENERATOR_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "pixel_convert.h"
+
+enum MipFilter
+{
+    // 2x2 average, what glGenerateMipmap does on most drivers
+    MIP_FILTER_BOX = 0,
+    // windowed sinc, sharp without much ringing; the default
+    MIP_FILTER_KAISER,
+    // sharper still, rings a little more on hard edges
+    MIP_FILTER_LANCZOS
+};
+
+struct MipOptions
+{
+    MipFilter filter = MIP_FILTER_KAISER;
+    // colour data is filtered in linear light; normal, height and other
+    // data maps should turn this off
+    bool srgb = true;
+    // wrap the filter around the edges instead of clamping, for textures
+    // sampled with GL_REPEAT. Equirectangular planet maps wrap in u only,
+    // so the seam at the date line doesn't show up in the smaller mips.
+    bool wrapU = false;
+    bool wrapV = false;
+};
+
+// Builds mip chains on the cpu. Each level is resampled from the one above
+// with a separable filter: a vertical pass that accumulates whole source rows
+// (plain SIMD multiply-adds over the row) followed by a horizontal pass over
+// the single accumulated row. Rows are converted to linear float as they are
+// first needed and kept in a small ring, so memory stays at a few rows no
+// matter how large the image is.
+class MipGenerator
+{
+public:
+    // appends levels below the last one until 1x1, or until the chain has
+    // maxLevels levels; `pixels` holds the chain
+    template <typename Level>
+    static void buildChain(std::vector<unsigned char> &pixels, std::vector<Level> &levels, int channels, const MipOptions &options,
+                           size_t maxLevels = SIZE_MAX)
+    {
+        pixels.reserve(pixels.size() + pixels.size() / 3 + 64);
+        while ((levels.back().width > 1 || levels.back().height > 1) && levels.size() < maxLevels)
+        {
+            Level last = levels.back();
+            Level next = last;
+            next.width = std::max(1, last.width / 2);
+            next.height = std::max(1, last.height / 2);
+            next.offset = pixels.size();
+            next.size = (size_t)next.width * next.height * channels;
+            pixels.resize(pixels.size() + next.size);
+            resample(pixels.data() + last.offset, last.width, last.height, pixels.data() + next.offset, next.width, next.height,
+                     channels, options);
+            levels.push_back(next);
+        }
+    }
+
+    // one level down, 2:1 in each dimension that isn't already 1
+    static std::vector<unsigned char> downsample(const unsigned char *src, int width, int height, int channels, const MipOptions &options)
+    {
+        int w = std::max(1, width / 2), h = std::max(1, height / 2);
+        std::vector<unsigned char> dst((size_t)w * h * channels);
+        resample(src, width, height, dst.data(), w, h, channels, options);
+        return dst;
+    }
+
+    static void resample(const unsigned char *src, int width, int height, unsigned char *dst, int dstWidth, int dstHeight,
+                         int channels, const MipOptions &options)
+    {
+        Taps columns = makeTaps(width, dstWidth, options.filter, options.wrapU);
+        Taps rows = makeTaps(height, dstHeight, options.filter, options.wrapV);
+
+        size_t rowFloats = (size_t)width * channels;
+        // every source row a destination row reads, cached in linear float
+        int window = rows.maxTaps + 1;
+        std::vector<float> cache(window * rowFloats);
+        std::vector<int> cached(window, -1);
+        std::vector<float> accumulated(rowFloats), out((size_t)dstWidth * channels);
+
+        for (int y = 0; y < dstHeight; y++)
+        {
+            std::fill(accumulated.begin(), accumulated.end(), 0.0f);
+            for (int t = rows.start[y]; t < rows.start[y + 1]; t++)
+            {
+                int sy = rows.index[t];
+                int slot = sy % window;
+                float *row = cache.data() + slot * rowFloats;
+                if (cached[slot] != sy)
+                {
+                    toFloat(src + sy * rowFloats, row, width, channels, options.srgb);
+                    cached[slot] = sy;
+                }
+                multiplyAdd(accumulated.data(), row, rows.weight[t], rowFloats);
+            }
+            filterRow(accumulated.data(), out.data(), columns, dstWidth, channels);
+            toUnorm(out.data(), dst + (size_t)y * dstWidth * channels, dstWidth, channels, options.srgb);
+        }
+    }
+
+private:
+    // for each destination sample, the source samples it reads and their
+    // weights; taps of sample i are start[i] .. start[i + 1]
+    struct Taps
+    {
+        std::vector<int> start;
+        std::vector<int> index;
+        std::vector<float> weight;
+        int maxTaps = 0;
+    };
+
+    static float sinc(float x)
+    {
+        if (std::fabs(x) < 1e-5f)
+            return 1.0f;
+        float px = 3.14159265f * x;
+        return std::sin(px) / px;
+    }
+
+    // zeroth order modified bessel function, for the kaiser window
+    static float besselI0(float x)
+    {
+        float sum = 1.0f, term = 1.0f;
+        for (int k = 1; k < 20; k++)
+        {
+            term *= (x / (2.0f * k)) * (x / (2.0f * k));
+            sum += term;
+        }
+        return sum;
+    }
+
+    static float radius(MipFilter filter)
+    {
+        return filter == MIP_FILTER_BOX ? 0.5f : 3.0f;
+    }
+
+    // x is in destination pixels
+    static float kernel(MipFilter filter, float x)
+    {
+        const float r = radius(filter);
+        float ax = std::fabs(x);
+        switch (filter)
+        {
+        case MIP_FILTER_BOX:
+            return ax <= r ? 1.0f : 0.0f;
+        case MIP_FILTER_LANCZOS:
+            return ax < r ? sinc(x) * sinc(x / r) : 0.0f;
+        case MIP_FILTER_KAISER:
+        default:
+        {
+            if (ax >= r)
+                return 0.0f;
+            const float alpha = 4.0f;
+            float t = x / r;
+            return sinc(x) * besselI0(alpha * std::sqrt(1.0f - t * t)) / besselI0(alpha);
+        }
+        }
+    }
+
+    static Taps makeTaps(int size, int dstSize, MipFilter filter, bool wrap)
+    {
+        Taps taps;
+        float scale = (float)size / dstSize;
+        float support = radius(filter) * scale;
+        taps.start.push_back(0);
+        for (int i = 0; i < dstSize; i++)
+        {
+            float center = (i + 0.5f) * scale - 0.5f;
+            int first = (int)std::ceil(center - support), last = (int)std::floor(center + support);
+            size_t begin = taps.index.size();
+            float total = 0.0f;
+            for (int j = first; j <= last; j++)
+            {
+                float w = kernel(filter, (j - center) / scale);
+                if (w == 0.0f)
+                    continue;
+                int index = wrap ? ((j % size) + size) % size : std::min(std::max(j, 0), size - 1);
+                taps.index.push_back(index);
+                taps.weight.push_back(w);
+                total += w;
+            }
+            for (size_t t = begin; t < taps.weight.size(); t++)
+                taps.weight[t] /= total;
+            taps.start.push_back((int)taps.index.size());
+            taps.maxTaps = std::max(taps.maxTaps, (int)(taps.index.size() - begin));
+        }
+        return taps;
+    }
+
+    static void toFloat(const unsigned char *src, float *dst, int width, int channels, bool srgb)
+    {
+        if (srgb)
+            PixelConvert::srgbToLinear(src, dst, (size_t)width, channels);
+        else
+            PixelConvert::unormToFloat(src, dst, (size_t)width * channels);
+    }
+
+    static void toUnorm(const float *src, unsigned char *dst, int width, int channels, bool srgb)
+    {
+        if (srgb)
+            PixelConvert::linearToSrgb(src, dst, (size_t)width, channels);
+        else
+            PixelConvert::floatToUnorm(src, dst, (size_t)width * channels);
+    }
+
+    // dst += src * w
+    static void multiplyAdd(float *dst, const float *src, float w, size_t count)
+    {
+        size_t i = 0;
+#if defined(PIXEL_CONVERT_SSE2)
+        __m128 weight = _mm_set1_ps(w);
+        for (; i + 4 <= count; i += 4)
+            _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(_mm_loadu_ps(src + i), weight)));
+#elif defined(PIXEL_CONVERT_WASM_SIMD)
+        v128_t weight = wasm_f32x4_splat(w);
+        for (; i + 4 <= count; i += 4)
+            wasm_v128_store(dst + i, wasm_f32x4_add(wasm_v128_load(dst + i), wasm_f32x4_mul(wasm_v128_load(src + i), weight)));
+#endif
+        for (; i < count; i++)
+            dst[i] += src[i] * w;
+    }
+
+    static void filterRow(const float *src, float *dst, const Taps &taps, int dstWidth, int channels)
+    {
+#if defined(PIXEL_CONVERT_SSE2) || defined(PIXEL_CONVERT_WASM_SIMD)
+        // a 4-channel pixel is exactly one vector
+        if (channels == 4)
+        {
+            for (int x = 0; x < dstWidth; x++)
+            {
+#if defined(PIXEL_CONVERT_SSE2)
+                __m128 sum = _mm_setzero_ps();
+                for (int t = taps.start[x]; t < taps.start[x + 1]; t++)
+                    sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(src + taps.index[t] * 4), _mm_set1_ps(taps.weight[t])));
+                _mm_storeu_ps(dst + x * 4, sum);
+#else
+                v128_t sum = wasm_f32x4_splat(0.0f);
+                for (int t = taps.start[x]; t < taps.start[x + 1]; t++)
+                    sum = wasm_f32x4_add(sum, wasm_f32x4_mul(wasm_v128_load(src + taps.index[t] * 4), wasm_f32x4_splat(taps.weight[t])));
+                wasm_v128_store(dst + x * 4, sum);
+#endif
+            }
+            return;
+        }
+#endif
+        for (int x = 0; x < dstWidth; x++)
+        {
+            float sum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+            for (int t = taps.start[x]; t < taps.start[x + 1]; t++)
+            {
+                const float *pixel = src + taps.index[t] * channels;
+                for (int c = 0; c < channels; c++)
+                    sum[c] += pixel[c] * taps.weight[t];
+            }
+            for (int c = 0; c < channels; c++)
+                dst[x * channels + c] = sum[c];
+        }
+    }
+};
+#endif
@@ -33,7 +33,7 @@
 using namespace std;
 #define MAX_BONE_INFLUENCE 4
 
-unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false);
+TextureHandle TextureFromFile(const char *path, const string &directory, bool gamma = false);
 
 class Model
 {
@@ -52,25 +52,27 @@ public:
         loadModel(path);
     }
 
-    void Draw(Shader &shader)
+    void Draw(Shader &shader, float screenPixels = TextureManager::FULL_COVERAGE)
     {
         for (unsigned int i = 0; i < meshes.size(); i++)
-            meshes[i].Draw(shader);
+            meshes[i].Draw(shader, screenPixels);
     }
 
-    void SetDiffuseTexture(string path)
+    void Submit(RenderQueue &queue, Shader &shader, unsigned int pass, unsigned int slot, float screenPixels = TextureManager::FULL_COVERAGE)
     {
-        unsigned int id = TextureFromFile(path.c_str(), "", false);
+        for (unsigned int i = 0; i < meshes.size(); i++)
+            meshes[i].Submit(queue, shader, pass, slot, screenPixels);
+    }
 
-        tex.id = id;
+    void SetDiffuseTexture(string path)
+    {
+        tex.handle = TextureFromFile(path.c_str(), "", false);
+        tex.id = tex.handle.id();
         tex.type = "texture_diffuse";
         tex.path = path;
 
         for (auto &mesh : meshes)
-        {
-            mesh.textures.clear();
-            mesh.textures.push_back(tex);
-        }
+            mesh.SetTextures({tex});
     }
 
 private:
@@ -274,35 +276,14 @@ private:
     }
 };
 
-unsigned int TextureFromFile(const char *path, const string &directory, bool gamma)
+TextureHandle TextureFromFile(const char *path, const string &directory, bool gamma)
 {
     string filename = string(path);
     if (!directory.empty())
         filename = directory + '/' + filename;
 
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 4);
-
-    if (data)
-    {
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        stbi_image_free(data);
-    }
-    else
-    {
-        cout << "Texture failed to load: " << path << endl;
-        stbi_image_free(data);
-    }
-    return textureID;
+    TextureDesc desc;
+    desc.format = TEXTURE_FORMAT_RGBA8;
+    return textureManager().acquire(filename, desc);
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,181 @@
+#ifndef OCCLUSION_CULLER_H
+#define OCCLUSION_CULLER_H
+
+#ifdef __EMSCRIPTEN__
+#include <GLES3/gl3.h>
+#else
+#include <glad/glad.h>
+#endif
+#include <glm/glm.hpp>
+
+#include <chrono>
+#include <vector>
+
+#include "frame_stats.h"
+#include "gl_state.h"
+#include "shader.h"
+
+// Hardware occlusion culling with bounding box proxies.
+//   - after the frame's visible objects are drawn, issue() renders the boxes
+//     of the proxies due a test against the depth buffer, colour and depth
+//     writes off, each inside its own any-samples-passed query
+//   - beginFrame() picks up whichever results have arrived, at least a frame
+//     later; nothing waits on the gpu, a proxy whose query is still in
+//     flight keeps its last answer and is not queried again
+//   - proxies found visible are assumed to stay so and are only re-tested
+//     every VISIBLE_RECHECK frames, staggered; hidden ones are re-tested
+//     every frame since they are not drawn
+// One proxy can stand for a whole group of objects, which are then culled
+// with a single query.
+class OcclusionCuller
+{
+public:
+    static const unsigned int VISIBLE_RECHECK = 4;
+
+    // off: every proxy is reported visible and no queries are made
+    bool enabled = true;
+
+    OcclusionCuller()
+        : boxShader("res/shaders/occlusion_box.vs", "res/shaders/occlusion_box.fs")
+    {
+        // conservative answers can be had cheaper; desktop GL has them from 4.3
+#ifdef __EMSCRIPTEN__
+        target = GL_ANY_SAMPLES_PASSED_CONSERVATIVE;
+#else
+        target = GLAD_GL_VERSION_4_3 ? GL_ANY_SAMPLES_PASSED_CONSERVATIVE : GL_ANY_SAMPLES_PASSED;
+#endif
+        const float corners[] = {-1, -1, -1, 1, -1, -1, 1, 1, -1, -1, 1, -1, -1, -1, 1, 1, -1, 1, 1, 1, 1, -1, 1, 1};
+        const GLuint indices[] = {0, 2, 1, 0, 3, 2, 4, 5, 6, 4, 6, 7, 0, 1, 5, 0, 5, 4,
+                                  3, 6, 2, 3, 7, 6, 0, 4, 7, 0, 7, 3, 1, 2, 6, 1, 6, 5};
+        glGenVertexArrays(1, &boxVAO);
+        glGenBuffers(1, &boxVBO);
+        glGenBuffers(1, &boxEBO);
+        glState.bindVertexArray(boxVAO);
+        glState.bindBuffer(GL_ARRAY_BUFFER, boxVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+        glState.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, boxEBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void *)0);
+        glState.bindVertexArray(0);
+    }
+
+    unsigned int add(const glm::vec3 &center, const glm::vec3 &extent)
+    {
+        Proxy proxy;
+        proxy.center = center;
+        proxy.extent = extent;
+        glGenQueries(1, &proxy.query);
+        proxies.push_back(proxy);
+        return (unsigned int)proxies.size() - 1;
+    }
+
+    void setBounds(unsigned int id, const glm::vec3 &center, const glm::vec3 &extent)
+    {
+        proxies[id].center = center;
+        proxies[id].extent = extent;
+    }
+
+    // collects finished queries; call at the top of the frame
+    void beginFrame()
+    {
+        frame++;
+        scheduled.clear();
+        for (Proxy &proxy : proxies)
+        {
+            if (!proxy.pending)
+                continue;
+            GLuint available = 0;
+            glGetQueryObjectuiv(proxy.query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                continue;
+            GLuint passed = 0;
+            glGetQueryObjectuiv(proxy.query, GL_QUERY_RESULT, &passed);
+            proxy.visible = passed != 0;
+            proxy.pending = false;
+        }
+    }
+
+    // for each proxy that passed frustum culling this frame: whether to draw
+    // it. Schedules its query if one is due. screenPixels is the rough
+    // on-screen diameter, only used for the saved / spent estimates.
+    bool visible(unsigned int id, float screenPixels)
+    {
+        if (!enabled)
+            return true;
+        Proxy &proxy = proxies[id];
+        // back in view after a gap: the old answer is stale
+        if (proxy.seenFrame + 1 != frame)
+            proxy.visible = true;
+        proxy.seenFrame = frame;
+        proxy.pixels = screenPixels * screenPixels * 0.785f;
+        if (!proxy.pending && (!proxy.visible || (frame + id) % VISIBLE_RECHECK == 0))
+            scheduled.push_back(id);
+        if (!proxy.visible)
+        {
+            frameStats.occlusionCulled++;
+            frameStats.occlusionPixelsSaved += proxy.pixels;
+        }
+        return proxy.visible;
+    }
+
+    // queries the scheduled proxies against the depth buffer as it stands;
+    // call once the occluders have been drawn
+    void issue(const glm::mat4 &viewProjection, const glm::vec3 &eye, float nearPlane)
+    {
+        if (!enabled || scheduled.empty())
+            return;
+        auto start = std::chrono::steady_clock::now();
+        glState.colorMask(false);
+        glState.depthMask(false);
+        glState.setEnabled(GL_DEPTH_TEST, true);
+        // equal depth passes: boxes flush with the surface of a drawn object
+        glState.depthFunc(GL_LEQUAL);
+        boxShader.use();
+        boxShader.setMat4("viewProjection", viewProjection);
+        glState.bindVertexArray(boxVAO);
+        for (unsigned int id : scheduled)
+        {
+            Proxy &proxy = proxies[id];
+            // a box around the camera gets clipped by the near plane and could
+            // pass for hidden
+            if (glm::all(glm::lessThanEqual(glm::abs(eye - proxy.center), proxy.extent + nearPlane)))
+            {
+                proxy.visible = true;
+                continue;
+            }
+            boxShader.setVec3("center", proxy.center);
+            boxShader.setVec3("extent", proxy.extent);
+            glBeginQuery(target, proxy.query);
+            glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+            glEndQuery(target);
+            proxy.pending = true;
+            frameStats.occlusionQueries++;
+            frameStats.occlusionProxyPixels += proxy.pixels;
+        }
+        glState.depthFunc(GL_LESS);
+        glState.depthMask(true);
+        glState.colorMask(true);
+        frameStats.occlusionIssueMs += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+private:
+    struct Proxy
+    {
+        glm::vec3 center;
+        glm::vec3 extent;
+        GLuint query = 0;
+        bool pending = false;
+        bool visible = true;
+        unsigned int seenFrame = 0;
+        float pixels = 0.0f;
+    };
+
+    Shader boxShader;
+    GLuint boxVAO = 0, boxVBO = 0, boxEBO = 0;
+    GLenum target;
+    std::vector<Proxy> proxies;
+    std::vector<unsigned int> scheduled;
+    unsigned int frame = 1;
+};
+#endif
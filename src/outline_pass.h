@@ -0,0 +1,149 @@
+#ifndef OUTLINE_PASS_H
+#define OUTLINE_PASS_H
+
+#ifdef __EMSCRIPTEN__
+#include <GLES3/gl3.h>
+#else
+#include <glad/glad.h>
+#endif
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "gl_state.h"
+#include "shader.h"
+
+// Screen-space selection outline:
+//   1. selected objects are drawn into a seed target, each covered pixel
+//      storing its own coordinates (beginMask / draw / finish)
+//   2. jump flooding spreads the nearest covered pixel to everything within
+//      the outline width, log2(width) full-screen passes
+//   3. one full-screen pass blends the outline wherever the distance to the
+//      nearest covered pixel is between 0 and the width
+// The cost depends on the screen size and width, not on how many objects are
+// selected or how many triangles they have.
+class OutlinePass
+{
+public:
+    // texture unit the flood and composite passes read seeds from
+    static const GLuint SEED_UNIT = 0;
+
+    OutlinePass()
+        : mask("res/shaders/5.1.framebuffers_screen.vs", "res/shaders/outline_mask.fs"),
+          flood("res/shaders/fullscreen.vs", "res/shaders/jump_flood.fs"),
+          composite("res/shaders/fullscreen.vs", "res/shaders/outline_composite.fs")
+    {
+        glGenVertexArrays(1, &emptyVAO);
+    }
+
+    // draw selected objects with this; it reads ObjectBlock and position only
+    Shader &maskShader()
+    {
+        return mask;
+    }
+
+    void setWidth(float pixels)
+    {
+        width = std::max(pixels, 1.0f);
+    }
+
+    void setColor(const glm::vec4 &rgba)
+    {
+        color = rgba;
+    }
+
+    // redirects drawing into the seed target at the current viewport size
+    void beginMask()
+    {
+        GLint viewport[4];
+        if (!glState.currentViewport(viewport))
+            glGetIntegerv(GL_VIEWPORT, viewport);
+        if (viewport[2] != targetWidth || viewport[3] != targetHeight)
+            createTargets(viewport[2], viewport[3]);
+        glState.bindFramebuffer(framebuffers[0]);
+        glState.viewport(0, 0, targetWidth, targetHeight);
+        const GLuint empty[4] = {0xFFFF, 0xFFFF, 0, 0};
+        glClearBufferuiv(GL_COLOR, 0, empty);
+        glState.setEnabled(GL_DEPTH_TEST, false);
+        mask.use();
+    }
+
+    // floods the seeds and blends the outline into the default framebuffer
+    void finish()
+    {
+        glState.bindVertexArray(emptyVAO);
+        flood.use();
+        flood.setInt("seeds", SEED_UNIT);
+        int current = 0;
+        for (int step = floodStart(); step >= 1; step /= 2)
+        {
+            glState.bindFramebuffer(framebuffers[1 - current]);
+            glState.bindTexture(SEED_UNIT, GL_TEXTURE_2D, seeds[current]);
+            flood.setInt("jump", step);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+            current = 1 - current;
+        }
+
+        glState.bindFramebuffer(0);
+        glState.viewport(0, 0, targetWidth, targetHeight);
+        glState.setEnabled(GL_BLEND, true);
+        glState.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        composite.use();
+        composite.setInt("seeds", SEED_UNIT);
+        composite.setFloat("width", width);
+        composite.setVec4("color", color);
+        glState.bindTexture(SEED_UNIT, GL_TEXTURE_2D, seeds[current]);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glState.setEnabled(GL_BLEND, false);
+    }
+
+private:
+    Shader mask, flood, composite;
+    GLuint emptyVAO = 0;
+    GLuint seeds[2] = {};
+    GLuint framebuffers[2] = {};
+    int targetWidth = 0, targetHeight = 0;
+    float width = 4.0f;
+    glm::vec4 color = glm::vec4(0.04f, 0.28f, 0.26f, 1.0f);
+
+    // steps width', width'/2 .. 1 with width' the power of two at or above
+    // the width reach every pixel the outline can cover
+    int floodStart() const
+    {
+        int step = 1;
+        while (step < (int)std::ceil(width))
+            step *= 2;
+        return step;
+    }
+
+    void createTargets(int w, int h)
+    {
+        if (framebuffers[0])
+        {
+            for (GLuint texture : seeds)
+                glState.forgetTexture(texture);
+            glDeleteTextures(2, seeds);
+            glDeleteFramebuffers(2, framebuffers);
+        }
+        targetWidth = w;
+        targetHeight = h;
+        glGenTextures(2, seeds);
+        glGenFramebuffers(2, framebuffers);
+        for (int i = 0; i < 2; i++)
+        {
+            // integer pixel coordinates, 0xFFFF where no seed was found yet
+            glState.bindTexture(SEED_UNIT, GL_TEXTURE_2D, seeds[i]);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16UI, w, h, 0, GL_RG_INTEGER, GL_UNSIGNED_SHORT, nullptr);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glState.bindFramebuffer(framebuffers[i]);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, seeds[i], 0);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                std::cout << "[OUTLINE] seed framebuffer is not complete" << std::endl;
+        }
+        glState.bindFramebuffer(0);
+    }
+};
+#endif
@@ -0,0 +1,265 @@
+#ifndef PAGE_FILE_H
+#define PAGE_FILE_H
+
+#include "stb_image.h"
+#include "TinyGLTF/stb_image_write.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "mip_generator.h"
+#include "pixel_convert.h"
+
+// How each page's pixels are stored in the file.
+enum PageCodec
+{
+    PAGE_CODEC_RAW = 0,
+    // baseline JPEG, decoded by stb on the page workers; drops alpha
+    PAGE_CODEC_JPEG = 1
+};
+
+struct PageFileHeader
+{
+    char magic[4] = {'S', 'V', 'T', '1'};
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t pageSize = 0;
+    uint32_t border = 0;
+    uint32_t levels = 0;
+    uint32_t codec = PAGE_CODEC_JPEG;
+    uint32_t pageCount = 0;
+};
+
+// Tiled mip pyramid of one very large image (.vtex), the backing store of a
+// VirtualTexture. Every level is cut into pageSize pages; each page is stored
+// with `border` texels of its neighbours around it, so bilinear filtering in
+// the page cache never reads across pages. After the header comes a table of
+// pageCount + 1 file offsets, then the pages, level 0 first and row by row.
+// Level sizes are powers of two and the last level fits in a single page.
+//
+// Reading is thread safe: readPage() opens its own stream, so page workers
+// can fetch in parallel.
+class PageFile
+{
+public:
+    bool open(const std::string &filePath, std::string &error)
+    {
+        std::ifstream file(filePath, std::ios::binary);
+        if (!file)
+        {
+            error = "can't open " + filePath;
+            return false;
+        }
+        file.read((char *)&header, sizeof(header));
+        if (!file || memcmp(header.magic, "SVT1", 4) != 0 || header.pageSize == 0 || header.levels == 0)
+        {
+            error = filePath + " is not a page file";
+            return false;
+        }
+        offsets.resize(header.pageCount + 1);
+        file.read((char *)offsets.data(), offsets.size() * sizeof(uint64_t));
+        if (!file)
+        {
+            error = filePath + " is truncated";
+            return false;
+        }
+        path = filePath;
+        firstPage.clear();
+        uint32_t first = 0;
+        for (int level = 0; level < levels(); level++)
+        {
+            firstPage.push_back(first);
+            first += pagesX(level) * pagesY(level);
+        }
+        return true;
+    }
+
+    int width() const { return (int)header.width; }
+    int height() const { return (int)header.height; }
+    int pageSize() const { return (int)header.pageSize; }
+    int border() const { return (int)header.border; }
+    int levels() const { return (int)header.levels; }
+
+    // edge length of a stored page, border included
+    int slotSize() const
+    {
+        return pageSize() + 2 * border();
+    }
+
+    int pagesX(int level) const
+    {
+        return std::max(1, (width() >> level) / pageSize());
+    }
+
+    int pagesY(int level) const
+    {
+        return std::max(1, (height() >> level) / pageSize());
+    }
+
+    // a page as slotSize() x slotSize() RGBA8, bottom row first
+    bool readPage(int level, int x, int y, std::vector<unsigned char> &rgba, std::string &error) const
+    {
+        uint32_t index = firstPage[level] + y * pagesX(level) + x;
+        std::vector<unsigned char> stored(offsets[index + 1] - offsets[index]);
+        std::ifstream file(path, std::ios::binary);
+        file.seekg((std::streamoff)offsets[index]);
+        file.read((char *)stored.data(), stored.size());
+        if (!file)
+        {
+            error = "can't read page " + std::to_string(index) + " of " + path;
+            return false;
+        }
+
+        size_t bytes = (size_t)slotSize() * slotSize() * 4;
+        if (header.codec == PAGE_CODEC_RAW)
+        {
+            if (stored.size() != bytes)
+            {
+                error = "bad page size in " + path;
+                return false;
+            }
+            rgba = std::move(stored);
+            return true;
+        }
+        int w = 0, h = 0, channels = 0;
+        unsigned char *data = stbi_load_from_memory(stored.data(), (int)stored.size(), &w, &h, &channels, 4);
+        if (!data || w != slotSize() || h != slotSize())
+        {
+            error = "can't decode page " + std::to_string(index) + " of " + path;
+            if (data)
+                stbi_image_free(data);
+            return false;
+        }
+        rgba.assign(data, data + bytes);
+        stbi_image_free(data);
+        return true;
+    }
+
+    // Cuts `source` into a page file. The image is resampled to power of two
+    // sizes first and the pyramid is built with MipGenerator; wrapU suits
+    // equirectangular planet maps, whose borders wrap around the date line.
+    // Holds the whole level 0 in memory, so it is meant for offline baking.
+    static bool bake(const std::string &source, const std::string &dest, std::string &error, int pageSize = 128, int border = 4,
+                     PageCodec codec = PAGE_CODEC_JPEG, bool wrapU = true)
+    {
+        stbi_set_flip_vertically_on_load_thread(false);
+        int srcWidth = 0, srcHeight = 0, channels = 0;
+        unsigned char *data = stbi_load(source.c_str(), &srcWidth, &srcHeight, &channels, 0);
+        if (!data)
+        {
+            error = "can't load " + source;
+            return false;
+        }
+        std::vector<unsigned char> level((size_t)srcWidth * srcHeight * 4);
+        // bottom row first, like every other texture in the project
+        PixelConvert::convertImage(data, channels, level.data(), 4, srcWidth, srcHeight, true);
+        stbi_image_free(data);
+
+        MipOptions options;
+        options.wrapU = wrapU;
+        int width = std::max(pageSize, nextPowerOfTwo(srcWidth));
+        int height = std::max(1, nextPowerOfTwo(srcHeight));
+        if (width != srcWidth || height != srcHeight)
+        {
+            std::vector<unsigned char> resized((size_t)width * height * 4);
+            MipGenerator::resample(level.data(), srcWidth, srcHeight, resized.data(), width, height, 4, options);
+            level.swap(resized);
+        }
+
+        PageFileHeader header;
+        header.width = width;
+        header.height = height;
+        header.pageSize = pageSize;
+        header.border = border;
+        header.codec = codec;
+        while ((width >> header.levels) > pageSize || (height >> header.levels) > pageSize)
+            header.levels++;
+        header.levels++;
+        for (uint32_t l = 0; l < header.levels; l++)
+            header.pageCount += std::max(1, (width >> l) / pageSize) * std::max(1, (height >> l) / pageSize);
+
+        std::ofstream file(dest, std::ios::binary);
+        if (!file)
+        {
+            error = "can't write " + dest;
+            return false;
+        }
+        std::vector<uint64_t> offsets;
+        file.write((const char *)&header, sizeof(header));
+        file.write(std::string((header.pageCount + 1) * sizeof(uint64_t), '\0').data(), (header.pageCount + 1) * sizeof(uint64_t));
+
+        int slot = pageSize + 2 * border;
+        std::vector<unsigned char> page((size_t)slot * slot * 4), encoded;
+        int levelWidth = width, levelHeight = height;
+        for (uint32_t l = 0; l < header.levels; l++)
+        {
+            int pagesX = std::max(1, levelWidth / pageSize), pagesY = std::max(1, levelHeight / pageSize);
+            for (int py = 0; py < pagesY; py++)
+                for (int px = 0; px < pagesX; px++)
+                {
+                    // texels outside the level wrap in u or clamp
+                    for (int y = 0; y < slot; y++)
+                    {
+                        int sy = std::min(std::max(py * pageSize + y - border, 0), levelHeight - 1);
+                        for (int x = 0; x < slot; x++)
+                        {
+                            int sx = px * pageSize + x - border;
+                            sx = wrapU ? ((sx % levelWidth) + levelWidth) % levelWidth : std::min(std::max(sx, 0), levelWidth - 1);
+                            memcpy(&page[((size_t)y * slot + x) * 4], &level[((size_t)sy * levelWidth + sx) * 4], 4);
+                        }
+                    }
+                    offsets.push_back((uint64_t)file.tellp());
+                    if (codec == PAGE_CODEC_RAW)
+                        file.write((const char *)page.data(), page.size());
+                    else
+                    {
+                        // row order round trips: stb writes and reads row 0 first
+                        encoded.clear();
+                        stbi_write_jpg_to_func(appendBytes, &encoded, slot, slot, 4, page.data(), 90);
+                        file.write((const char *)encoded.data(), encoded.size());
+                    }
+                }
+            if (l + 1 < header.levels)
+            {
+                level = MipGenerator::downsample(level.data(), levelWidth, levelHeight, 4, options);
+                levelWidth = std::max(1, levelWidth / 2);
+                levelHeight = std::max(1, levelHeight / 2);
+            }
+        }
+        offsets.push_back((uint64_t)file.tellp());
+        file.seekp(sizeof(header));
+        file.write((const char *)offsets.data(), offsets.size() * sizeof(uint64_t));
+        if (!file)
+        {
+            error = "failed writing " + dest;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    std::string path;
+    PageFileHeader header;
+    std::vector<uint64_t> offsets;
+    std::vector<uint32_t> firstPage;
+
+    static int nextPowerOfTwo(int value)
+    {
+        int power = 1;
+        while (power < value)
+            power *= 2;
+        return power;
+    }
+
+    static void appendBytes(void *context, void *data, int size)
+    {
+        std::vector<unsigned char> *out = (std::vector<unsigned char> *)context;
+        out->insert(out->end(), (unsigned char *)data, (unsigned char *)data + size);
+    }
+};
+#endif
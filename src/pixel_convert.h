@@ -0,0 +1,584 @@
+#ifndef PIXEL_CONVERT_H
+#define PIXEL_CONVERT_H
+
+// x86 builds always get SSE2; SSSE3 and AVX2 kernels are used when the
+// compiler is allowed to emit them (see SIMD_AVX2 in CMakeLists.txt).
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define PIXEL_CONVERT_AVX2
+#endif
+#if defined(__SSSE3__) || defined(__AVX__)
+#include <tmmintrin.h>
+#define PIXEL_CONVERT_SSSE3
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define PIXEL_CONVERT_SSE2
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#define PIXEL_CONVERT_WASM_SIMD
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+// Pixel conversions used while ingesting textures: channel expansion and
+// reduction, swizzles, row flips, premultiplied alpha and sRGB <-> linear.
+// Channel rules follow stb_image's generic converter: grey expands to
+// (g, g, g), colour reduces to luminance (77 r + 150 g + 29 b) >> 8 and
+// missing alpha is 255. (stb's jpeg path reads grey straight from the Y
+// plane instead, so jpegs reduced to grey can differ by a step.)
+class PixelConvert
+{
+public:
+    static uint8_t luminance(const uint8_t *rgb)
+    {
+        return (uint8_t)((rgb[0] * 77 + rgb[1] * 150 + rgb[2] * 29) >> 8);
+    }
+
+    // (c * a) / 255 rounded, the same formula the simd paths use
+    static uint8_t mulDiv255(unsigned int c, unsigned int a)
+    {
+        unsigned int t = c * a + 128;
+        return (uint8_t)((t + (t >> 8)) >> 8);
+    }
+
+    static void convertScalar(const uint8_t *src, int srcChannels, uint8_t *dst, int dstChannels, size_t count)
+    {
+        for (size_t i = 0; i < count; i++, src += srcChannels, dst += dstChannels)
+        {
+            uint8_t grey = srcChannels >= 3 ? luminance(src) : src[0];
+            uint8_t alpha = srcChannels == 2 ? src[1] : srcChannels == 4 ? src[3] : 255;
+            switch (dstChannels)
+            {
+            case 1:
+                dst[0] = grey;
+                break;
+            case 2:
+                dst[0] = grey;
+                dst[1] = alpha;
+                break;
+            default:
+                if (srcChannels >= 3)
+                {
+                    dst[0] = src[0];
+                    dst[1] = src[1];
+                    dst[2] = src[2];
+                }
+                else
+                    dst[0] = dst[1] = dst[2] = grey;
+                if (dstChannels == 4)
+                    dst[3] = alpha;
+                break;
+            }
+        }
+    }
+
+    // rgb -> rgba, 16 pixels per iteration
+    static size_t expand3to4(const uint8_t *src, uint8_t *dst, size_t count)
+    {
+        size_t i = 0;
+#if defined(PIXEL_CONVERT_SSSE3)
+        const __m128i mask = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+        const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+        for (; i + 16 <= count; i += 16)
+        {
+            __m128i in0 = _mm_loadu_si128((const __m128i *)(src + i * 3));
+            __m128i in1 = _mm_loadu_si128((const __m128i *)(src + i * 3 + 16));
+            __m128i in2 = _mm_loadu_si128((const __m128i *)(src + i * 3 + 32));
+            __m128i *out = (__m128i *)(dst + i * 4);
+            _mm_storeu_si128(out + 0, _mm_or_si128(_mm_shuffle_epi8(in0, mask), alpha));
+            _mm_storeu_si128(out + 1, _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(in1, in0, 12), mask), alpha));
+            _mm_storeu_si128(out + 2, _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(in2, in1, 8), mask), alpha));
+            _mm_storeu_si128(out + 3, _mm_or_si128(_mm_shuffle_epi8(_mm_srli_si128(in2, 4), mask), alpha));
+        }
+#elif defined(PIXEL_CONVERT_WASM_SIMD)
+        const v128_t alpha = wasm_i32x4_splat((int)0xFF000000);
+        for (; i + 16 <= count; i += 16)
+        {
+            v128_t in0 = wasm_v128_load(src + i * 3);
+            v128_t in1 = wasm_v128_load(src + i * 3 + 16);
+            v128_t in2 = wasm_v128_load(src + i * 3 + 32);
+            uint8_t *out = dst + i * 4;
+            // alpha lanes pick any byte, the or overwrites them
+            wasm_v128_store(out, wasm_v128_or(wasm_i8x16_shuffle(in0, in0, 0, 1, 2, 0, 3, 4, 5, 0, 6, 7, 8, 0, 9, 10, 11, 0), alpha));
+            wasm_v128_store(out + 16, wasm_v128_or(wasm_i8x16_shuffle(in0, in1, 12, 13, 14, 0, 15, 16, 17, 0, 18, 19, 20, 0, 21, 22, 23, 0), alpha));
+            wasm_v128_store(out + 32, wasm_v128_or(wasm_i8x16_shuffle(in1, in2, 8, 9, 10, 0, 11, 12, 13, 0, 14, 15, 16, 0, 17, 18, 19, 0), alpha));
+            wasm_v128_store(out + 48, wasm_v128_or(wasm_i8x16_shuffle(in2, in2, 4, 5, 6, 0, 7, 8, 9, 0, 10, 11, 12, 0, 13, 14, 15, 0), alpha));
+        }
+#endif
+        return i;
+    }
+
+    // grey -> rgba, 16 pixels per iteration
+    static size_t expand1to4(const uint8_t *src, uint8_t *dst, size_t count)
+    {
+        size_t i = 0;
+#if defined(PIXEL_CONVERT_SSE2)
+        const __m128i opaque = _mm_set1_epi8((char)0xFF);
+        for (; i + 16 <= count; i += 16)
+        {
+            __m128i g = _mm_loadu_si128((const __m128i *)(src + i));
+            __m128i ggLo = _mm_unpacklo_epi8(g, g), ggHi = _mm_unpackhi_epi8(g, g);
+            __m128i gaLo = _mm_unpacklo_epi8(g, opaque), gaHi = _mm_unpackhi_epi8(g, opaque);
+            __m128i *out = (__m128i *)(dst + i * 4);
+            _mm_storeu_si128(out + 0, _mm_unpacklo_epi16(ggLo, gaLo));
+            _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(ggLo, gaLo));
+            _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(ggHi, gaHi));
+            _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(ggHi, gaHi));
+        }
+#elif defined(PIXEL_CONVERT_WASM_SIMD)
+        const v128_t opaque = wasm_i8x16_splat((int8_t)0xFF);
+        for (; i + 16 <= count; i += 16)
+        {
+            v128_t g = wasm_v128_load(src + i);
+            v128_t ggLo = wasm_i8x16_shuffle(g, g, 0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23);
+            v128_t ggHi = wasm_i8x16_shuffle(g, g, 8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31);
+            v128_t gaLo = wasm_i8x16_shuffle(g, opaque, 0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23);
+            v128_t gaHi = wasm_i8x16_shuffle(g, opaque, 8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31);
+            uint8_t *out = dst + i * 4;
+            wasm_v128_store(out, wasm_i16x8_shuffle(ggLo, gaLo, 0, 8, 1, 9, 2, 10, 3, 11));
+            wasm_v128_store(out + 16, wasm_i16x8_shuffle(ggLo, gaLo, 4, 12, 5, 13, 6, 14, 7, 15));
+            wasm_v128_store(out + 32, wasm_i16x8_shuffle(ggHi, gaHi, 0, 8, 1, 9, 2, 10, 3, 11));
+            wasm_v128_store(out + 48, wasm_i16x8_shuffle(ggHi, gaHi, 4, 12, 5, 13, 6, 14, 7, 15));
+        }
+#endif
+        return i;
+    }
+
+    // grey+alpha -> rgba, 8 pixels per iteration
+    static size_t expand2to4(const uint8_t *src, uint8_t *dst, size_t count)
+    {
+        size_t i = 0;
+#if defined(PIXEL_CONVERT_SSE2)
+        const __m128i low = _mm_set1_epi16(0x00FF);
+        for (; i + 8 <= count; i += 8)
+        {
+            __m128i ga = _mm_loadu_si128((const __m128i *)(src + i * 2));
+            __m128i g = _mm_and_si128(ga, low);
+            __m128i gg = _mm_or_si128(g, _mm_slli_epi16(g, 8));
+            __m128i *out = (__m128i *)(dst + i * 4);
+            _mm_storeu_si128(out + 0, _mm_unpacklo_epi16(gg, ga));
+            _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(gg, ga));
+        }
+#elif defined(PIXEL_CONVERT_WASM_SIMD)
+        const v128_t low = wasm_i16x8_splat(0x00FF);
+        for (; i + 8 <= count; i += 8)
+        {
+            v128_t ga = wasm_v128_load(src + i * 2);
+            v128_t g = wasm_v128_and(ga, low);
+            v128_t gg = wasm_v128_or(g, wasm_i16x8_shl(g, 8));
+            uint8_t *out = dst + i * 4;
+            wasm_v128_store(out, wasm_i16x8_shuffle(gg, ga, 0, 8, 1, 9, 2, 10, 3, 11));
+            wasm_v128_store(out + 16, wasm_i16x8_shuffle(gg, ga, 4, 12, 5, 13, 6, 14, 7, 15));
+        }
+#endif
+        return i;
+    }
+
+    // rgba -> rgb, 16 pixels per iteration
+    static size_t reduce4to3(const uint8_t *src, uint8_t *dst, size_t count)
+    {
+        size_t i = 0;
+#if defined(PIXEL_CONVERT_SSSE3)
+        const __m128i mask = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+        for (; i + 16 <= count; i += 16)
+        {
+            const __m128i *in = (const __m128i *)(src + i * 4);
+            __m128i p0 = _mm_shuffle_epi8(_mm_loadu_si128(in + 0), mask);
+            __m128i p1 = _mm_shuffle_epi8(_mm_loadu_si128(in + 1), mask);
+            __m128i p2 = _mm_shuffle_epi8(_mm_loadu_si128(in + 2), mask);
+            __m128i p3 = _mm_shuffle_epi8(_mm_loadu_si128(in + 3), mask);
+            // each p holds 12 packed bytes; stitch them into three vectors
+            __m128i *out = (__m128i *)(dst + i * 3);
+            _mm_storeu_si128(out + 0, _mm_or_si128(p0, _mm_slli_si128(p1, 12)));
+            _mm_storeu_si128(out + 1, _mm_or_si128(_mm_srli_si128(p1, 4), _mm_slli_si128(p2, 8)));
+            _mm_storeu_si128(out + 2, _mm_or_si128(_mm_srli_si128(p2, 8), _mm_slli_si128(p3, 4)));
+        }
+#elif defined(PIXEL_CONVERT_WASM_SIMD)
+        for (; i + 16 <= count; i += 16)
+        {
+            const uint8_t *in = src + i * 4;
+            v128_t in0 = wasm_v128_load(in), in1 = wasm_v128_load(in + 16);
+            v128_t in2 = wasm_v128_load(in + 32), in3 = wasm_v128_load(in + 48);
+            uint8_t *out = dst + i * 3;
+            wasm_v128_store(out, wasm_i8x16_shuffle(in0, in1, 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 16, 17, 18, 20));
+            wasm_v128_store(out + 16, wasm_i8x16_shuffle(in1, in2, 5, 6, 8, 9, 10, 12, 13, 14, 16, 17, 18, 20, 21, 22, 24, 25));
+            wasm_v128_store(out + 32, wasm_i8x16_shuffle(in2, in3, 10, 12, 13, 14, 16, 17, 18, 20, 21, 22, 24, 25, 26, 28, 29, 30));
+        }
+#endif
+        return i;
+    }
+
+    // Converts `count` pixels between channel counts (1 to 4 each way).
+    // src and dst must not overlap.
+    static void convert(const uint8_t *src, int srcChannels, uint8_t *dst, int dstChannels, size_t count)
+    {
+        if (srcChannels == dstChannels)
+        {
+            memcpy(dst, src, count * srcChannels);
+            return;
+        }
+        size_t done = 0;
+        if (dstChannels == 4 && srcChannels == 3)
+            done = expand3to4(src, dst, count);
+        else if (dstChannels == 4 && srcChannels == 1)
+            done = expand1to4(src, dst, count);
+        else if (dstChannels == 4 && srcChannels == 2)
+            done = expand2to4(src, dst, count);
+        else if (dstChannels == 3 && srcChannels == 4)
+            done = reduce4to3(src, dst, count);
+        convertScalar(src + done * srcChannels, srcChannels, dst + done * dstChannels, dstChannels, count - done);
+    }
+
+    // Whole image conversion; with `flip` rows are written bottom-up, so the
+    // vertical flip costs nothing extra.
+    static void convertImage(const uint8_t *src, int srcChannels, uint8_t *dst, int dstChannels, int width, int height, bool flip)
+    {
+        size_t srcRow = (size_t)width * srcChannels, dstRow = (size_t)width * dstChannels;
+        for (int y = 0; y < height; y++)
+        {
+            int dy = flip ? height - 1 - y : y;
+            convert(src + y * srcRow, srcChannels, dst + dy * dstRow, dstChannels, (size_t)width);
+        }
+    }
+
+    // in-place vertical flip
+    static void flipRows(uint8_t *pixels, size_t rowBytes, int height)
+    {
+        std::vector<uint8_t> temp(rowBytes);
+        for (int top = 0, bottom = height - 1; top < bottom; top++, bottom--)
+        {
+            uint8_t *a = pixels + top * rowBytes, *b = pixels + bottom * rowBytes;
+            memcpy(temp.data(), a, rowBytes);
+            memcpy(a, b, rowBytes);
+            memcpy(b, temp.data(), rowBytes);
+        }
+    }
+
+    // Reorders the channels of 4-channel pixels in place: output channel c
+    // takes input channel order[c], e.g. {2, 1, 0, 3} turns BGRA into RGBA.
+    static void swizzle4(uint8_t *pixels, size_t count, const int order[4])
+    {
+        size_t i = 0;
+#if defined(PIXEL_CONVERT_SSSE3) || defined(PIXEL_CONVERT_WASM_SIMD)
+        uint8_t mask[32];
+        for (int b = 0; b < 32; b++)
+            mask[b] = (uint8_t)((b & ~3) + order[b & 3]);
+#endif
+#if defined(PIXEL_CONVERT_AVX2)
+        __m256i shuffle = _mm256_loadu_si256((const __m256i *)mask);
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256i *p = (__m256i *)(pixels + i * 4);
+            _mm256_storeu_si256(p, _mm256_shuffle_epi8(_mm256_loadu_si256(p), shuffle));
+        }
+#endif
+#if defined(PIXEL_CONVERT_SSSE3)
+        __m128i shuffle128 = _mm_loadu_si128((const __m128i *)mask);
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128i *p = (__m128i *)(pixels + i * 4);
+            _mm_storeu_si128(p, _mm_shuffle_epi8(_mm_loadu_si128(p), shuffle128));
+        }
+#elif defined(PIXEL_CONVERT_WASM_SIMD)
+        v128_t shuffle128 = wasm_v128_load(mask);
+        for (; i + 4 <= count; i += 4)
+        {
+            uint8_t *p = pixels + i * 4;
+            wasm_v128_store(p, wasm_i8x16_swizzle(wasm_v128_load(p), shuffle128));
+        }
+#endif
+        for (; i < count; i++)
+        {
+            uint8_t *p = pixels + i * 4;
+            uint8_t in[4] = {p[0], p[1], p[2], p[3]};
+            for (int c = 0; c < 4; c++)
+                p[c] = in[order[c]];
+        }
+    }
+
+    // rgb *= a / 255 on 4-channel pixels in place, alpha unchanged
+    static void premultiplyAlpha(uint8_t *pixels, size_t count)
+    {
+        size_t i = 0;
+#if defined(PIXEL_CONVERT_AVX2)
+        {
+            const __m256i zero = _mm256_setzero_si256();
+            const __m256i alphaLanes = _mm256_set1_epi64x((long long)0xFFFF000000000000ull);
+            const __m256i bias = _mm256_set1_epi16(128);
+            for (; i + 8 <= count; i += 8)
+            {
+                __m256i *p = (__m256i *)(pixels + i * 4);
+                __m256i v = _mm256_loadu_si256(p);
+                __m256i halves[2] = {_mm256_unpacklo_epi8(v, zero), _mm256_unpackhi_epi8(v, zero)};
+                for (__m256i &h : halves)
+                {
+                    __m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(h, 0xFF), 0xFF);
+                    // multiply alpha by 255 so it comes back unchanged
+                    a = _mm256_blendv_epi8(a, _mm256_set1_epi16(255), alphaLanes);
+                    __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(h, a), bias);
+                    h = _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+                }
+                _mm256_storeu_si256(p, _mm256_packus_epi16(halves[0], halves[1]));
+            }
+        }
+#endif
+#if defined(PIXEL_CONVERT_SSE2)
+        {
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i alphaLanes = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+            const __m128i opaque = _mm_and_si128(alphaLanes, _mm_set1_epi16(255));
+            const __m128i bias = _mm_set1_epi16(128);
+            for (; i + 4 <= count; i += 4)
+            {
+                __m128i *p = (__m128i *)(pixels + i * 4);
+                __m128i v = _mm_loadu_si128(p);
+                __m128i halves[2] = {_mm_unpacklo_epi8(v, zero), _mm_unpackhi_epi8(v, zero)};
+                for (__m128i &h : halves)
+                {
+                    __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(h, 0xFF), 0xFF);
+                    a = _mm_or_si128(_mm_andnot_si128(alphaLanes, a), opaque);
+                    __m128i t = _mm_add_epi16(_mm_mullo_epi16(h, a), bias);
+                    h = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+                }
+                _mm_storeu_si128(p, _mm_packus_epi16(halves[0], halves[1]));
+            }
+        }
+#elif defined(PIXEL_CONVERT_WASM_SIMD)
+        {
+            const v128_t alphaLanes = wasm_i16x8_make(0, 0, 0, -1, 0, 0, 0, -1);
+            const v128_t opaque = wasm_v128_and(alphaLanes, wasm_i16x8_splat(255));
+            const v128_t bias = wasm_i16x8_splat(128);
+            for (; i + 4 <= count; i += 4)
+            {
+                uint8_t *p = pixels + i * 4;
+                v128_t v = wasm_v128_load(p);
+                v128_t halves[2] = {wasm_u16x8_extend_low_u8x16(v), wasm_u16x8_extend_high_u8x16(v)};
+                for (v128_t &h : halves)
+                {
+                    v128_t a = wasm_i16x8_shuffle(h, h, 3, 3, 3, 3, 7, 7, 7, 7);
+                    a = wasm_v128_or(wasm_v128_andnot(a, alphaLanes), opaque);
+                    v128_t t = wasm_i16x8_add(wasm_i16x8_mul(h, a), bias);
+                    h = wasm_u16x8_shr(wasm_i16x8_add(t, wasm_u16x8_shr(t, 8)), 8);
+                }
+                wasm_v128_store(p, wasm_u8x16_narrow_i16x8(halves[0], halves[1]));
+            }
+        }
+#endif
+        for (; i < count; i++)
+        {
+            uint8_t *p = pixels + i * 4;
+            p[0] = mulDiv255(p[0], p[3]);
+            p[1] = mulDiv255(p[1], p[3]);
+            p[2] = mulDiv255(p[2], p[3]);
+        }
+    }
+
+    static float srgbDecode(float c)
+    {
+        return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+    }
+
+    static float srgbEncode(float l)
+    {
+        return l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+    }
+
+    // linear values are quantized to 16 bits and looked up: below one step
+    // of error in the darks, where the curve is steepest, and a plain table
+    // lookup everywhere else. Three bytes of padding let AVX2 gather dwords.
+    static const int LINEAR_STEPS = 65535;
+
+    struct SrgbTables
+    {
+        float toLinear[256];
+        uint8_t toSrgb[LINEAR_STEPS + 1 + 3];
+
+        SrgbTables()
+        {
+            for (int i = 0; i < 256; i++)
+                toLinear[i] = srgbDecode(i / 255.0f);
+            for (int i = 0; i <= LINEAR_STEPS; i++)
+                toSrgb[i] = (uint8_t)(srgbEncode(i / (float)LINEAR_STEPS) * 255.0f + 0.5f);
+            toSrgb[LINEAR_STEPS + 1] = toSrgb[LINEAR_STEPS + 2] = toSrgb[LINEAR_STEPS + 3] = 0;
+        }
+    };
+
+    static const SrgbTables &srgbTables()
+    {
+        static const SrgbTables tables;
+        return tables;
+    }
+
+    // alpha is stored linearly in every format
+    static bool hasAlpha(int channels)
+    {
+        return channels == 2 || channels == 4;
+    }
+
+    // 8-bit sRGB -> linear float, alpha only rescaled to 0..1
+    static void srgbToLinear(const uint8_t *src, float *dst, size_t count, int channels)
+    {
+        const float *table = srgbTables().toLinear;
+        size_t values = count * channels;
+        for (size_t i = 0; i < values; i++)
+            dst[i] = table[src[i]];
+        if (hasAlpha(channels))
+            for (size_t i = channels - 1; i < values; i += channels)
+                dst[i] = src[i] * (1.0f / 255.0f);
+    }
+
+    // linear float -> 8-bit sRGB, clamped; alpha is only rescaled
+    static void linearToSrgb(const float *src, uint8_t *dst, size_t count, int channels)
+    {
+        const uint8_t *table = srgbTables().toSrgb;
+        size_t values = count * channels;
+        size_t i = 0;
+#if defined(PIXEL_CONVERT_AVX2)
+        {
+            const __m256 scale = _mm256_set1_ps((float)LINEAR_STEPS), half = _mm256_set1_ps(0.5f);
+            const __m256 lo = _mm256_setzero_ps(), hi = _mm256_set1_ps(1.0f);
+            const __m256i low = _mm256_set1_epi32(0xFF);
+            for (; i + 8 <= values; i += 8)
+            {
+                __m256 v = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(src + i), lo), hi);
+                __m256i index = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(v, scale), half));
+                __m256i srgb = _mm256_and_si256(_mm256_i32gather_epi32((const int *)table, index, 1), low);
+                // eight dwords down to eight bytes
+                __m128i words = _mm_packus_epi32(_mm256_castsi256_si128(srgb), _mm256_extracti128_si256(srgb, 1));
+                _mm_storel_epi64((__m128i *)(dst + i), _mm_packus_epi16(words, words));
+            }
+        }
+#endif
+#if defined(PIXEL_CONVERT_SSE2)
+        {
+            const __m128 scale = _mm_set1_ps((float)LINEAR_STEPS), half = _mm_set1_ps(0.5f);
+            const __m128 lo = _mm_setzero_ps(), hi = _mm_set1_ps(1.0f);
+            alignas(16) int32_t index[4];
+            for (; i + 4 <= values; i += 4)
+            {
+                __m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i), lo), hi);
+                _mm_store_si128((__m128i *)index, _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v, scale), half)));
+                dst[i] = table[index[0]];
+                dst[i + 1] = table[index[1]];
+                dst[i + 2] = table[index[2]];
+                dst[i + 3] = table[index[3]];
+            }
+        }
+#elif defined(PIXEL_CONVERT_WASM_SIMD)
+        {
+            const v128_t scale = wasm_f32x4_splat((float)LINEAR_STEPS), half = wasm_f32x4_splat(0.5f);
+            const v128_t lo = wasm_f32x4_splat(0.0f), hi = wasm_f32x4_splat(1.0f);
+            for (; i + 4 <= values; i += 4)
+            {
+                v128_t v = wasm_f32x4_min(wasm_f32x4_max(wasm_v128_load(src + i), lo), hi);
+                v128_t index = wasm_i32x4_trunc_sat_f32x4(wasm_f32x4_add(wasm_f32x4_mul(v, scale), half));
+                dst[i] = table[wasm_i32x4_extract_lane(index, 0)];
+                dst[i + 1] = table[wasm_i32x4_extract_lane(index, 1)];
+                dst[i + 2] = table[wasm_i32x4_extract_lane(index, 2)];
+                dst[i + 3] = table[wasm_i32x4_extract_lane(index, 3)];
+            }
+        }
+#endif
+        for (; i < values; i++)
+            dst[i] = table[(int)(std::min(std::max(src[i], 0.0f), 1.0f) * LINEAR_STEPS + 0.5f)];
+        if (hasAlpha(channels))
+            for (size_t a = channels - 1; a < values; a += channels)
+                dst[a] = (uint8_t)(std::min(std::max(src[a], 0.0f), 1.0f) * 255.0f + 0.5f);
+    }
+
+    // 8-bit unorm <-> float for data that isn't colour (normals, heights)
+    static void unormToFloat(const uint8_t *src, float *dst, size_t values)
+    {
+        for (size_t i = 0; i < values; i++)
+            dst[i] = src[i] * (1.0f / 255.0f);
+    }
+
+    static void floatToUnorm(const float *src, uint8_t *dst, size_t values)
+    {
+        for (size_t i = 0; i < values; i++)
+            dst[i] = (uint8_t)(std::min(std::max(src[i], 0.0f), 1.0f) * 255.0f + 0.5f);
+    }
+
+    static const char *simdName()
+    {
+#if defined(PIXEL_CONVERT_AVX2)
+        return "avx2";
+#elif defined(PIXEL_CONVERT_SSSE3)
+        return "ssse3";
+#elif defined(PIXEL_CONVERT_SSE2)
+        return "sse2";
+#elif defined(PIXEL_CONVERT_WASM_SIMD)
+        return "wasm simd128";
+#else
+        return "scalar";
+#endif
+    }
+
+    // Times every kernel on 1K to 8K square images (4K on the web, where the
+    // heap is tighter) and prints the throughput. Run with SOLAR_PIXEL_BENCH.
+    static void benchmark(std::ostream &out = std::cout)
+    {
+#ifdef __EMSCRIPTEN__
+        const int maxSize = 4096;
+#else
+        const int maxSize = 8192;
+#endif
+        out << "[PIXELS] kernels: " << simdName() << std::endl;
+        for (int size = 1024; size <= maxSize; size *= 2)
+        {
+            size_t count = (size_t)size * size;
+            std::vector<uint8_t> src(count * 4), dst(count * 4);
+            for (size_t i = 0; i < src.size(); i++)
+                src[i] = (uint8_t)(i * 2654435761u >> 13);
+
+            auto report = [&](const char *name, size_t bytes, auto &&kernel)
+            {
+                auto start = std::chrono::steady_clock::now();
+                kernel();
+                float ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+                out << "  " << std::setw(5) << size << "^2 " << std::setw(18) << std::left << name << std::right
+                    << std::setw(9) << std::fixed << std::setprecision(2) << ms << " ms "
+                    << std::setw(8) << std::setprecision(0) << bytes / 1048576.0 / (ms / 1000.0) << " MB/s" << std::endl;
+            };
+
+            report("rgb -> rgba", count * 4, [&]
+                   { convert(src.data(), 3, dst.data(), 4, count); });
+            report("grey -> rgba", count * 4, [&]
+                   { convert(src.data(), 1, dst.data(), 4, count); });
+            report("rgba -> rgb", count * 3, [&]
+                   { convert(src.data(), 4, dst.data(), 3, count); });
+            report("rgb -> rgba flip", count * 4, [&]
+                   { convertImage(src.data(), 3, dst.data(), 4, size, size, true); });
+            report("flip rows", count * 4, [&]
+                   { flipRows(dst.data(), (size_t)size * 4, size); });
+            const int bgra[4] = {2, 1, 0, 3};
+            report("swizzle bgra", count * 4, [&]
+                   { swizzle4(dst.data(), count, bgra); });
+            report("premultiply", count * 4, [&]
+                   { premultiplyAlpha(dst.data(), count); });
+
+            // float images of this size don't fit comfortably, go through a
+            // band of rows at a time like the mip generator does
+            const size_t bandPixels = (size_t)size * 64;
+            std::vector<float> linear(bandPixels * 4);
+            report("srgb <-> linear", count * 4, [&]
+                   {
+                       for (size_t first = 0; first < count; first += bandPixels)
+                       {
+                           size_t n = std::min(bandPixels, count - first);
+                           srgbToLinear(src.data() + first * 4, linear.data(), n, 4);
+                           linearToSrgb(linear.data(), dst.data() + first * 4, n, 4);
+                       } });
+        }
+        out << std::defaultfloat;
+    }
+};
+#endif
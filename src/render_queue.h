@@ -0,0 +1,280 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#ifdef __EMSCRIPTEN__
+#include <GLES3/gl3.h>
+#else
+#include <glad/glad.h>
+#endif
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "command_list.h"
+#include "material.h"
+#include "transform_batch.h"
+#include "frame_stats.h"
+
+// Fixed-function state a pass is drawn with, applied when the queue moves
+// on to the pass.
+struct PassState
+{
+    bool depthTest = true;
+    GLenum stencilFunc = GL_ALWAYS;
+    GLint stencilRef = 0;
+    GLuint stencilWriteMask = 0x00;
+};
+
+// Collects the frame's draws, orders them by a 64-bit key (see
+// CommandList::makeKey) and issues them in one loop that only makes the GL
+// calls whose state actually changes. Draws come from the queue's own list,
+// filled through submit() on the GL thread, and from any lists recorded
+// elsewhere and handed over with add().
+class RenderQueue
+{
+public:
+    static const unsigned int PASS_COUNT = 16;
+
+    explicit RenderQueue(TransformBatch &transforms)
+        : transforms(transforms), own(transforms)
+    {
+    }
+
+    void setPass(unsigned int pass, const PassState &state)
+    {
+        passes[pass] = state;
+    }
+
+    // where depth is measured from for this frame's keys
+    void setEye(const glm::vec3 &position)
+    {
+        eye = position;
+        own.eye = position;
+    }
+
+    void submit(unsigned int pass, const Material &material, GLuint vao, GLenum mode, GLsizei count, bool indexed,
+                unsigned int slot, float screenPixels = TextureManager::FULL_COVERAGE, GLsizei instances = 0)
+    {
+        own.draw(pass, material, vao, mode, count, indexed, slot, screenPixels, instances);
+    }
+
+    // see CommandList::drawInstances
+    void submitInstances(unsigned int pass, const Material &material, GLuint vao, GLsizei count, const InstanceBuffer &buffer,
+                         unsigned int slot, float screenPixels = TextureManager::FULL_COVERAGE)
+    {
+        own.drawInstances(pass, material, vao, count, buffer, slot, screenPixels);
+    }
+
+    // for the next submit(); the value stays set for later draws on the
+    // same program, so every draw that reads it should set it
+    void uniform(GLint location, int value)
+    {
+        own.uniform(location, value);
+    }
+
+    // readies a list for recording this frame, on any thread
+    void begin(CommandList &list) const
+    {
+        list.begin(eye);
+    }
+
+    // replays the list with the next flush(); it must stay untouched until then
+    void add(const CommandList &list)
+    {
+        lists.push_back(&list);
+    }
+
+    // uploads, sorts and draws everything recorded since the last flush
+    void flush()
+    {
+        auto start = std::chrono::steady_clock::now();
+        lists.insert(lists.begin(), &own);
+        upload();
+        sort();
+        auto sorted = std::chrono::steady_clock::now();
+
+        int pass = -1;
+        GLuint program = 0, vao = 0;
+        const Material *material = nullptr;
+        unsigned int slot = ~0u;
+        bool first = true;
+        for (const Entry &entry : order)
+        {
+            const CommandList &list = *lists[entry.list];
+            const DrawPacket &packet = list.draws[entry.index];
+            GLsizei instances = packet.instanceBuffer ? packet.instanceBuffer->size() : packet.instances;
+            if (packet.instanceBuffer && instances == 0)
+                continue;
+            int packetPass = (int)(packet.key >> 60);
+            if (packetPass != pass)
+            {
+                pass = packetPass;
+                applyPass(passes[pass]);
+            }
+            if (first || packet.material->program != program)
+            {
+                program = packet.material->program;
+                glState.useProgram(program);
+                frameStats.programBinds++;
+                material = nullptr;
+            }
+            if (packet.material != material)
+            {
+                material = packet.material;
+                material->bind(packet.screenPixels);
+            }
+            else
+                material->touch(packet.screenPixels);
+            for (uint32_t i = 0; i < packet.uniformCount; i++)
+                applyUniform(list.uniforms[packet.firstUniform + i]);
+            if (first || packet.vao != vao)
+            {
+                vao = packet.vao;
+                glState.bindVertexArray(vao);
+                frameStats.vaoBinds++;
+            }
+            if (packet.slot != slot)
+            {
+                slot = packet.slot;
+                transforms.bind(slot);
+            }
+            first = false;
+
+            if (instances > 0)
+            {
+                glDrawElementsInstanced(packet.mode, packet.count, GL_UNSIGNED_INT, 0, instances);
+                frameStats.instancedDraws++;
+                frameStats.instances += instances;
+            }
+            else if (packet.indexed)
+                glDrawElements(packet.mode, packet.count, GL_UNSIGNED_INT, 0);
+            else
+                glDrawArrays(packet.mode, 0, packet.count);
+        }
+
+        frameStats.drawPackets += (unsigned int)order.size();
+        frameStats.commandLists += (unsigned int)lists.size() - 1;
+        frameStats.queueSortMs += std::chrono::duration<float, std::milli>(sorted - start).count();
+        frameStats.queueSubmitMs += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - sorted).count();
+        own.begin(eye);
+        lists.clear();
+    }
+
+private:
+    struct Entry
+    {
+        uint64_t key;
+        uint32_t list;
+        uint32_t index;
+    };
+
+    // an instance buffer filled from the lists, and its size this frame
+    struct Stream
+    {
+        InstanceBuffer *buffer;
+        GLsizei total;
+    };
+
+    TransformBatch &transforms;
+    PassState passes[PASS_COUNT];
+    glm::vec3 eye = glm::vec3(0.0f);
+    CommandList own;
+    // this frame's lists, own first during flush()
+    std::vector<const CommandList *> lists;
+    std::vector<Entry> order, scratch;
+    std::vector<Stream> streams, lastStreams;
+
+    // refills every buffer the lists appended to with their runs, in list
+    // order; a buffer filled last frame and not this one ends up empty
+    void upload()
+    {
+        streams.clear();
+        for (const CommandList *list : lists)
+            for (const UploadPacket &upload : list->uploads)
+            {
+                if (upload.instances.empty())
+                    continue;
+                auto stream = std::find_if(streams.begin(), streams.end(), [&](const Stream &s)
+                                           { return s.buffer == upload.buffer; });
+                if (stream == streams.end())
+                    streams.push_back({upload.buffer, (GLsizei)upload.instances.size()});
+                else
+                    stream->total += (GLsizei)upload.instances.size();
+            }
+        for (const Stream &stream : streams)
+        {
+            stream.buffer->reserve(stream.total, GL_STREAM_DRAW);
+            GLsizei offset = 0;
+            for (const CommandList *list : lists)
+                for (const UploadPacket &upload : list->uploads)
+                    if (upload.buffer == stream.buffer && !upload.instances.empty())
+                    {
+                        stream.buffer->write(offset, upload.instances.data(), (GLsizei)upload.instances.size());
+                        offset += (GLsizei)upload.instances.size();
+                    }
+            stream.buffer->setSize(stream.total);
+            frameStats.commandUploadBytes += (size_t)stream.total * sizeof(InstanceData);
+        }
+        for (const Stream &last : lastStreams)
+            if (std::none_of(streams.begin(), streams.end(), [&](const Stream &s)
+                             { return s.buffer == last.buffer; }))
+                last.buffer->setSize(0);
+        lastStreams.swap(streams);
+    }
+
+    // LSD radix sort, a byte per pass; bytes every key shares are skipped,
+    // which drops most passes as the high fields repeat within a frame
+    void sort()
+    {
+        size_t count = 0;
+        for (const CommandList *list : lists)
+            count += list->draws.size();
+        order.resize(count);
+        scratch.resize(count);
+        size_t next = 0;
+        for (size_t l = 0; l < lists.size(); l++)
+            for (size_t i = 0; i < lists[l]->draws.size(); i++)
+                order[next++] = {lists[l]->draws[i].key, (uint32_t)l, (uint32_t)i};
+        if (count < 2)
+            return;
+        for (int shift = 0; shift < 64; shift += 8)
+        {
+            size_t offsets[256] = {};
+            for (const Entry &entry : order)
+                offsets[(entry.key >> shift) & 0xFF]++;
+            if (offsets[(order[0].key >> shift) & 0xFF] == count)
+                continue;
+            size_t total = 0;
+            for (size_t &offset : offsets)
+            {
+                size_t bucket = offset;
+                offset = total;
+                total += bucket;
+            }
+            for (const Entry &entry : order)
+                scratch[offsets[(entry.key >> shift) & 0xFF]++] = entry;
+            order.swap(scratch);
+        }
+    }
+
+    static void applyPass(const PassState &state)
+    {
+        glState.setEnabled(GL_DEPTH_TEST, state.depthTest);
+        glState.stencilFunc(state.stencilFunc, state.stencilRef, 0xFF);
+        glState.stencilMask(state.stencilWriteMask);
+    }
+
+    static void applyUniform(const UniformPacket &uniform)
+    {
+        if (uniform.type == GL_INT)
+            glUniform1i(uniform.location, uniform.intValue);
+        else if (uniform.type == GL_FLOAT)
+            glUniform1f(uniform.location, uniform.value.x);
+        else
+            glUniform4fv(uniform.location, 1, &uniform.value[0]);
+    }
+};
+#endif
@@ -1,10 +1,18 @@
 out vec4 FragColor;
 
 in vec2 TexCoords;
+in vec3 WorldPos;
 
-uniform sampler2D texture1;
+// every scene texture lives in one array; draws only pick their layer
+uniform mediump sampler2DArray texture1;
+uniform int layer;
+
+#include "clustered_lights.glsl"
 
 void main()
 {    
-    FragColor = texture(texture1, TexCoords);
-}
\ No newline at end of file
+    vec4 albedo = texture(texture1, vec3(TexCoords, float(layer)));
+    // the floor and cubes carry no normals: flat faces from the derivatives
+    vec3 normal = normalize(cross(dFdx(WorldPos), dFdy(WorldPos)));
+    FragColor = vec4(albedo.rgb * (1.0 + clusteredLight(WorldPos, normal)), albedo.a);
+}
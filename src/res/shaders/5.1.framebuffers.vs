@@ -2,13 +2,18 @@ layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec2 aTexCoords;
 
 out vec2 TexCoords;
+out vec3 WorldPos;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+layout (std140) uniform ObjectBlock
+{
+    mat4 mvp;
+    mat4 model;
+    mat4 normalMatrix;
+};
 
 void main()
 {
     TexCoords = aTexCoords;    
-    gl_Position = projection * view * model * vec4(aPos, 1.0f);
+    WorldPos = vec3(model * vec4(aPos, 1.0f));
+    gl_Position = mvp * vec4(aPos, 1.0f);
 }
\ No newline at end of file
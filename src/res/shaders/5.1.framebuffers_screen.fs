@@ -1,6 +0,0 @@
-out vec4 FragColor;
-
-void main()
-{
-    FragColor = vec4(0.04, 0.28, 0.26, 1.0);
-}
\ No newline at end of file
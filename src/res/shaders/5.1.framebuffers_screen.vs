@@ -3,12 +3,15 @@ layout (location = 1) in vec2 aTexCoords;
 
 out vec2 TexCoords;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+layout (std140) uniform ObjectBlock
+{
+    mat4 mvp;
+    mat4 model;
+    mat4 normalMatrix;
+};
 
 void main()
 {
     TexCoords = aTexCoords;    
-    gl_Position = projection * view * model * vec4(aPos, 1.0f);
+    gl_Position = mvp * vec4(aPos, 1.0f);
 }
\ No newline at end of file
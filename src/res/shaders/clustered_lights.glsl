@@ -0,0 +1,48 @@
+// clustered point lights, see clustered_lights.h; ClusteredLights::attach()
+// hooks a shader that includes this up to the data
+layout (std140) uniform ClusterBlock
+{
+    // clusters along x, y and depth, then the light count
+    ivec4 clusterCounts;
+    // viewport size, near and far planes
+    vec4 clusterViewport;
+};
+// two texels a light: position and radius, colour and intensity
+uniform highp sampler2D clusterLights;
+// per cluster, the first of its light ids and how many there are
+uniform highp usampler2D clusterGrid;
+// light ids, CLUSTER_INDEX_WIDTH to a row
+uniform highp usampler2D clusterIndices;
+
+const int CLUSTER_INDEX_WIDTH = 1024;
+
+// diffuse light from the lights of this fragment's cluster only
+vec3 clusteredLight(vec3 worldPos, vec3 normal)
+{
+    float near = clusterViewport.z;
+    float far = clusterViewport.w;
+    float depth = near * far / (far - gl_FragCoord.z * (far - near));
+    int slice = int(log(depth / near) / log(far / near) * float(clusterCounts.z));
+    ivec2 tile = ivec2(gl_FragCoord.xy / clusterViewport.xy * vec2(clusterCounts.xy));
+    tile = clamp(tile, ivec2(0), clusterCounts.xy - 1);
+    slice = clamp(slice, 0, clusterCounts.z - 1);
+    // ids run up to 65536, past the 2^15 a mediump int is guaranteed to
+    // hold in ES fragment shaders
+    highp uvec2 range = texelFetch(clusterGrid, ivec2(tile.x + tile.y * clusterCounts.x, slice), 0).xy;
+    highp int end = int(range.x + range.y);
+
+    vec3 total = vec3(0.0);
+    for (highp int i = int(range.x); i < end; i++)
+    {
+        highp int light = int(texelFetch(clusterIndices, ivec2(i % CLUSTER_INDEX_WIDTH, i / CLUSTER_INDEX_WIDTH), 0).r);
+        vec4 positionRadius = texelFetch(clusterLights, ivec2(2 * light, 0), 0);
+        vec4 colorIntensity = texelFetch(clusterLights, ivec2(2 * light + 1, 0), 0);
+        vec3 toLight = positionRadius.xyz - worldPos;
+        float dist = length(toLight);
+        // reaches zero at the light's radius, where binning stops
+        float falloff = clamp(1.0 - dist / positionRadius.w, 0.0, 1.0);
+        float diffuse = max(dot(normal, toLight / max(dist, 1e-4)), 0.0);
+        total += colorIntensity.rgb * (colorIntensity.a * falloff * falloff * diffuse);
+    }
+    return total;
+}
@@ -0,0 +1,8 @@
+// never runs, rasterization is off during the cull pass; programs still need
+// a fragment stage to link
+out vec4 FragColor;
+
+void main()
+{
+    FragColor = vec4(0.0);
+}
@@ -0,0 +1,23 @@
+// desktop only: passes on the instances the vertex pass kept, so transform
+// feedback packs them tightly
+layout (points) in;
+layout (points, max_vertices = 1) out;
+
+in vec4 vPositionScale[];
+in vec4 vRotation[];
+in float vMaterial[];
+
+out vec4 cPositionScale;
+out vec4 cRotation;
+out float cMaterial;
+
+void main()
+{
+    if (vPositionScale[0].w > 0.0)
+    {
+        cPositionScale = vPositionScale[0];
+        cRotation = vRotation[0];
+        cMaterial = vMaterial[0];
+        EmitVertex();
+    }
+}
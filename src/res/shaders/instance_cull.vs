@@ -0,0 +1,49 @@
+// transform feedback pass of GpuInstanceCuller: one instance in, the same
+// instance out, its scale zeroed unless it is in view, close enough, in a
+// visible ring sector and in this pass's level of detail
+layout (location = 0) in vec4 iPositionScale;
+layout (location = 1) in vec4 iRotation;
+layout (location = 2) in float iMaterial;
+
+uniform mat4 model;
+uniform vec4 planes[6];
+uniform vec3 eye;
+uniform float time;
+uniform float orbitRate;
+uniform float boundRadius;
+// where LOD 1 and 2 start, and the farthest instance drawn
+uniform vec3 lodDistances;
+uniform int lod;
+uniform uint sectorMask;
+uniform int sectors;
+
+out vec4 vPositionScale;
+out vec4 vRotation;
+out float vMaterial;
+
+void main()
+{
+    vec3 position = iPositionScale.xyz;
+    float radius = length(position.xz);
+    float angle = atan(position.z, position.x);
+    if (orbitRate != 0.0)
+    {
+        angle += time * orbitRate / (radius * sqrt(radius));
+        position.xz = vec2(cos(angle), sin(angle)) * radius;
+    }
+
+    vec3 world = (model * vec4(position, 1.0)).xyz;
+    float bound = iPositionScale.w * boundRadius * length(model[0].xyz);
+    bool keep = true;
+    for (int i = 0; i < 6; i++)
+        keep = keep && dot(planes[i].xyz, world) + planes[i].w >= -bound;
+    float gap = distance(eye, world);
+    int level = gap < lodDistances.x ? 0 : (gap < lodDistances.y ? 1 : 2);
+    keep = keep && gap < lodDistances.z && level == lod;
+    int sector = int(fract(angle / 6.2831853) * float(sectors)) % sectors;
+    keep = keep && ((sectorMask >> uint(sector)) & 1u) != 0u;
+
+    vPositionScale = vec4(position, keep ? iPositionScale.w : 0.0);
+    vRotation = iRotation;
+    vMaterial = iMaterial;
+}
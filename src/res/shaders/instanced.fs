@@ -0,0 +1,20 @@
+out vec4 FragColor;
+
+in vec2 TexCoords;
+in vec3 Normal;
+in vec3 WorldPos;
+flat in float Layer;
+
+// the scene texture array; each instance picks its layer
+uniform mediump sampler2DArray texture1;
+uniform vec3 lightDirection;
+
+#include "clustered_lights.glsl"
+
+void main()
+{
+    vec3 normal = normalize(Normal);
+    float diffuse = max(dot(normal, lightDirection), 0.0);
+    vec3 albedo = texture(texture1, vec3(TexCoords, Layer)).rgb;
+    FragColor = vec4(albedo * (0.25 + 0.75 * diffuse + clusteredLight(WorldPos, normal)), 1.0);
+}
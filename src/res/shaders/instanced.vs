@@ -0,0 +1,36 @@
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+// per instance, see InstanceData in instance_buffer.h
+layout (location = 3) in vec4 iPositionScale;
+layout (location = 4) in vec4 iRotation;
+layout (location = 5) in float iMaterial;
+
+out vec2 TexCoords;
+out vec3 Normal;
+out vec3 WorldPos;
+flat out float Layer;
+
+// the slot bound for the draw places the whole group; instances are
+// positioned inside it
+layout (std140) uniform ObjectBlock
+{
+    mat4 mvp;
+    mat4 model;
+    mat4 normalMatrix;
+};
+
+vec3 rotate(vec4 q, vec3 v)
+{
+    return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
+void main()
+{
+    TexCoords = aTexCoords;
+    Normal = mat3(normalMatrix) * rotate(iRotation, aNormal);
+    Layer = iMaterial;
+    vec3 position = rotate(iRotation, aPos) * iPositionScale.w + iPositionScale.xyz;
+    WorldPos = vec3(model * vec4(position, 1.0f));
+    gl_Position = mvp * vec4(position, 1.0f);
+}
@@ -0,0 +1,31 @@
+out highp uvec2 Seed;
+
+// nearest seed found so far per pixel, 0xFFFF where there is none
+uniform highp usampler2D seeds;
+uniform int jump;
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    ivec2 size = textureSize(seeds, 0);
+    highp uvec2 best = uvec2(0xFFFFu);
+    float bestDistance = 1e20;
+    for (int y = -1; y <= 1; y++)
+        for (int x = -1; x <= 1; x++)
+        {
+            ivec2 neighbour = pixel + ivec2(x, y) * jump;
+            if (any(lessThan(neighbour, ivec2(0))) || any(greaterThanEqual(neighbour, size)))
+                continue;
+            highp uvec2 seed = texelFetch(seeds, neighbour, 0).xy;
+            if (seed.x == 0xFFFFu)
+                continue;
+            vec2 offset = vec2(seed) - vec2(pixel);
+            float squared = dot(offset, offset);
+            if (squared < bestDistance)
+            {
+                bestDistance = squared;
+                best = seed;
+            }
+        }
+    Seed = best;
+}
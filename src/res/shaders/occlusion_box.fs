@@ -0,0 +1,7 @@
+// colour writes are off, only the depth test counts
+out vec4 FragColor;
+
+void main()
+{
+    FragColor = vec4(1.0);
+}
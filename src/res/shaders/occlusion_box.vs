@@ -0,0 +1,12 @@
+// bounding box proxy for occlusion queries: the unit cube stretched over
+// the box
+layout (location = 0) in vec3 aPos;
+
+uniform mat4 viewProjection;
+uniform vec3 center;
+uniform vec3 extent;
+
+void main()
+{
+    gl_Position = viewProjection * vec4(center + aPos * extent, 1.0);
+}
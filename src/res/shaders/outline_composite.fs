@@ -0,0 +1,19 @@
+out vec4 FragColor;
+
+uniform highp usampler2D seeds;
+// in pixels
+uniform float width;
+uniform vec4 color;
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    highp uvec2 seed = texelFetch(seeds, pixel, 0).xy;
+    if (seed.x == 0xFFFFu)
+        discard;
+    float gap = length(vec2(seed) - vec2(pixel));
+    // covered pixels are their own seed; the outer edge is antialiased
+    if (gap == 0.0)
+        discard;
+    FragColor = vec4(color.rgb, color.a * clamp(width + 0.5 - gap, 0.0, 1.0));
+}
@@ -0,0 +1,7 @@
+// seeds for the jump flood: every covered pixel names itself
+out highp uvec2 Seed;
+
+void main()
+{
+    Seed = uvec2(gl_FragCoord.xy);
+}
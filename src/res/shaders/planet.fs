@@ -0,0 +1,16 @@
+out vec4 FragColor;
+
+in vec2 TexCoords;
+in vec3 WorldPos;
+in vec3 Normal;
+
+// equirectangular surface on the uv sphere
+uniform sampler2D surface;
+
+#include "clustered_lights.glsl"
+
+void main()
+{
+    vec4 albedo = texture(surface, TexCoords);
+    FragColor = vec4(albedo.rgb * (1.0 + clusteredLight(WorldPos, normalize(Normal))), albedo.a);
+}
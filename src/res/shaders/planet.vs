@@ -0,0 +1,22 @@
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec2 aTexCoords;
+
+// unit uv sphere: the position is also the normal
+out vec2 TexCoords;
+out vec3 WorldPos;
+out vec3 Normal;
+
+layout (std140) uniform ObjectBlock
+{
+    mat4 mvp;
+    mat4 model;
+    mat4 normalMatrix;
+};
+
+void main()
+{
+    TexCoords = aTexCoords;
+    WorldPos = vec3(model * vec4(aPos, 1.0f));
+    Normal = mat3(normalMatrix) * aPos;
+    gl_Position = mvp * vec4(aPos, 1.0f);
+}
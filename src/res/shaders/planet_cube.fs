@@ -0,0 +1,16 @@
+out vec4 FragColor;
+
+in vec3 Direction;
+in vec3 WorldPos;
+in vec3 Normal;
+
+// equirectangular map resampled into a cube map on the decode workers
+uniform mediump samplerCube surface;
+
+#include "clustered_lights.glsl"
+
+void main()
+{
+    vec4 albedo = texture(surface, normalize(Direction));
+    FragColor = vec4(albedo.rgb * (1.0 + clusteredLight(WorldPos, normalize(Normal))), albedo.a);
+}
@@ -0,0 +1,21 @@
+layout (location = 0) in vec3 aPos;
+
+// the surface is looked up by direction, so the mesh needs no uvs
+out vec3 Direction;
+out vec3 WorldPos;
+out vec3 Normal;
+
+layout (std140) uniform ObjectBlock
+{
+    mat4 mvp;
+    mat4 model;
+    mat4 normalMatrix;
+};
+
+void main()
+{
+    Direction = aPos;
+    WorldPos = vec3(model * vec4(aPos, 1.0f));
+    Normal = mat3(normalMatrix) * aPos;
+    gl_Position = mvp * vec4(aPos, 1.0f);
+}
@@ -0,0 +1,71 @@
+out vec4 FragColor;
+
+in vec2 TexCoords;
+in vec3 WorldPos;
+in vec3 Normal;
+
+// virtual texture, see virtual_texture.h
+uniform sampler2D vtCache;
+uniform sampler2D vtIndirection;
+uniform vec2 vtVirtualSize;
+uniform float vtPageSize;
+uniform float vtBorder;
+uniform float vtCacheSize;
+uniform float vtMaxLevel;
+uniform float vtLodBias;
+// the feedback pass writes the page each pixel wants instead of a colour
+uniform bool vtFeedback;
+
+#include "clustered_lights.glsl"
+
+// level the pixel wants, from the uv derivatives in level 0 texels
+float vtLevel(vec2 uv)
+{
+    vec2 texel = uv * vtVirtualSize;
+    vec2 dx = dFdx(texel);
+    vec2 dy = dFdy(texel);
+    float lod = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-8)) + vtLodBias;
+    return clamp(floor(lod), 0.0, vtMaxLevel);
+}
+
+// equirectangular maps wrap in u; v stays inside the poles
+vec2 vtWrap(vec2 uv)
+{
+    return vec2(fract(uv.x), clamp(uv.y, 0.0, 0.99999));
+}
+
+vec2 vtPage(vec2 uv, float level)
+{
+    return floor(uv * vtVirtualSize / (vtPageSize * exp2(level)));
+}
+
+vec4 vtSample(vec2 uv)
+{
+    float level = vtLevel(uv);
+    uv = vtWrap(uv);
+    // finest resident ancestor: cache slot in xy, its level in z
+    vec3 entry = floor(texelFetch(vtIndirection, ivec2(vtPage(uv, level)), int(level)).xyz * 255.0 + 0.5);
+    vec2 texel = uv * vtVirtualSize / exp2(entry.z);
+    vec2 inPage = texel - floor(texel / vtPageSize) * vtPageSize;
+    vec2 cached = entry.xy * (vtPageSize + 2.0 * vtBorder) + vtBorder + inPage;
+    return textureLod(vtCache, cached / vtCacheSize, 0.0);
+}
+
+vec4 vtFeedbackColor(vec2 uv)
+{
+    float level = vtLevel(uv);
+    vec2 page = vtPage(vtWrap(uv), level);
+    vec2 high = floor(page / 256.0);
+    return vec4(page - high * 256.0, high.x + high.y * 16.0, level + 1.0) / 255.0;
+}
+
+void main()
+{
+    if (vtFeedback)
+    {
+        FragColor = vtFeedbackColor(TexCoords);
+        return;
+    }
+    vec4 albedo = vtSample(TexCoords);
+    FragColor = vec4(albedo.rgb * (1.0 + clusteredLight(WorldPos, normalize(Normal))), albedo.a);
+}
@@ -0,0 +1,552 @@
+#ifndef SCENE_BVH_H
+#define SCENE_BVH_H
+
+#include <glm/glm.hpp>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define SCENE_BVH_SSE
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#define SCENE_BVH_WASM_SIMD
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "frame_stats.h"
+#include "thread_pool.h"
+
+// Bounding volume hierarchy over object bounding spheres, for frustum culling.
+//   - built top-down with median splits; leaves hold up to four objects,
+//     stored structure-of-arrays so one SIMD test covers a whole leaf
+//   - set() moves an object and marks the path to the root; update() refits
+//     just those nodes and rebuilds from scratch once the refitted boxes have
+//     grown to rebuildRatio times the area they had after the last build
+//   - cull() walks the tree testing node boxes against four frustum planes
+//     per instruction. A node's plane mask drops the planes its parent was
+//     already fully inside of, and the subtrees below the top levels are
+//     traversed in parallel.
+// Ids are handed out by add() in order, starting at 0.
+class SceneBVH
+{
+public:
+    static constexpr int LEAF_SIZE = 4;
+    static constexpr uint32_t NONE = 0xFFFFFFFFu;
+
+    // a refitted tree whose boxes have grown this much is rebuilt
+    float rebuildRatio = 1.5f;
+
+    uint32_t add(const glm::vec3 &center, float radius)
+    {
+        spheres.push_back(glm::vec4(center, radius));
+        built = false;
+        return (uint32_t)spheres.size() - 1;
+    }
+
+    void set(uint32_t id, const glm::vec3 &center, float radius)
+    {
+        spheres[id] = glm::vec4(center, radius);
+        if (!built)
+            return;
+        uint32_t slot = slotOf[id];
+        cx[slot] = center.x;
+        cy[slot] = center.y;
+        cz[slot] = center.z;
+        cr[slot] = radius;
+        for (uint32_t node = leafOf[slot / LEAF_SIZE]; node != NONE && !dirty[node]; node = parents[node])
+            dirty[node] = 1;
+    }
+
+    const glm::vec4 &sphere(uint32_t id) const
+    {
+        return spheres[id];
+    }
+
+    size_t size() const
+    {
+        return spheres.size();
+    }
+
+    // refits what set() touched, or rebuilds; call once per frame before cull()
+    void update()
+    {
+        auto start = std::chrono::steady_clock::now();
+        if (!built)
+            build();
+        else
+        {
+            float area = refit();
+            if (area > buildArea * rebuildRatio)
+                build();
+        }
+        frameStats.bvhUpdateMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // appends the ids of objects that touch the frustum of `viewProjection`
+    void cull(const glm::mat4 &viewProjection, std::vector<uint32_t> &visible, ThreadPool *pool = nullptr)
+    {
+        auto start = std::chrono::steady_clock::now();
+        visible.clear();
+        if (nodes.empty())
+            return;
+        Frustum frustum = Frustum::fromMatrix(viewProjection);
+
+        // the top of the tree is walked here; subtrees below SPLIT_DEPTH
+        // become tasks, each with its own output list
+        frontier.clear();
+        if (parts.empty())
+            parts.emplace_back();
+        parts[0].clear();
+        traverse(frustum, 0, ALL_PLANES, 0, parts[0], true);
+
+        size_t tasks = pool && pool->threadCount() > 0 ? std::min(frontier.size(), (size_t)pool->threadCount() * 4) : 1;
+        if (parts.size() < tasks + 1)
+            parts.resize(tasks + 1);
+        size_t perTask = frontier.empty() ? 0 : (frontier.size() + tasks - 1) / tasks;
+        auto walk = [&](size_t begin, size_t end)
+        {
+            for (size_t task = begin; task < end; task++)
+            {
+                std::vector<uint32_t> &out = parts[task + 1];
+                out.clear();
+                size_t last = std::min(frontier.size(), (task + 1) * perTask);
+                for (size_t i = task * perTask; i < last; i++)
+                    traverse(frustum, frontier[i].node, frontier[i].mask, SPLIT_DEPTH, out, false);
+            }
+        };
+        if (pool && tasks > 1)
+            pool->parallelFor(tasks, 1, walk);
+        else if (!frontier.empty())
+            walk(0, tasks);
+
+        size_t total = 0;
+        for (size_t i = 0; i <= tasks; i++)
+            total += parts[i].size();
+        visible.reserve(total);
+        for (size_t i = 0; i <= tasks; i++)
+            visible.insert(visible.end(), parts[i].begin(), parts[i].end());
+
+        frameStats.cullMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        frameStats.cullObjects = (unsigned int)spheres.size();
+        frameStats.cullVisible = (unsigned int)visible.size();
+    }
+
+    // SOLAR_CULL_BENCH: build, refit and cull 1K-100K spheres scattered
+    // through a ring, against a brute force loop over every sphere
+    static void benchmark(std::ostream &out = std::cout)
+    {
+        ThreadPool pool;
+        pool.start(ThreadPool::defaultThreadCount());
+        out << "[CULL] kernels: " << simdName() << ", " << pool.threadCount() << " worker threads" << std::endl;
+        glm::mat4 projection = glm::mat4(1.0f);
+        {
+            // 45 degree perspective looking down -z from above the ring
+            float f = 1.0f / std::tan(glm::radians(22.5f)), near = 0.1f, far = 100.0f;
+            projection = glm::mat4(0.0f);
+            projection[0][0] = f / (4.0f / 3.0f);
+            projection[1][1] = f;
+            projection[2][2] = (far + near) / (near - far);
+            projection[2][3] = -1.0f;
+            projection[3][2] = 2.0f * far * near / (near - far);
+        }
+        glm::mat4 view = glm::mat4(1.0f);
+        view[3] = glm::vec4(0.0f, -3.0f, -12.0f, 1.0f);
+        glm::mat4 viewProjection = projection * view;
+
+        for (int count : {1000, 10000, 100000})
+        {
+            std::mt19937 rng(11);
+            std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+            SceneBVH bvh;
+            for (int i = 0; i < count; i++)
+            {
+                float angle = uniform(rng) * 6.2831853f, radius = 6.0f + 3.0f * uniform(rng);
+                bvh.add(glm::vec3(std::cos(angle) * radius, 0.3f * (uniform(rng) - 0.5f), std::sin(angle) * radius), 0.02f + 0.05f * uniform(rng));
+            }
+            auto time = [](auto &&work)
+            {
+                auto start = std::chrono::steady_clock::now();
+                work();
+                return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+            };
+            float buildMs = time([&]
+                                 { bvh.update(); });
+            // everything moves a little along its orbit
+            float refitMs = time([&]
+                                 {
+                for (uint32_t id = 0; id < (uint32_t)count; id++)
+                {
+                    glm::vec4 s = bvh.sphere(id);
+                    bvh.set(id, glm::vec3(s.x * 0.9999f - s.z * 0.01f, s.y, s.z * 0.9999f + s.x * 0.01f), s.w);
+                }
+                bvh.update(); });
+            std::vector<uint32_t> visible;
+            const int repeats = 20;
+            float singleMs = time([&]
+                                  { for (int i = 0; i < repeats; i++) bvh.cull(viewProjection, visible); }) / repeats;
+            float pooledMs = time([&]
+                                  { for (int i = 0; i < repeats; i++) bvh.cull(viewProjection, visible, &pool); }) / repeats;
+            size_t bruteVisible = 0;
+            Frustum frustum = Frustum::fromMatrix(viewProjection);
+            float bruteMs = time([&]
+                                 {
+                for (int i = 0; i < repeats; i++)
+                {
+                    bruteVisible = 0;
+                    for (const glm::vec4 &s : bvh.spheres)
+                        bruteVisible += frustum.touches(s);
+                } }) / repeats;
+            out << "  " << std::setw(6) << count << " spheres: build " << std::fixed << std::setprecision(2) << buildMs
+                << " ms | move + refit " << refitMs << " ms | cull " << std::setprecision(3) << singleMs << " ms, pooled "
+                << pooledMs << " ms | brute force " << bruteMs << " ms | " << visible.size() << " visible"
+                << (visible.size() == bruteVisible ? "" : " (MISMATCH)") << std::endl;
+        }
+        pool.stop();
+    }
+
+    static const char *simdName()
+    {
+#if defined(SCENE_BVH_SSE)
+        return "sse";
+#elif defined(SCENE_BVH_WASM_SIMD)
+        return "wasm simd128";
+#else
+        return "scalar";
+#endif
+    }
+
+private:
+    static constexpr uint32_t ALL_PLANES = 0x3F;
+    // subtrees below this depth are handed to the pool, 2^8 at most
+    static constexpr int SPLIT_DEPTH = 8;
+
+    // internal nodes keep their left child right after them (preorder);
+    // leaves have count > 0 and own slots [first, first + LEAF_SIZE)
+    struct Node
+    {
+        glm::vec3 center;
+        glm::vec3 extent;
+        uint32_t right;
+        uint32_t first;
+        uint32_t count;
+    };
+
+    struct Centroid
+    {
+        glm::vec3 center;
+        uint32_t id;
+    };
+
+    struct Pending
+    {
+        uint32_t node;
+        uint32_t mask;
+    };
+
+    // six normalised planes, inside where dot(n, p) + w >= 0; lanes 6 and 7
+    // are never outside
+    struct alignas(16) Frustum
+    {
+        float nx[8], ny[8], nz[8], w[8];
+        float ax[8], ay[8], az[8];
+
+        static Frustum fromMatrix(const glm::mat4 &m)
+        {
+            Frustum f;
+            glm::vec4 row[4];
+            for (int i = 0; i < 4; i++)
+                row[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+            glm::vec4 planes[6] = {row[3] + row[0], row[3] - row[0], row[3] + row[1], row[3] - row[1], row[3] + row[2], row[3] - row[2]};
+            for (int i = 0; i < 8; i++)
+            {
+                glm::vec4 p = i < 6 ? planes[i] / glm::length(glm::vec3(planes[i])) : glm::vec4(0.0f, 0.0f, 0.0f, 1e30f);
+                f.nx[i] = p.x;
+                f.ny[i] = p.y;
+                f.nz[i] = p.z;
+                f.w[i] = p.w;
+                f.ax[i] = std::fabs(p.x);
+                f.ay[i] = std::fabs(p.y);
+                f.az[i] = std::fabs(p.z);
+            }
+            return f;
+        }
+
+        bool touches(const glm::vec4 &s) const
+        {
+            for (int i = 0; i < 6; i++)
+                if (nx[i] * s.x + ny[i] * s.y + nz[i] * s.z + w[i] < -s.w)
+                    return false;
+            return true;
+        }
+    };
+
+    std::vector<glm::vec4> spheres;
+    std::vector<Node> nodes;
+    std::vector<uint32_t> parents;
+    std::vector<uint8_t> dirty;
+    // per leaf block of LEAF_SIZE slots, the node that owns it
+    std::vector<uint32_t> leafOf;
+    // objects in tree order, padded to whole leaves
+    std::vector<float> cx, cy, cz, cr;
+    std::vector<uint32_t> ids;
+    std::vector<uint32_t> slotOf;
+    bool built = false;
+    float buildArea = 0.0f;
+
+    std::vector<Pending> frontier;
+    std::vector<std::vector<uint32_t>> parts;
+
+    // ---- build and refit --------------------------------------------------
+
+    void build()
+    {
+        // centres travel with their ids so the splits stay in cache
+        std::vector<Centroid> order(spheres.size());
+        for (uint32_t i = 0; i < (uint32_t)order.size(); i++)
+            order[i] = {glm::vec3(spheres[i]), i};
+        nodes.clear();
+        parents.clear();
+        leafOf.clear();
+        ids.clear();
+        if (!order.empty())
+            buildNode(order.data(), order.size(), NONE);
+
+        size_t slots = ids.size();
+        cx.assign(slots, 0.0f);
+        cy.assign(slots, 0.0f);
+        cz.assign(slots, 0.0f);
+        cr.assign(slots, -1.0f);
+        slotOf.assign(spheres.size(), NONE);
+        for (uint32_t slot = 0; slot < (uint32_t)slots; slot++)
+        {
+            if (ids[slot] == NONE)
+                continue;
+            const glm::vec4 &s = spheres[ids[slot]];
+            cx[slot] = s.x;
+            cy[slot] = s.y;
+            cz[slot] = s.z;
+            cr[slot] = s.w;
+            slotOf[ids[slot]] = slot;
+        }
+        dirty.assign(nodes.size(), 1);
+        built = true;
+        buildArea = refit();
+        frameStats.bvhRebuilds++;
+    }
+
+    uint32_t buildNode(Centroid *objects, size_t count, uint32_t parent)
+    {
+        uint32_t index = (uint32_t)nodes.size();
+        nodes.push_back(Node());
+        parents.push_back(parent);
+        if (count <= (size_t)LEAF_SIZE)
+        {
+            nodes[index].right = 0;
+            nodes[index].first = (uint32_t)ids.size();
+            nodes[index].count = (uint32_t)count;
+            leafOf.push_back(index);
+            for (int i = 0; i < LEAF_SIZE; i++)
+                ids.push_back(i < (int)count ? objects[i].id : NONE);
+            return index;
+        }
+        // split at the median centre along the widest axis
+        glm::vec3 low(1e30f), high(-1e30f);
+        for (size_t i = 0; i < count; i++)
+        {
+            low = glm::min(low, objects[i].center);
+            high = glm::max(high, objects[i].center);
+        }
+        glm::vec3 size = high - low;
+        int axis = size.x > size.y ? (size.x > size.z ? 0 : 2) : (size.y > size.z ? 1 : 2);
+        size_t half = count / 2;
+        // whole leaves on the left keep the padding down
+        half = std::max((size_t)LEAF_SIZE, half / LEAF_SIZE * LEAF_SIZE);
+        std::nth_element(objects, objects + half, objects + count, [axis](const Centroid &a, const Centroid &b)
+                         { return a.center[axis] < b.center[axis]; });
+        nodes[index].count = 0;
+        buildNode(objects, half, index);
+        uint32_t right = buildNode(objects + half, count - half, index);
+        nodes[index].right = right;
+        return index;
+    }
+
+    // recomputes dirty boxes children first and returns the summed area of
+    // every box, the quality measure compared against buildArea
+    float refit()
+    {
+        float area = 0.0f;
+        for (size_t i = nodes.size(); i-- > 0;)
+        {
+            Node &node = nodes[i];
+            if (dirty[i])
+            {
+                glm::vec3 low(1e30f), high(-1e30f);
+                if (node.count > 0)
+                {
+                    for (uint32_t slot = node.first; slot < node.first + node.count; slot++)
+                    {
+                        glm::vec3 c(cx[slot], cy[slot], cz[slot]);
+                        low = glm::min(low, c - cr[slot]);
+                        high = glm::max(high, c + cr[slot]);
+                    }
+                }
+                else
+                {
+                    const Node &left = nodes[i + 1], &right = nodes[node.right];
+                    low = glm::min(left.center - left.extent, right.center - right.extent);
+                    high = glm::max(left.center + left.extent, right.center + right.extent);
+                }
+                node.center = (low + high) * 0.5f;
+                node.extent = (high - low) * 0.5f;
+                dirty[i] = 0;
+            }
+            area += node.extent.x * node.extent.y + node.extent.y * node.extent.z + node.extent.z * node.extent.x;
+        }
+        return area;
+    }
+
+    // ---- culling ----------------------------------------------------------
+
+    // bit i set when the box is outside plane i / inside plane i
+    static void classify(const Frustum &f, const Node &node, uint32_t &outside, uint32_t &inside)
+    {
+#if defined(SCENE_BVH_SSE)
+        __m128 cx = _mm_set1_ps(node.center.x), cy = _mm_set1_ps(node.center.y), cz = _mm_set1_ps(node.center.z);
+        __m128 ex = _mm_set1_ps(node.extent.x), ey = _mm_set1_ps(node.extent.y), ez = _mm_set1_ps(node.extent.z);
+        outside = inside = 0;
+        for (int half = 0; half < 2; half++)
+        {
+            int o = half * 4;
+            __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(f.nx + o), cx), _mm_mul_ps(_mm_load_ps(f.ny + o), cy)),
+                                  _mm_add_ps(_mm_mul_ps(_mm_load_ps(f.nz + o), cz), _mm_load_ps(f.w + o)));
+            __m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(f.ax + o), ex), _mm_mul_ps(_mm_load_ps(f.ay + o), ey)),
+                                  _mm_mul_ps(_mm_load_ps(f.az + o), ez));
+            outside |= (uint32_t)_mm_movemask_ps(_mm_cmplt_ps(d, _mm_sub_ps(_mm_setzero_ps(), r))) << o;
+            inside |= (uint32_t)_mm_movemask_ps(_mm_cmpgt_ps(d, r)) << o;
+        }
+#elif defined(SCENE_BVH_WASM_SIMD)
+        v128_t cx = wasm_f32x4_splat(node.center.x), cy = wasm_f32x4_splat(node.center.y), cz = wasm_f32x4_splat(node.center.z);
+        v128_t ex = wasm_f32x4_splat(node.extent.x), ey = wasm_f32x4_splat(node.extent.y), ez = wasm_f32x4_splat(node.extent.z);
+        outside = inside = 0;
+        for (int half = 0; half < 2; half++)
+        {
+            int o = half * 4;
+            v128_t d = wasm_f32x4_add(wasm_f32x4_add(wasm_f32x4_mul(wasm_v128_load(f.nx + o), cx), wasm_f32x4_mul(wasm_v128_load(f.ny + o), cy)),
+                                      wasm_f32x4_add(wasm_f32x4_mul(wasm_v128_load(f.nz + o), cz), wasm_v128_load(f.w + o)));
+            v128_t r = wasm_f32x4_add(wasm_f32x4_add(wasm_f32x4_mul(wasm_v128_load(f.ax + o), ex), wasm_f32x4_mul(wasm_v128_load(f.ay + o), ey)),
+                                      wasm_f32x4_mul(wasm_v128_load(f.az + o), ez));
+            outside |= (uint32_t)wasm_i32x4_bitmask(wasm_f32x4_lt(d, wasm_f32x4_neg(r))) << o;
+            inside |= (uint32_t)wasm_i32x4_bitmask(wasm_f32x4_gt(d, r)) << o;
+        }
+#else
+        outside = inside = 0;
+        for (int i = 0; i < 8; i++)
+        {
+            float d = f.nx[i] * node.center.x + f.ny[i] * node.center.y + f.nz[i] * node.center.z + f.w[i];
+            float r = f.ax[i] * node.extent.x + f.ay[i] * node.extent.y + f.az[i] * node.extent.z;
+            outside |= (uint32_t)(d < -r) << i;
+            inside |= (uint32_t)(d > r) << i;
+        }
+#endif
+    }
+
+    // index of the lowest set bit; mask must not be 0
+    static int lowestBit(uint32_t mask)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return (int)index;
+#else
+        return __builtin_ctz(mask);
+#endif
+    }
+
+    // the leaf's four spheres against each plane still in `mask`; returns a
+    // bit per visible slot
+    uint32_t testLeaf(const Frustum &f, uint32_t first, uint32_t mask) const
+    {
+        uint32_t culled = 0;
+#if defined(SCENE_BVH_SSE)
+        __m128 x = _mm_loadu_ps(&cx[first]), y = _mm_loadu_ps(&cy[first]), z = _mm_loadu_ps(&cz[first]);
+        __m128 negR = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&cr[first]));
+        for (; mask; mask &= mask - 1)
+        {
+            int i = lowestBit(mask);
+            __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(f.nx[i]), x), _mm_mul_ps(_mm_set1_ps(f.ny[i]), y)),
+                                  _mm_add_ps(_mm_mul_ps(_mm_set1_ps(f.nz[i]), z), _mm_set1_ps(f.w[i])));
+            culled |= (uint32_t)_mm_movemask_ps(_mm_cmplt_ps(d, negR));
+        }
+#elif defined(SCENE_BVH_WASM_SIMD)
+        v128_t x = wasm_v128_load(&cx[first]), y = wasm_v128_load(&cy[first]), z = wasm_v128_load(&cz[first]);
+        v128_t negR = wasm_f32x4_neg(wasm_v128_load(&cr[first]));
+        for (; mask; mask &= mask - 1)
+        {
+            int i = lowestBit(mask);
+            v128_t d = wasm_f32x4_add(wasm_f32x4_add(wasm_f32x4_mul(wasm_f32x4_splat(f.nx[i]), x), wasm_f32x4_mul(wasm_f32x4_splat(f.ny[i]), y)),
+                                      wasm_f32x4_add(wasm_f32x4_mul(wasm_f32x4_splat(f.nz[i]), z), wasm_f32x4_splat(f.w[i])));
+            culled |= (uint32_t)wasm_i32x4_bitmask(wasm_f32x4_lt(d, negR));
+        }
+#else
+        for (; mask; mask &= mask - 1)
+        {
+            int i = lowestBit(mask);
+            for (int lane = 0; lane < LEAF_SIZE; lane++)
+                if (f.nx[i] * cx[first + lane] + f.ny[i] * cy[first + lane] + f.nz[i] * cz[first + lane] + f.w[i] < -cr[first + lane])
+                    culled |= 1u << lane;
+        }
+#endif
+        return ~culled & 0xF;
+    }
+
+    // depth-first from `root`; with `split`, nodes reaching SPLIT_DEPTH are
+    // queued in `frontier` instead of being descended
+    void traverse(const Frustum &f, uint32_t root, uint32_t mask, int depth, std::vector<uint32_t> &out, bool split)
+    {
+        struct Entry
+        {
+            uint32_t node, mask;
+            int depth;
+        };
+        Entry stack[64];
+        int top = 0;
+        stack[top++] = {root, mask, depth};
+        while (top > 0)
+        {
+            Entry entry = stack[--top];
+            const Node &node = nodes[entry.node];
+            uint32_t outside, inside;
+            classify(f, node, outside, inside);
+            if (outside & entry.mask)
+                continue;
+            uint32_t planes = entry.mask & ~inside;
+            if (node.count > 0)
+            {
+                uint32_t visible = planes ? testLeaf(f, node.first, planes) : 0xF;
+                for (uint32_t lane = 0; lane < node.count; lane++)
+                    if (visible & (1u << lane))
+                        out.push_back(ids[node.first + lane]);
+                continue;
+            }
+            if (split && entry.depth + 1 >= SPLIT_DEPTH)
+            {
+                frontier.push_back({entry.node + 1, planes});
+                frontier.push_back({node.right, planes});
+                continue;
+            }
+            stack[top++] = {node.right, planes, entry.depth + 1};
+            stack[top++] = {entry.node + 1, planes, entry.depth + 1};
+        }
+    }
+};
+#endif
@@ -10,6 +10,18 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <string.h>
+#include <vector>
+
+#include "gl_state.h"
+
+// generated at build time from res/shaders
+#if __has_include("embedded_shaders.h")
+#include "embedded_shaders.h"
+#define HAS_EMBEDDED_SHADERS 1
+#else
+#define HAS_EMBEDDED_SHADERS 0
+#endif
 
 class Shader
 {
@@ -18,71 +30,19 @@ public:
 
     Shader(const char *vertexPath, const char *fragmentPath)
     {
-        std::string vertexCode;
-        std::string fragmentCode;
-        std::ifstream vShaderFile;
-        std::ifstream fShaderFile;
-
-        vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-
-        try
-        {
-            vShaderFile.open(vertexPath);
-            fShaderFile.open(fragmentPath);
-            std::stringstream vShaderStream, fShaderStream;
-            vShaderStream << vShaderFile.rdbuf();
-            fShaderStream << fShaderFile.rdbuf();
-            vShaderFile.close();
-            fShaderFile.close();
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();
-        }
-        catch (std::ifstream::failure &e)
-        {
-            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << e.what() << std::endl;
-        }
-
-// --- VERSION INJECTION LOGIC ---
-#ifdef __EMSCRIPTEN__
-        std::string versionHeader = "#version 300 es\nprecision highp float;\n";
-#else
-        std::string versionHeader = "#version 330 core\n";
-#endif
-
-        // Prepend the version header to your loaded code
-        std::string vShaderStr = versionHeader + vertexCode;
-        std::string fShaderStr = versionHeader + fragmentCode;
-
-        const char *vShaderCode = vShaderStr.c_str();
-        const char *fShaderCode = fShaderStr.c_str();
-        // -------------------------------
-
-        unsigned int vertex, fragment;
-        vertex = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertex, 1, &vShaderCode, NULL);
-        glCompileShader(vertex);
-        checkCompileErrors(vertex, "VERTEX");
-
-        fragment = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment, 1, &fShaderCode, NULL);
-        glCompileShader(fragment);
-        checkCompileErrors(fragment, "FRAGMENT");
-
-        ID = glCreateProgram();
-        glAttachShader(ID, vertex);
-        glAttachShader(ID, fragment);
-        glLinkProgram(ID);
-        checkCompileErrors(ID, "PROGRAM");
-
-        glDeleteShader(vertex);
-        glDeleteShader(fragment);
+        build(vertexPath, fragmentPath, nullptr, {});
+    }
+    // with an optional geometry shader (desktop only) and the outputs
+    // transform feedback captures, interleaved in the order given
+    Shader(const char *vertexPath, const char *fragmentPath, const char *geometryPath, const std::vector<const char *> &feedbackVaryings)
+    {
+        build(vertexPath, fragmentPath, geometryPath, feedbackVaryings);
     }
     // activate the shader
     // ------------------------------------------------------------------------
     void use() const
     {
-        glUseProgram(ID);
+        glState.useProgram(ID);
     }
     // utility uniform functions
     // ------------------------------------------------------------------------
@@ -142,12 +102,135 @@ public:
     {
         glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
     }
+    // ------------------------------------------------------------------------
+    void bindUniformBlock(const std::string &name, unsigned int binding) const
+    {
+        unsigned int index = glGetUniformBlockIndex(ID, name.c_str());
+        if (index != GL_INVALID_INDEX)
+            glUniformBlockBinding(ID, index, binding);
+    }
     void Activate()
     {
         use();
     }
 
 private:
+    void build(const char *vertexPath, const char *fragmentPath, const char *geometryPath, const std::vector<const char *> &feedbackVaryings)
+    {
+        std::string vShaderStr = resolveIncludes(loadSource(vertexPath));
+        std::string fShaderStr = resolveIncludes(loadSource(fragmentPath));
+
+        const char *vShaderCode = vShaderStr.c_str();
+        const char *fShaderCode = fShaderStr.c_str();
+
+        unsigned int vertex, fragment, geometry = 0;
+        vertex = glCreateShader(GL_VERTEX_SHADER);
+        glShaderSource(vertex, 1, &vShaderCode, NULL);
+        glCompileShader(vertex);
+        checkCompileErrors(vertex, "VERTEX");
+
+        fragment = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(fragment, 1, &fShaderCode, NULL);
+        glCompileShader(fragment);
+        checkCompileErrors(fragment, "FRAGMENT");
+
+#ifndef __EMSCRIPTEN__
+        if (geometryPath)
+        {
+            std::string gShaderStr = resolveIncludes(loadSource(geometryPath));
+            const char *gShaderCode = gShaderStr.c_str();
+            geometry = glCreateShader(GL_GEOMETRY_SHADER);
+            glShaderSource(geometry, 1, &gShaderCode, NULL);
+            glCompileShader(geometry);
+            checkCompileErrors(geometry, "GEOMETRY");
+        }
+#endif
+
+        ID = glCreateProgram();
+        glAttachShader(ID, vertex);
+        glAttachShader(ID, fragment);
+        if (geometry)
+            glAttachShader(ID, geometry);
+        if (!feedbackVaryings.empty())
+            glTransformFeedbackVaryings(ID, (GLsizei)feedbackVaryings.size(), feedbackVaryings.data(), GL_INTERLEAVED_ATTRIBS);
+        glLinkProgram(ID);
+        checkCompileErrors(ID, "PROGRAM");
+
+        glDeleteShader(vertex);
+        glDeleteShader(fragment);
+        if (geometry)
+            glDeleteShader(geometry);
+    }
+
+    // returns the versioned source for a shader path. Sources embedded at build
+    // time (see cmake/EmbedShaders.cmake) are used unless SHADERS_FROM_DISK is
+    // defined, in which case the files under res/shaders are read instead so
+    // they can be edited without rebuilding.
+    // ------------------------------------------------------------------------
+    static std::string loadSource(const char *path)
+    {
+#if HAS_EMBEDDED_SHADERS && !defined(SHADERS_FROM_DISK)
+        for (const EmbeddedShader &embedded : embeddedShaders)
+        {
+            if (strcmp(embedded.path, path) == 0)
+                return embedded.source;
+        }
+        std::cout << "WARNING::SHADER::NOT_EMBEDDED, reading from disk: " << path << std::endl;
+#endif
+        std::string code;
+        std::ifstream shaderFile;
+        shaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+        try
+        {
+            shaderFile.open(path);
+            std::stringstream shaderStream;
+            shaderStream << shaderFile.rdbuf();
+            shaderFile.close();
+            code = shaderStream.str();
+        }
+        catch (std::ifstream::failure &e)
+        {
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << e.what() << std::endl;
+        }
+
+        // Prepend the version header to your loaded code
+        return versionHeader() + code;
+    }
+    // --- VERSION INJECTION LOGIC ---
+    static std::string versionHeader()
+    {
+#ifdef __EMSCRIPTEN__
+        return "#version 300 es\nprecision highp float;\n";
+#else
+        return "#version 330 core\n";
+#endif
+    }
+    // replaces each `#include "name"` line with res/shaders/name, less its
+    // version header; included files may include others
+    // ------------------------------------------------------------------------
+    static std::string resolveIncludes(std::string source)
+    {
+        const std::string directive = "#include \"";
+        size_t at;
+        while ((at = source.find(directive)) != std::string::npos)
+        {
+            size_t nameStart = at + directive.size();
+            size_t nameEnd = source.find('"', nameStart);
+            size_t lineEnd = source.find('\n', at);
+            if (nameEnd == std::string::npos || nameEnd > lineEnd)
+            {
+                std::cout << "ERROR::SHADER::BAD_INCLUDE: " << source.substr(at, lineEnd - at) << std::endl;
+                source.erase(at, lineEnd == std::string::npos ? std::string::npos : lineEnd - at);
+                continue;
+            }
+            std::string path = "res/shaders/" + source.substr(nameStart, nameEnd - nameStart);
+            std::string included = loadSource(path.c_str());
+            if (included.compare(0, versionHeader().size(), versionHeader()) == 0)
+                included.erase(0, versionHeader().size());
+            source.replace(at, lineEnd == std::string::npos ? std::string::npos : lineEnd - at, included);
+        }
+        return source;
+    }
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
     void checkCompileErrors(GLuint shader, std::string type)
@@ -0,0 +1,341 @@
+#ifndef SOFTWARE_OCCLUSION_H
+#define SOFTWARE_OCCLUSION_H
+
+#include <glm/glm.hpp>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define SOFTWARE_OCCLUSION_AVX
+#elif defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define SOFTWARE_OCCLUSION_SSE
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#define SOFTWARE_OCCLUSION_WASM_SIMD
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "frame_stats.h"
+#include "thread_pool.h"
+
+// Triangles of an occluder in model space. They must lie inside the object
+// they stand for, so anything they hide really is hidden.
+struct OccluderMesh
+{
+    std::vector<glm::vec3> positions;
+    std::vector<uint32_t> indices;
+
+    // sphere with every vertex on the unit sphere, hence inside it; counter
+    // clockwise seen from outside
+    static OccluderMesh sphere(int segments, int rings)
+    {
+        OccluderMesh mesh;
+        const float pi = 3.14159265f;
+        for (int ring = 0; ring <= rings; ring++)
+            for (int segment = 0; segment <= segments; segment++)
+            {
+                float theta = pi * ring / rings, phi = 2.0f * pi * segment / segments;
+                mesh.positions.push_back(glm::vec3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi)));
+            }
+        for (int ring = 0; ring < rings; ring++)
+            for (int segment = 0; segment < segments; segment++)
+            {
+                uint32_t a = ring * (segments + 1) + segment, b = a + segments + 1;
+                mesh.indices.insert(mesh.indices.end(), {a, a + 1, b, a + 1, b + 1, b});
+            }
+        return mesh;
+    }
+};
+
+// Low resolution cpu depth buffer for occlusion culling within the frame,
+// with none of the latency of gpu queries.
+//   - addOccluder() queues a few big, simple meshes; rasterize() draws them,
+//     the screen split into bands of rows across the thread pool, each
+//     band writing LANES pixels per step
+//   - every TILE x TILE block then records its farthest depth, so a box
+//     test first compares against whole tiles and only looks at single
+//     pixels in tiles the occluders don't fully cover in front of it
+// Depth is window depth, 0 near to 1 far. Triangles crossing the near plane
+// are dropped, which only ever hides less.
+class SoftwareOcclusion
+{
+public:
+    static const int TILE = 8;
+#if defined(SOFTWARE_OCCLUSION_AVX)
+    static const int LANES = 8;
+#elif defined(SOFTWARE_OCCLUSION_SSE) || defined(SOFTWARE_OCCLUSION_WASM_SIMD)
+    static const int LANES = 4;
+#else
+    static const int LANES = 1;
+#endif
+
+    // both rounded up to whole tiles
+    SoftwareOcclusion(int width = 256, int height = 192)
+        : width((width + TILE - 1) / TILE * TILE), height((height + TILE - 1) / TILE * TILE)
+    {
+        tilesX = this->width / TILE;
+        tilesY = this->height / TILE;
+        depth.resize((size_t)this->width * this->height);
+        tileMax.resize((size_t)tilesX * tilesY);
+    }
+
+    void clear()
+    {
+        occluders.clear();
+    }
+
+    // the mesh has to outlive rasterize()
+    void addOccluder(const OccluderMesh &mesh, const glm::mat4 &model)
+    {
+        occluders.push_back({&mesh, model});
+    }
+
+    void rasterize(const glm::mat4 &viewProjection, ThreadPool *pool = nullptr)
+    {
+        auto start = std::chrono::steady_clock::now();
+        this->viewProjection = viewProjection;
+        setup();
+        int bands = tilesY;
+        auto draw = [&](size_t begin, size_t end)
+        {
+            for (size_t band = begin; band < end; band++)
+                drawBand((int)band * TILE, (int)band * TILE + TILE);
+        };
+        if (pool)
+            pool->parallelFor(bands, 2, draw);
+        else
+            draw(0, bands);
+        frameStats.softOccluderTriangles = (unsigned int)triangles.size();
+        frameStats.softRasterMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // false only when the whole world space box is behind the occluders
+    bool visible(const glm::vec3 &center, const glm::vec3 &extent)
+    {
+        auto start = std::chrono::steady_clock::now();
+        bool result = testBox(center, extent);
+        frameStats.softTests++;
+        frameStats.softCulled += !result;
+        frameStats.softTestMs += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return result;
+    }
+
+    static const char *simdName()
+    {
+#if defined(SOFTWARE_OCCLUSION_AVX)
+        return "avx";
+#elif defined(SOFTWARE_OCCLUSION_SSE)
+        return "sse";
+#elif defined(SOFTWARE_OCCLUSION_WASM_SIMD)
+        return "wasm simd128";
+#else
+        return "scalar";
+#endif
+    }
+
+private:
+    struct Occluder
+    {
+        const OccluderMesh *mesh;
+        glm::mat4 model;
+    };
+
+    // edges as a*x + b*y + c, >= 0 inside, and the depth plane, all in
+    // pixels; rows is the y range the triangle covers
+    struct Triangle
+    {
+        float a[3], b[3], c[3];
+        float z0, dzdx, dzdy;
+        int x0, x1, y0, y1;
+    };
+
+    int width, height, tilesX, tilesY;
+    std::vector<float> depth;
+    std::vector<float> tileMax;
+    std::vector<Occluder> occluders;
+    std::vector<Triangle> triangles;
+    std::vector<glm::vec4> projected;
+    // from the last rasterize(), for visible()
+    glm::mat4 viewProjection = glm::mat4(1.0f);
+
+    // to window coordinates, w <= 0 marked with a negative w
+    glm::vec4 toWindow(const glm::vec4 &clip) const
+    {
+        if (clip.w < 1e-5f || clip.z < -clip.w)
+            return glm::vec4(0.0f, 0.0f, 0.0f, -1.0f);
+        float inverse = 1.0f / clip.w;
+        return glm::vec4((clip.x * inverse * 0.5f + 0.5f) * width, (clip.y * inverse * 0.5f + 0.5f) * height,
+                         clip.z * inverse * 0.5f + 0.5f, 1.0f);
+    }
+
+    // projects every occluder and keeps the front facing, on screen triangles
+    void setup()
+    {
+        triangles.clear();
+        for (const Occluder &occluder : occluders)
+        {
+            glm::mat4 mvp = viewProjection * occluder.model;
+            const OccluderMesh &mesh = *occluder.mesh;
+            projected.resize(mesh.positions.size());
+            for (size_t i = 0; i < mesh.positions.size(); i++)
+                projected[i] = toWindow(mvp * glm::vec4(mesh.positions[i], 1.0f));
+            for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+            {
+                const glm::vec4 &p0 = projected[mesh.indices[i]], &p1 = projected[mesh.indices[i + 1]], &p2 = projected[mesh.indices[i + 2]];
+                if (p0.w < 0.0f || p1.w < 0.0f || p2.w < 0.0f)
+                    continue;
+                float area = (p1.x - p0.x) * (p2.y - p0.y) - (p2.x - p0.x) * (p1.y - p0.y);
+                if (area <= 0.0f)
+                    continue;
+                Triangle t;
+                t.x0 = std::max(0, (int)std::floor(std::min({p0.x, p1.x, p2.x})));
+                t.x1 = std::min(width - 1, (int)std::ceil(std::max({p0.x, p1.x, p2.x})));
+                t.y0 = std::max(0, (int)std::floor(std::min({p0.y, p1.y, p2.y})));
+                t.y1 = std::min(height - 1, (int)std::ceil(std::max({p0.y, p1.y, p2.y})));
+                if (t.x0 > t.x1 || t.y0 > t.y1)
+                    continue;
+                const glm::vec4 *v[3] = {&p0, &p1, &p2};
+                for (int e = 0; e < 3; e++)
+                {
+                    const glm::vec4 &from = *v[e], &to = *v[(e + 1) % 3];
+                    t.a[e] = from.y - to.y;
+                    t.b[e] = to.x - from.x;
+                    t.c[e] = from.x * to.y - from.y * to.x;
+                }
+                float inverse = 1.0f / area;
+                t.dzdx = ((p1.z - p0.z) * (p2.y - p0.y) - (p2.z - p0.z) * (p1.y - p0.y)) * inverse;
+                t.dzdy = ((p2.z - p0.z) * (p1.x - p0.x) - (p1.z - p0.z) * (p2.x - p0.x)) * inverse;
+                t.z0 = p0.z - t.dzdx * p0.x - t.dzdy * p0.y;
+                triangles.push_back(t);
+            }
+        }
+    }
+
+    // clears rows [y0, y1), draws every triangle touching them and
+    // refreshes the tile maxima of the band
+    void drawBand(int y0, int y1)
+    {
+        std::fill(depth.begin() + (size_t)y0 * width, depth.begin() + (size_t)y1 * width, 1.0f);
+        for (const Triangle &t : triangles)
+        {
+            int rowStart = std::max(y0, t.y0), rowEnd = std::min(y1 - 1, t.y1);
+            int x0 = t.x0 / LANES * LANES;
+            for (int y = rowStart; y <= rowEnd; y++)
+                drawSpan(t, y, x0, t.x1);
+        }
+        for (int ty = y0 / TILE; ty < y1 / TILE; ty++)
+            for (int tx = 0; tx < tilesX; tx++)
+            {
+                float farthest = 0.0f;
+                for (int y = ty * TILE; y < ty * TILE + TILE; y++)
+                    for (int x = tx * TILE; x < tx * TILE + TILE; x++)
+                        farthest = std::max(farthest, depth[(size_t)y * width + x]);
+                tileMax[(size_t)ty * tilesX + tx] = farthest;
+            }
+    }
+
+    // pixel centres of row y from x0 (a multiple of LANES) to x1
+    void drawSpan(const Triangle &t, int y, int x0, int x1)
+    {
+        float py = y + 0.5f;
+        float *row = &depth[(size_t)y * width];
+        float rowC0 = t.b[0] * py + t.c[0], rowC1 = t.b[1] * py + t.c[1], rowC2 = t.b[2] * py + t.c[2];
+        float rowZ = t.z0 + t.dzdy * py;
+#if defined(SOFTWARE_OCCLUSION_AVX)
+        const __m256 ramp = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f), zero = _mm256_setzero_ps();
+        for (int x = x0; x <= x1; x += LANES)
+        {
+            __m256 px = _mm256_add_ps(_mm256_set1_ps((float)x), ramp);
+            __m256 e0 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(t.a[0]), px), _mm256_set1_ps(rowC0));
+            __m256 e1 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(t.a[1]), px), _mm256_set1_ps(rowC1));
+            __m256 e2 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(t.a[2]), px), _mm256_set1_ps(rowC2));
+            __m256 inside = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(e0, zero, _CMP_GE_OQ), _mm256_cmp_ps(e1, zero, _CMP_GE_OQ)),
+                                          _mm256_cmp_ps(e2, zero, _CMP_GE_OQ));
+            if (_mm256_movemask_ps(inside) == 0)
+                continue;
+            __m256 z = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(t.dzdx), px), _mm256_set1_ps(rowZ));
+            __m256 old = _mm256_loadu_ps(row + x);
+            _mm256_storeu_ps(row + x, _mm256_blendv_ps(old, _mm256_min_ps(old, z), inside));
+        }
+#elif defined(SOFTWARE_OCCLUSION_SSE)
+        const __m128 ramp = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f), zero = _mm_setzero_ps();
+        for (int x = x0; x <= x1; x += LANES)
+        {
+            __m128 px = _mm_add_ps(_mm_set1_ps((float)x), ramp);
+            __m128 e0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.a[0]), px), _mm_set1_ps(rowC0));
+            __m128 e1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.a[1]), px), _mm_set1_ps(rowC1));
+            __m128 e2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.a[2]), px), _mm_set1_ps(rowC2));
+            __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+            if (_mm_movemask_ps(inside) == 0)
+                continue;
+            __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.dzdx), px), _mm_set1_ps(rowZ));
+            __m128 old = _mm_loadu_ps(row + x);
+            _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, _mm_min_ps(old, z)), _mm_andnot_ps(inside, old)));
+        }
+#elif defined(SOFTWARE_OCCLUSION_WASM_SIMD)
+        const v128_t ramp = wasm_f32x4_make(0.5f, 1.5f, 2.5f, 3.5f), zero = wasm_f32x4_splat(0.0f);
+        for (int x = x0; x <= x1; x += LANES)
+        {
+            v128_t px = wasm_f32x4_add(wasm_f32x4_splat((float)x), ramp);
+            v128_t e0 = wasm_f32x4_add(wasm_f32x4_mul(wasm_f32x4_splat(t.a[0]), px), wasm_f32x4_splat(rowC0));
+            v128_t e1 = wasm_f32x4_add(wasm_f32x4_mul(wasm_f32x4_splat(t.a[1]), px), wasm_f32x4_splat(rowC1));
+            v128_t e2 = wasm_f32x4_add(wasm_f32x4_mul(wasm_f32x4_splat(t.a[2]), px), wasm_f32x4_splat(rowC2));
+            v128_t inside = wasm_v128_and(wasm_v128_and(wasm_f32x4_ge(e0, zero), wasm_f32x4_ge(e1, zero)), wasm_f32x4_ge(e2, zero));
+            if (!wasm_v128_any_true(inside))
+                continue;
+            v128_t z = wasm_f32x4_add(wasm_f32x4_mul(wasm_f32x4_splat(t.dzdx), px), wasm_f32x4_splat(rowZ));
+            v128_t old = wasm_v128_load(row + x);
+            wasm_v128_store(row + x, wasm_v128_bitselect(wasm_f32x4_min(old, z), old, inside));
+        }
+#else
+        for (int x = x0; x <= x1; x++)
+        {
+            float px = x + 0.5f;
+            if (t.a[0] * px + rowC0 >= 0.0f && t.a[1] * px + rowC1 >= 0.0f && t.a[2] * px + rowC2 >= 0.0f)
+                row[x] = std::min(row[x], t.dzdx * px + rowZ);
+        }
+#endif
+    }
+
+    bool testBox(const glm::vec3 &center, const glm::vec3 &extent) const
+    {
+        // screen rectangle and nearest depth of the box's corners
+        glm::vec2 low(1e30f), high(-1e30f);
+        float nearest = 1.0f;
+        for (int corner = 0; corner < 8; corner++)
+        {
+            glm::vec3 offset((corner & 1) ? extent.x : -extent.x, (corner & 2) ? extent.y : -extent.y, (corner & 4) ? extent.z : -extent.z);
+            glm::vec4 p = toWindow(viewProjection * glm::vec4(center + offset, 1.0f));
+            // reaches the near plane: can't be behind anything
+            if (p.w < 0.0f)
+                return true;
+            low = glm::min(low, glm::vec2(p));
+            high = glm::max(high, glm::vec2(p));
+            nearest = std::min(nearest, p.z);
+        }
+        // occluders were sampled at pixel centres and may overhang their edge
+        // pixels a little: a pixel of margin keeps the answer conservative
+        int x0 = std::max(0, (int)std::floor(low.x) - 1), x1 = std::min(width - 1, (int)std::floor(high.x) + 1);
+        int y0 = std::max(0, (int)std::floor(low.y) - 1), y1 = std::min(height - 1, (int)std::floor(high.y) + 1);
+        if (x0 > x1 || y0 > y1)
+            return true;
+        for (int ty = y0 / TILE; ty <= y1 / TILE; ty++)
+            for (int tx = x0 / TILE; tx <= x1 / TILE; tx++)
+            {
+                if (tileMax[(size_t)ty * tilesX + tx] < nearest)
+                    continue;
+                int rowEnd = std::min(y1, ty * TILE + TILE - 1), columnEnd = std::min(x1, tx * TILE + TILE - 1);
+                for (int y = std::max(y0, ty * TILE); y <= rowEnd; y++)
+                    for (int x = std::max(x0, tx * TILE); x <= columnEnd; x++)
+                        if (depth[(size_t)y * width + x] >= nearest)
+                            return true;
+            }
+        return false;
+    }
+};
+#endif
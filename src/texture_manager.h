@@ -0,0 +1,1053 @@
+#ifndef TEXTURE_MANAGER_H
+#define TEXTURE_MANAGER_H
+
+#ifdef __EMSCRIPTEN__
+#include <GLES3/gl3.h>
+#else
+#include <glad/glad.h>
+#endif
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "gl_state.h"
+#include "image_decoder.h"
+#include "ktx2.h"
+#include "mip_generator.h"
+#include "texture_quality.h"
+#include "upload_ring.h"
+
+// How a texture is sampled. Part of the cache key, so the same image loaded
+// with different wrap or filter modes gets its own GL texture.
+struct SamplerDesc
+{
+    GLenum wrapS = GL_REPEAT;
+    GLenum wrapT = GL_REPEAT;
+    GLenum minFilter = GL_LINEAR_MIPMAP_LINEAR;
+    GLenum magFilter = GL_LINEAR;
+
+    bool usesMipmaps() const
+    {
+        return minFilter != GL_LINEAR && minFilter != GL_NEAREST;
+    }
+};
+
+// Requested channel layout. NATIVE keeps whatever the file has.
+enum TextureFormat
+{
+    TEXTURE_FORMAT_NATIVE = 0,
+    TEXTURE_FORMAT_RGBA8 = 4
+};
+
+struct TextureDesc
+{
+    TextureFormat format = TEXTURE_FORMAT_NATIVE;
+    SamplerDesc sampler;
+    bool flipVertically = true;
+    // for textures blended with GL_ONE, GL_ONE_MINUS_SRC_ALPHA
+    bool premultiplyAlpha = false;
+    // mips are filtered on the decode workers, in linear light for colour
+    // textures; gpuMipmaps hands the job to glGenerateMipmap instead
+    MipFilter mipFilter = MIP_FILTER_KAISER;
+    bool srgb = true;
+    bool gpuMipmaps = false;
+    // block compress on the decode workers (BC1/BC3 or ETC2, whichever the
+    // context samples), for images that have no cooked KTX2 version.
+    // Ignored for arrays, cube maps and gpuMipmaps.
+    bool compress = false;
+    BlockQuality compressQuality = BLOCK_QUALITY_NORMAL;
+
+    // equirectangular planet maps wrap around the date line in u but must
+    // not wrap from one pole to the other in v
+    static TextureDesc equirect()
+    {
+        TextureDesc desc;
+        desc.sampler.wrapT = GL_CLAMP_TO_EDGE;
+        return desc;
+    }
+};
+
+class TextureManager;
+TextureManager &textureManager();
+
+// Refcounted reference to a managed texture. The GL texture is deleted once
+// the last handle goes away. The GL name stays the same when the manager
+// evicts or restores the texture, so id() can be cached by materials.
+class TextureHandle
+{
+public:
+    TextureHandle() {}
+    TextureHandle(const TextureHandle &other);
+    TextureHandle(TextureHandle &&other) noexcept : slot(other.slot) { other.slot = 0; }
+    TextureHandle &operator=(TextureHandle other) noexcept
+    {
+        std::swap(slot, other.slot);
+        return *this;
+    }
+    ~TextureHandle() { reset(); }
+
+    GLuint id() const;
+    // GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY or GL_TEXTURE_CUBE_MAP
+    GLenum target() const;
+    bool valid() const { return slot != 0; }
+    void reset();
+
+private:
+    friend class TextureManager;
+    explicit TextureHandle(unsigned int slot) : slot(slot) {}
+    unsigned int slot = 0;
+};
+
+// Single owner of every image texture in the project. Textures are deduped by
+// path, format and sampler, tracked by their VRAM size including mips, and
+// the least recently visible ones are shrunk or evicted when the total goes
+// over the budget. Decoding happens on worker threads: a texture shows a 1x1
+// placeholder until pump() uploads its pixels on the GL thread.
+//
+// Mips are streamed tail first. The workers build the whole chain, the small
+// levels go up at once and the larger ones are streamed through an
+// UploadRing, in row bands within a per-frame byte budget, while draws ask
+// for them through touch(). GL_TEXTURE_BASE_LEVEL always points at
+// the largest resident level, so missing levels are never sampled and
+// dropping a top mip frees its memory straight away.
+//
+// Texture arrays and atlases let draws of different images share one bind:
+// a draw then only carries a layer index or an atlas rect. Arrays and cube
+// maps are uploaded whole once decoded and are evicted whole, never shrunk.
+class TextureManager
+{
+public:
+    // textures are never shrunk below this edge length before being evicted
+    static const int MIN_RESIDENT_SIZE = 64;
+    // levels up to this edge length are uploaded together when a decode lands
+    static const int TAIL_SIZE = 32;
+    // touch() without a coverage asks for the full resolution
+    static constexpr float FULL_COVERAGE = 1e9f;
+    // pixel transfer format by channel count
+    static constexpr GLenum pixelFormats[5] = {0, GL_RED, GL_RG, GL_RGB, GL_RGBA};
+
+    // call before the first acquire(); 0 decodes on the calling thread
+    void setDecodeThreads(int threads)
+    {
+        decoder.start(threads);
+        decoderStarted = true;
+        compressedFamilies = queryCompressedFamilies();
+    }
+
+    int decodeThreads() const
+    {
+        return decoder.threadCount();
+    }
+
+    // applies to textures decoded from now on; set it before the first
+    // acquire() so nothing is decoded twice
+    void setQuality(const TextureQuality &settings)
+    {
+        quality = settings;
+    }
+
+    TextureHandle acquire(const std::string &path, const TextureDesc &desc = TextureDesc())
+    {
+        Entry *entry = nullptr;
+        unsigned int slot = findOrCreate(makeKey(path, desc), path, desc, GL_TEXTURE_2D, entry);
+        if (entry)
+            load(slot, *entry);
+        return TextureHandle(slot);
+    }
+
+    // One GL_TEXTURE_2D_ARRAY with a layer per path, in order; shaders pick
+    // theirs through a layer index. Images of another size are resampled to
+    // width x height on the decode workers. All layers share one format, so
+    // TEXTURE_FORMAT_NATIVE means RGBA8 here.
+    TextureHandle acquireArray(const std::vector<std::string> &paths, int width, int height, const TextureDesc &desc = TextureDesc())
+    {
+        TextureDesc layered = desc;
+        if (layered.format == TEXTURE_FORMAT_NATIVE)
+            layered.format = TEXTURE_FORMAT_RGBA8;
+        std::string name = joinPaths(paths);
+        Entry *entry = nullptr;
+        unsigned int slot = findOrCreate(makeKey("array " + std::to_string(width) + "x" + std::to_string(height) + " " + name, layered),
+                                         name, layered, GL_TEXTURE_2D_ARRAY, entry);
+        if (entry)
+        {
+            entry->paths = paths;
+            entry->layerWidth = width;
+            entry->layerHeight = height;
+            load(slot, *entry);
+        }
+        return TextureHandle(slot);
+    }
+
+    // Packs small images into one size x size GL_TEXTURE_2D with `padding`
+    // texels of gutter around each; atlasRect() tells where each one went.
+    // Mips stop at the level where the gutter would drop below one texel,
+    // so pad by 2^n to keep n of them. The sampler's wrap modes only apply
+    // to the atlas as a whole.
+    TextureHandle acquireAtlas(const std::vector<std::string> &paths, int size, int padding, const TextureDesc &desc = TextureDesc())
+    {
+        TextureDesc packed = desc;
+        if (packed.format == TEXTURE_FORMAT_NATIVE)
+            packed.format = TEXTURE_FORMAT_RGBA8;
+        std::string name = joinPaths(paths);
+        Entry *entry = nullptr;
+        unsigned int slot = findOrCreate(makeKey("atlas " + std::to_string(size) + "/" + std::to_string(padding) + " " + name, packed),
+                                         name, packed, GL_TEXTURE_2D, entry);
+        if (entry)
+        {
+            entry->paths = paths;
+            entry->atlasSize = size;
+            entry->atlasPadding = padding;
+            load(slot, *entry);
+        }
+        return TextureHandle(slot);
+    }
+
+    // A GL_TEXTURE_CUBE_MAP resampled on the decode workers from an
+    // equirectangular map, sampled with a direction instead of sphere uvs.
+    // faceSize 0 keeps the equator's texel density (a quarter of the width).
+    TextureHandle acquireCubemap(const std::string &path, int faceSize = 0, const TextureDesc &desc = TextureDesc())
+    {
+        TextureDesc cube = desc;
+        cube.sampler.wrapS = cube.sampler.wrapT = GL_CLAMP_TO_EDGE;
+        Entry *entry = nullptr;
+        unsigned int slot = findOrCreate(makeKey("cube " + std::to_string(faceSize) + " " + path, cube), path, cube, GL_TEXTURE_CUBE_MAP, entry);
+        if (entry)
+        {
+            entry->cubeFaceSize = faceSize;
+            load(slot, *entry);
+        }
+        return TextureHandle(slot);
+    }
+
+    // A texture whose pixels come from `generator`, run on a decode worker
+    // at width x height; everything else behaves like a file, including
+    // desc.compress. Generated textures are planet maps, so they default to
+    // TextureDesc::equirect(). Evicted textures are generated again, so the generator
+    // must be thread safe and give the same image every time. `name` is
+    // what dedupes it and what the inventory shows.
+    TextureHandle acquireGenerated(const std::string &name, int width, int height, TextureGenerator generator,
+                                   const TextureDesc &desc = TextureDesc::equirect())
+    {
+        Entry *entry = nullptr;
+        unsigned int slot = findOrCreate(makeKey("generated " + std::to_string(width) + "x" + std::to_string(height) + " " + name, desc),
+                                         name, desc, GL_TEXTURE_2D, entry);
+        if (entry)
+        {
+            entry->generator = std::move(generator);
+            entry->generatedWidth = width;
+            entry->generatedHeight = height;
+            load(slot, *entry);
+        }
+        return TextureHandle(slot);
+    }
+
+    // uv rect of the index-th image of an atlas; the whole texture until the
+    // atlas is decoded
+    AtlasRect atlasRect(const TextureHandle &handle, int index) const
+    {
+        auto found = entries.find(handle.slot);
+        if (found == entries.end() || index < 0 || index >= (int)found->second.rects.size())
+            return AtlasRect();
+        return found->second.rects[index];
+    }
+
+    // Called by draws so eviction knows what is on screen. screenPixels is
+    // roughly how many pixels the texture spans on screen (see
+    // screenCoverage()); the finest level any draw asks for in a frame is
+    // streamed in.
+    void touch(GLuint id, float screenPixels = FULL_COVERAGE)
+    {
+        auto found = slotsById.find(id);
+        if (found == slotsById.end())
+            return;
+        Entry &entry = entries[found->second];
+        int wanted = levelForCoverage(entry, screenPixels);
+        if (entry.wantedFrame != frame || wanted < entry.wantedLevel)
+            entry.wantedLevel = wanted;
+        entry.wantedFrame = frame;
+        entry.lastVisibleFrame = frame;
+
+        // the decoded chain is dropped once fully resident, so finer levels
+        // that were evicted since have to be decoded again
+        if (entry.evicted || (entry.wantedLevel < entry.baseLevel && entry.pixels.empty()))
+            requestLoad(found->second, entry);
+    }
+
+    // approximate on-screen diameter in pixels of a sphere of `radius` at
+    // `distance` from the eye
+    static float screenCoverage(float radius, float distance, float fovY, float viewportHeight)
+    {
+        if (distance <= radius)
+            return FULL_COVERAGE;
+        return radius / (distance * std::tan(fovY * 0.5f)) * viewportHeight;
+    }
+
+    // uploads the tails of finished decodes, then refines resident textures
+    // towards the levels draws asked for
+    void pump()
+    {
+        DecodedImage image;
+        while (decoder.poll(image))
+        {
+            auto found = entries.find(image.slot);
+            if (found == entries.end() || found->second.generation != image.generation)
+                continue; // released or re-requested since
+            Entry &entry = found->second;
+            entry.loading = false;
+            if (!image.ok)
+            {
+                std::cout << "Texture failed to load at path: " << image.path << " (" << image.error << ")" << std::endl;
+                continue;
+            }
+            receive(entry, image);
+        }
+        refine();
+    }
+
+    // blocks until every queued decode has been uploaded
+    void waitForLoads()
+    {
+        while (decoder.busy())
+        {
+            pump();
+            std::this_thread::yield();
+        }
+        pump();
+    }
+
+    void setBudget(size_t bytes)
+    {
+        budgetBytes = bytes;
+    }
+
+    // bytes of mip data streamed per frame, the size of each upload ring slot
+    void setUploadBudget(size_t bytes)
+    {
+        uploadBudget = bytes;
+        uploadRing.destroy();
+    }
+
+    size_t residentBytes() const
+    {
+        size_t total = 0;
+        for (const auto &item : entries)
+            total += item.second.bytes;
+        return total;
+    }
+
+    // uploads finished decodes, advances the visibility clock and enforces
+    // the vram budget
+    void endFrame()
+    {
+        pump();
+        enforceBudget();
+        frame++;
+    }
+
+    void dumpInventory(std::ostream &out = std::cout) const
+    {
+        std::vector<const Entry *> sorted;
+        for (const auto &item : entries)
+            sorted.push_back(&item.second);
+        std::sort(sorted.begin(), sorted.end(), [](const Entry *a, const Entry *b)
+                  { return a->bytes > b->bytes; });
+
+        out << "[TEXTURES] " << sorted.size() << " textures, "
+            << residentBytes() / 1024 << " KB resident of " << budgetBytes / 1024 << " KB budget" << std::endl;
+        for (const Entry *entry : sorted)
+        {
+            out << "  " << std::setw(6) << entry->id
+                << " " << std::setw(5) << entry->width << "x" << std::setw(5) << std::left << entry->height << std::right
+                << " " << std::setw(14) << std::left << formatName(*entry) << std::right
+                << " mips " << std::setw(2) << entry->levels - std::min(entry->baseLevel, entry->levels) << "/" << std::setw(2) << std::left << entry->levels << std::right
+                << " " << std::setw(8) << entry->bytes / 1024 << " KB"
+                << " refs " << entry->refs
+                << " seen " << (frame - entry->lastVisibleFrame) << " frames ago"
+                << (entry->evicted ? " [evicted]" : entry->baseLevel > entry->dropLevels ? " [reduced]" : "")
+                << "  " << entry->path << std::endl;
+        }
+    }
+
+    // deletes every GL texture while the context still exists; handles
+    // released afterwards are ignored
+    void shutdown()
+    {
+        decoder.stop();
+        uploadRing.destroy();
+        for (auto &item : entries)
+        {
+            glState.forgetTexture(item.second.id);
+            glDeleteTextures(1, &item.second.id);
+        }
+        entries.clear();
+        slotsByKey.clear();
+        slotsById.clear();
+        closed = true;
+    }
+
+private:
+    friend class TextureHandle;
+
+    struct Entry
+    {
+        std::string key;
+        std::string path;
+        TextureDesc desc;
+        GLuint id = 0;
+        GLenum target = GL_TEXTURE_2D;
+        int refs = 0;
+        // array layers or atlas images, empty for a single file
+        std::vector<std::string> paths;
+        int layerWidth = 0;
+        int layerHeight = 0;
+        int atlasSize = 0;
+        int atlasPadding = 0;
+        int cubeFaceSize = 0;
+        TextureGenerator generator;
+        int generatedWidth = 0;
+        int generatedHeight = 0;
+        // array layers, or 6 faces for cube maps
+        int layers = 1;
+        std::vector<AtlasRect> rects;
+        // size of level 0 of the decoded chain
+        int width = 0;
+        int height = 0;
+        int channels = 0;
+        // compressed internal format, 0 for plain 8-bit channels
+        GLenum compressedFormat = 0;
+        // GL_RGB565 on low quality tiers, 0 for the one matching channels
+        GLenum internalFormat = 0;
+        // the full chain; levels and baseLevel index into it
+        std::vector<ImageLevel> chain;
+        int levels = 0;
+        // levels the decoder skipped before building the chain
+        int dropLevels = 0;
+        // largest resident level, == levels while only the placeholder is up
+        int baseLevel = 0;
+        // finest level a draw asked for in the last frame it was visible,
+        // everything until the first touch
+        int wantedLevel = 0;
+        uint64_t wantedFrame = UINT64_MAX;
+        // decoded chain kept on the cpu until every level is resident
+        std::vector<unsigned char> pixels;
+        // level being streamed in and how many of its rows have been sent
+        int streamingLevel = -1;
+        int streamedRows = 0;
+        bool evicted = false;
+        // a decode is queued; its result is matched by generation
+        bool loading = false;
+        unsigned int generation = 0;
+        size_t bytes = 0;
+        uint64_t lastVisibleFrame = 0;
+    };
+
+    std::unordered_map<unsigned int, Entry> entries;
+    std::unordered_map<std::string, unsigned int> slotsByKey;
+    std::unordered_map<GLuint, unsigned int> slotsById;
+    unsigned int nextSlot = 1;
+    uint64_t frame = 0;
+    size_t budgetBytes = 256u * 1024u * 1024u;
+    size_t uploadBudget = 4u * 1024u * 1024u;
+    UploadRing uploadRing;
+    bool closed = false;
+    ImageDecoder decoder;
+    bool decoderStarted = false;
+    unsigned int compressedFamilies = 0;
+    TextureQuality quality;
+
+    void addRef(unsigned int slot)
+    {
+        auto found = entries.find(slot);
+        if (found != entries.end())
+            found->second.refs++;
+    }
+
+    void release(unsigned int slot)
+    {
+        if (closed)
+            return;
+        auto found = entries.find(slot);
+        if (found == entries.end() || --found->second.refs > 0)
+            return;
+        Entry &entry = found->second;
+        glState.forgetTexture(entry.id);
+        glDeleteTextures(1, &entry.id);
+        slotsByKey.erase(entry.key);
+        slotsById.erase(entry.id);
+        entries.erase(found);
+    }
+
+    GLuint idOf(unsigned int slot) const
+    {
+        auto found = entries.find(slot);
+        return found == entries.end() ? 0 : found->second.id;
+    }
+
+    GLenum targetOf(unsigned int slot) const
+    {
+        auto found = entries.find(slot);
+        return found == entries.end() ? GL_TEXTURE_2D : found->second.target;
+    }
+
+    // the slot already holding `key`, or a new entry returned through
+    // `created` for the caller to fill in and load()
+    unsigned int findOrCreate(const std::string &key, const std::string &path, const TextureDesc &desc, GLenum target, Entry *&created)
+    {
+        if (!decoderStarted)
+            setDecodeThreads(ThreadPool::defaultThreadCount());
+
+        created = nullptr;
+        auto found = slotsByKey.find(key);
+        if (found != slotsByKey.end())
+        {
+            entries[found->second].refs++;
+            return found->second;
+        }
+
+        unsigned int slot = nextSlot++;
+        Entry &entry = entries[slot];
+        entry.key = key;
+        entry.path = path;
+        entry.desc = desc;
+        entry.target = target;
+        entry.refs = 1;
+        entry.lastVisibleFrame = frame;
+        glGenTextures(1, &entry.id);
+        slotsByKey[key] = slot;
+        slotsById[entry.id] = slot;
+        created = &entry;
+        return slot;
+    }
+
+    void load(unsigned int slot, Entry &entry)
+    {
+        showPlaceholder(entry);
+        requestLoad(slot, entry);
+    }
+
+    static std::string joinPaths(const std::vector<std::string> &paths)
+    {
+        std::string joined;
+        for (const std::string &path : paths)
+            joined += (joined.empty() ? "" : ", ") + path;
+        return joined;
+    }
+
+    static std::string makeKey(const std::string &path, const TextureDesc &desc)
+    {
+        const SamplerDesc &s = desc.sampler;
+        return path + "|" + std::to_string(desc.format) + "|" + std::to_string(desc.flipVertically) + std::to_string(desc.premultiplyAlpha) + "|" +
+               std::to_string(desc.mipFilter) + std::to_string(desc.srgb) + std::to_string(desc.gpuMipmaps) + "|" +
+               std::to_string(desc.compress) + std::to_string(desc.compressQuality) + "|" +
+               std::to_string(s.wrapS) + "," + std::to_string(s.wrapT) + "," +
+               std::to_string(s.minFilter) + "," + std::to_string(s.magFilter);
+    }
+
+    // queues a decode of the entry's file, or generator, or layers
+    void requestLoad(unsigned int slot, Entry &entry)
+    {
+        if (entry.loading)
+            return;
+        entry.loading = true;
+        entry.generation++;
+
+        DecodeRequest request;
+        request.slot = slot;
+        request.generation = entry.generation;
+        request.path = entry.path;
+        request.channels = entry.desc.format;
+        request.flipVertically = entry.desc.flipVertically;
+        request.premultiplyAlpha = entry.desc.premultiplyAlpha;
+        const SamplerDesc &sampler = entry.desc.sampler;
+        request.mipmaps = sampler.usesMipmaps() && !entry.desc.gpuMipmaps;
+        request.mipOptions.filter = entry.desc.mipFilter;
+        request.mipOptions.srgb = entry.desc.srgb;
+        request.mipOptions.wrapU = sampler.wrapS == GL_REPEAT || sampler.wrapS == GL_MIRRORED_REPEAT;
+        request.mipOptions.wrapV = sampler.wrapT == GL_REPEAT || sampler.wrapT == GL_MIRRORED_REPEAT;
+        request.compressedFamilies = compressedFamilies;
+        request.paths = entry.paths;
+        request.maxSize = quality.maxSize;
+        request.layerWidth = entry.layerWidth;
+        request.layerHeight = entry.layerHeight;
+        // array layers can't be downscaled one by one, the whole array is
+        while (quality.maxSize > 0 && (request.layerWidth > quality.maxSize || request.layerHeight > quality.maxSize))
+        {
+            request.layerWidth = std::max(1, request.layerWidth / 2);
+            request.layerHeight = std::max(1, request.layerHeight / 2);
+        }
+        request.atlasSize = entry.atlasSize;
+        request.atlasPadding = entry.atlasPadding;
+        request.cubemap = entry.target == GL_TEXTURE_CUBE_MAP;
+        request.cubeFaceSize = entry.cubeFaceSize;
+        request.generator = entry.generator;
+        request.generatedWidth = entry.generatedWidth;
+        request.generatedHeight = entry.generatedHeight;
+        // glGenerateMipmap can't fill compressed levels
+        request.compress = entry.desc.compress && !entry.desc.gpuMipmaps && entry.target == GL_TEXTURE_2D && entry.paths.empty();
+        request.compressQuality = entry.desc.compressQuality;
+        decoder.submit(request);
+    }
+
+    // mip level whose size roughly matches the on-screen coverage
+    static int levelForCoverage(const Entry &entry, float screenPixels)
+    {
+        if (entry.levels == 0)
+            return 0;
+        float size = (float)std::max(entry.width, entry.height);
+        int level = 0;
+        while (level + 1 < entry.levels && size * 0.5f >= screenPixels)
+        {
+            size *= 0.5f;
+            level++;
+        }
+        return level;
+    }
+
+    void showPlaceholder(Entry &entry)
+    {
+        static const unsigned char grey[4] = {128, 128, 128, 255};
+        glState.bindTexture(0, entry.target, entry.id);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        // a single layer for arrays; sampling clamps the layer index
+        if (entry.target == GL_TEXTURE_2D_ARRAY)
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, 1, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+        else if (entry.target == GL_TEXTURE_CUBE_MAP)
+            for (int face = 0; face < 6; face++)
+                glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+        else
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+        glTexParameteri(entry.target, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(entry.target, GL_TEXTURE_MAX_LEVEL, 0);
+        applySampler(entry.target, entry.desc.sampler, GL_LINEAR);
+
+        entry.bytes = 4;
+        entry.baseLevel = entry.levels;
+    }
+
+    // takes a decoded chain: a fresh texture gets its tail uploaded, one
+    // that still has levels resident just keeps the pixels for refine()
+    void receive(Entry &entry, DecodedImage &image)
+    {
+        entry.rects = std::move(image.rects);
+        if (entry.target != GL_TEXTURE_2D)
+        {
+            receiveLayered(entry, image);
+            return;
+        }
+        bool sameChain = !entry.evicted && entry.baseLevel < entry.levels && entry.levels == (int)image.levels.size() &&
+                         entry.width == image.width && entry.height == image.height &&
+                         entry.channels == image.channels && entry.compressedFormat == image.compressedFormat;
+        entry.pixels = std::move(image.pixels);
+        if (sameChain)
+            return;
+
+        abortStreaming(entry);
+        glState.bindTexture(0, GL_TEXTURE_2D, entry.id);
+        int oldLevels = entry.levels;
+        entry.width = image.width;
+        entry.height = image.height;
+        entry.channels = image.channels;
+        entry.compressedFormat = image.compressedFormat;
+        entry.internalFormat = quality.use16Bit && !entry.compressedFormat && entry.channels == 3 ? GL_RGB565 : 0;
+        entry.chain = std::move(image.levels);
+        entry.levels = (int)entry.chain.size();
+        entry.dropLevels = image.dropLevels;
+        entry.evicted = false;
+        entry.bytes = 0;
+
+        int tail = entry.levels - 1;
+        while (tail > 0 && std::max(entry.chain[tail - 1].width, entry.chain[tail - 1].height) <= TAIL_SIZE)
+            tail--;
+        for (int level = entry.levels - 1; level >= tail; level--)
+            uploadLevel(entry, level);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, entry.levels - 1);
+        setBaseLevel(entry, tail);
+        // now out of range: the placeholder in level 0 and whatever an
+        // older chain left around the new one
+        for (int level = 0; level < tail; level++)
+            releaseLevel(GL_TEXTURE_2D, level);
+        for (int level = entry.levels; level < oldLevels; level++)
+            releaseLevel(GL_TEXTURE_2D, level);
+        applySampler(GL_TEXTURE_2D, entry.desc.sampler, finishChain(entry));
+        dropPixelsIfComplete(entry);
+    }
+
+    // arrays and cube maps skip streaming: every level of every layer goes
+    // up at once
+    void receiveLayered(Entry &entry, DecodedImage &image)
+    {
+        glState.bindTexture(0, entry.target, entry.id);
+        entry.width = image.width;
+        entry.height = image.height;
+        entry.channels = image.channels;
+        entry.layers = image.layers;
+        entry.chain = std::move(image.levels);
+        entry.levels = (int)entry.chain.size();
+        entry.evicted = false;
+        entry.bytes = 0;
+
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (int level = 0; level < entry.levels; level++)
+        {
+            const ImageLevel &info = entry.chain[level];
+            specifyLayeredLevel(entry, level, info.width, info.height, image.pixels.data() + info.offset);
+            entry.bytes += info.size;
+            frameStats.mipUploads++;
+            frameStats.mipUploadBytes += info.size;
+        }
+        glTexParameteri(entry.target, GL_TEXTURE_MAX_LEVEL, entry.levels - 1);
+        setBaseLevel(entry, 0);
+        applySampler(entry.target, entry.desc.sampler, finishChain(entry));
+    }
+
+    // min filter for a freshly received chain, generating mips on the GPU
+    // when the texture wants them but the decoder didn't build any
+    GLenum finishChain(Entry &entry)
+    {
+        const SamplerDesc &sampler = entry.desc.sampler;
+        if (entry.levels > 1 || !sampler.usesMipmaps())
+            return sampler.minFilter;
+        // compressed files without stored mips can't have them generated,
+        // fall back to a filter that doesn't need them
+        if (!entry.desc.gpuMipmaps || entry.compressedFormat)
+            return GL_LINEAR;
+        // opt-in: the driver builds the chain in one go, usually a box
+        // filter in gamma space
+        glTexParameteri(entry.target, GL_TEXTURE_MAX_LEVEL, 1000);
+        glGenerateMipmap(entry.target);
+        entry.bytes += entry.bytes / 3;
+        return sampler.minFilter;
+    }
+
+    // Streams the level below the resident ones for each texture that needs
+    // it through the upload ring, in bands of rows, within the per-frame
+    // budget. The level only becomes the base once all of its rows are in.
+    void refine()
+    {
+        if (!uploadRing.ready())
+            uploadRing.init(uploadBudget);
+        if (!uploadRing.beginFrame())
+        {
+            frameStats.uploadStalls++;
+            return;
+        }
+
+        for (auto &item : entries)
+        {
+            Entry &entry = item.second;
+            while (!entry.pixels.empty() && !entry.evicted && entry.baseLevel > entry.wantedLevel && streamBand(entry))
+                ;
+            if (uploadRing.remaining() == 0)
+                break;
+        }
+        uploadRing.endFrame();
+    }
+
+    // sends as many rows of the entry's next level as fit in the ring slot;
+    // false once the slot is full
+    bool streamBand(Entry &entry)
+    {
+        glState.bindTexture(0, GL_TEXTURE_2D, entry.id);
+        int level = entry.baseLevel - 1;
+        const ImageLevel &info = entry.chain[level];
+        if (entry.streamingLevel != level)
+        {
+            // storage first, the rows follow over one or more frames
+            uploadRing.unbind();
+            specifyLevel(GL_TEXTURE_2D, level, entry, info.width, info.height, info.size, nullptr);
+            entry.streamingLevel = level;
+            entry.streamedRows = 0;
+            entry.bytes += levelBytes(entry, level);
+        }
+
+        // rows of texels, or of blocks for compressed formats
+        int blockHeight = 1;
+        if (entry.compressedFormat)
+            blockHeight = findCompressedFormatByGL(entry.compressedFormat)->blockHeight;
+        int rows = (info.height + blockHeight - 1) / blockHeight;
+        size_t rowBytes = info.size / rows;
+        const unsigned char *data = entry.pixels.data() + info.offset + entry.streamedRows * rowBytes;
+        const void *pixels;
+        int band;
+        if (rowBytes > uploadRing.capacity())
+        {
+            // a row that can never fit in a slot goes straight from client
+            // memory, one per frame and only into an untouched slot, which it
+            // then uses up
+            if (uploadRing.remaining() < uploadRing.capacity())
+                return false;
+            band = 1;
+            uploadRing.unbind();
+            uploadRing.consume(rowBytes);
+            pixels = data;
+        }
+        else
+        {
+            band = std::min(rows - entry.streamedRows, (int)(uploadRing.remaining() / rowBytes));
+            if (band <= 0)
+                return false;
+            pixels = (const void *)uploadRing.stage(data, band * rowBytes);
+        }
+
+        size_t bytes = band * rowBytes;
+        int y = entry.streamedRows * blockHeight;
+        int height = std::min(band * blockHeight, info.height - y);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        if (entry.compressedFormat)
+            glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, y, info.width, height, entry.compressedFormat, (GLsizei)bytes,
+                                      pixels);
+        else
+            glTexSubImage2D(GL_TEXTURE_2D, level, 0, y, info.width, height, pixelFormats[entry.channels], GL_UNSIGNED_BYTE,
+                            pixels);
+        entry.streamedRows += band;
+        frameStats.mipUploadBytes += bytes;
+
+        if (entry.streamedRows == rows)
+        {
+            entry.streamingLevel = -1;
+            frameStats.mipUploads++;
+            setBaseLevel(entry, level);
+            dropPixelsIfComplete(entry);
+        }
+        return true;
+    }
+
+    void uploadLevel(Entry &entry, int level)
+    {
+        const ImageLevel &info = entry.chain[level];
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        specifyLevel(GL_TEXTURE_2D, level, entry, info.width, info.height, info.size, entry.pixels.data() + info.offset);
+        entry.bytes += levelBytes(entry, level);
+        frameStats.mipUploads++;
+        frameStats.mipUploadBytes += info.size;
+    }
+
+    // Levels above the base are never sampled. MIN_LOD is measured from the
+    // base level, so moving the base is all the clamping that's needed.
+    static void setBaseLevel(Entry &entry, int level)
+    {
+        entry.baseLevel = level;
+        glTexParameteri(entry.target, GL_TEXTURE_BASE_LEVEL, level);
+    }
+
+    static void dropPixelsIfComplete(Entry &entry)
+    {
+        if (entry.baseLevel == 0)
+            std::vector<unsigned char>().swap(entry.pixels);
+    }
+
+    // glTexImage2D or glCompressedTexImage2D in the entry's format. Null
+    // data only allocates (the web build still copies `size` bytes for
+    // compressed formats, WebGL has no way to allocate those empty).
+    static void specifyLevel(GLenum target, int level, const Entry &entry, int width, int height, size_t size, const unsigned char *data)
+    {
+        static const GLenum internalFormats[] = {0, GL_R8, GL_RG8, GL_RGB8, GL_RGBA8};
+        if (entry.compressedFormat)
+            glCompressedTexImage2D(target, level, entry.compressedFormat, width, height, 0, (GLsizei)size, data);
+        else
+            glTexImage2D(target, level, entry.internalFormat ? entry.internalFormat : internalFormats[entry.channels], width, height, 0,
+                         pixelFormats[entry.channels], GL_UNSIGNED_BYTE, data);
+    }
+
+    // frees a level's storage by making it 0x0. Always uncompressed, since
+    // WebGL2 rejects an empty compressed level; the level must already be
+    // outside BASE_LEVEL..MAX_LEVEL so the texture stays complete.
+    static void releaseLevel(GLenum target, int level)
+    {
+        glTexImage2D(target, level, GL_RGBA8, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    }
+
+    // vram a level takes, less than its decoded size for 16-bit formats
+    static size_t levelBytes(const Entry &entry, int level)
+    {
+        const ImageLevel &info = entry.chain[level];
+        if (entry.internalFormat == GL_RGB565)
+            return (size_t)info.width * info.height * 2;
+        return info.size;
+    }
+
+    // one level of every layer or face, laid out back to back in `data`;
+    // 0x0 releases the level
+    static void specifyLayeredLevel(const Entry &entry, int level, int width, int height, const unsigned char *data)
+    {
+        static const GLenum internalFormats[] = {0, GL_R8, GL_RG8, GL_RGB8, GL_RGBA8};
+        GLenum internalFormat = internalFormats[entry.channels], format = pixelFormats[entry.channels];
+        if (entry.target == GL_TEXTURE_2D_ARRAY)
+        {
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, level, internalFormat, width, height, width ? entry.layers : 0, 0, format, GL_UNSIGNED_BYTE, data);
+            return;
+        }
+        size_t faceBytes = (size_t)width * height * entry.channels;
+        for (int face = 0; face < 6; face++)
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, internalFormat, width, height, 0, format, GL_UNSIGNED_BYTE,
+                         data ? data + face * faceBytes : nullptr);
+    }
+
+    static void applySampler(GLenum target, const SamplerDesc &sampler, GLenum minFilter)
+    {
+        glTexParameteri(target, GL_TEXTURE_WRAP_S, sampler.wrapS);
+        glTexParameteri(target, GL_TEXTURE_WRAP_T, sampler.wrapT);
+        glTexParameteri(target, GL_TEXTURE_MIN_FILTER, minFilter);
+        glTexParameteri(target, GL_TEXTURE_MAG_FILTER, sampler.magFilter);
+    }
+
+    // releases a level that was only partly streamed in
+    void abortStreaming(Entry &entry)
+    {
+        if (entry.streamingLevel < 0)
+            return;
+        // it sits just above the base level, so it was never sampled
+        glState.bindTexture(0, GL_TEXTURE_2D, entry.id);
+        releaseLevel(GL_TEXTURE_2D, entry.streamingLevel);
+        entry.bytes -= levelBytes(entry, entry.streamingLevel);
+        entry.streamingLevel = -1;
+    }
+
+    // releases the largest resident level; the next touch that wants it
+    // back decodes the file again
+    void dropTopLevel(Entry &entry)
+    {
+        abortStreaming(entry);
+        int level = entry.baseLevel;
+        glState.bindTexture(0, GL_TEXTURE_2D, entry.id);
+        setBaseLevel(entry, level + 1);
+        releaseLevel(GL_TEXTURE_2D, level);
+        entry.bytes -= levelBytes(entry, level);
+    }
+
+    // disk-backed state: the GL name survives as a 1x1 placeholder and the
+    // image is decoded again the next time the texture is touched
+    void evict(Entry &entry)
+    {
+        abortStreaming(entry);
+        int baseLevel = entry.baseLevel;
+        // the placeholder replaces level 0 and narrows the sampled range to
+        // it first, so the rest can go without leaving the texture incomplete
+        showPlaceholder(entry);
+        for (int level = std::max(baseLevel, 1); level < entry.levels; level++)
+        {
+            if (entry.target != GL_TEXTURE_2D)
+                specifyLayeredLevel(entry, level, 0, 0, nullptr);
+            else
+                releaseLevel(GL_TEXTURE_2D, level);
+        }
+        std::vector<unsigned char>().swap(entry.pixels);
+        entry.evicted = true;
+    }
+
+    bool canShrink(const Entry &entry) const
+    {
+        if (entry.evicted || entry.target != GL_TEXTURE_2D || entry.baseLevel + 1 >= entry.levels)
+            return false;
+        const ImageLevel &next = entry.chain[entry.baseLevel + 1];
+        return std::max(next.width, next.height) >= MIN_RESIDENT_SIZE;
+    }
+
+    void enforceBudget()
+    {
+        size_t total = residentBytes();
+        if (total <= budgetBytes)
+            return;
+
+        // first trim mips finer than their draws asked for (distant objects),
+        // even on visible textures
+        for (auto &item : entries)
+        {
+            Entry &entry = item.second;
+            while (total > budgetBytes && entry.baseLevel < entry.wantedLevel && canShrink(entry))
+            {
+                size_t before = entry.bytes;
+                dropTopLevel(entry);
+                total -= before - entry.bytes;
+            }
+        }
+
+        std::vector<Entry *> candidates;
+        for (auto &item : entries)
+            if (!item.second.evicted && item.second.lastVisibleFrame < frame)
+                candidates.push_back(&item.second);
+        std::sort(candidates.begin(), candidates.end(), [](const Entry *a, const Entry *b)
+                  { return a->lastVisibleFrame < b->lastVisibleFrame; });
+
+        // then shrink the stalest textures down to MIN_RESIDENT_SIZE, then
+        // evict them outright
+        for (int pass = 0; pass < 2 && total > budgetBytes; pass++)
+        {
+            for (Entry *entry : candidates)
+            {
+                if (total <= budgetBytes)
+                    break;
+                if (entry->evicted)
+                    continue;
+                size_t before = entry->bytes;
+                if (pass == 0)
+                {
+                    while (total - before + entry->bytes > budgetBytes && canShrink(*entry))
+                        dropTopLevel(*entry);
+                }
+                else
+                {
+                    evict(*entry);
+                    // a pending decode would bring it back, drop it
+                    entry->loading = false;
+                    entry->generation++;
+                }
+                total = total - before + entry->bytes;
+            }
+        }
+    }
+
+    static std::string formatName(const Entry &entry)
+    {
+        if (entry.compressedFormat)
+        {
+            const CompressedFormatInfo *format = findCompressedFormatByGL(entry.compressedFormat);
+            return format ? format->name : "compressed";
+        }
+        static const char *names[] = {"?", "r8", "rg8", "rgb8", "rgba8"};
+        if (entry.internalFormat == GL_RGB565)
+            return "rgb565";
+        if (entry.target == GL_TEXTURE_2D_ARRAY)
+            return std::string(names[entry.channels]) + " x" + std::to_string(entry.layers);
+        if (entry.target == GL_TEXTURE_CUBE_MAP)
+            return std::string(names[entry.channels]) + " cube";
+        return names[entry.channels];
+    }
+};
+
+// Never destroyed: handles held in globals may be released after main returns.
+inline TextureManager &textureManager()
+{
+    static TextureManager *instance = new TextureManager();
+    return *instance;
+}
+
+inline TextureHandle::TextureHandle(const TextureHandle &other) : slot(other.slot)
+{
+    if (slot)
+        textureManager().addRef(slot);
+}
+
+inline GLuint TextureHandle::id() const
+{
+    return slot ? textureManager().idOf(slot) : 0;
+}
+
+inline GLenum TextureHandle::target() const
+{
+    return slot ? textureManager().targetOf(slot) : GL_TEXTURE_2D;
+}
+
+inline void TextureHandle::reset()
+{
+    if (slot)
+        textureManager().release(slot);
+    slot = 0;
+}
+#endif
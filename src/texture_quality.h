@@ -0,0 +1,130 @@
+#ifndef TEXTURE_QUALITY_H
+#define TEXTURE_QUALITY_H
+
+#ifdef __EMSCRIPTEN__
+#include <GLES3/gl3.h>
+#include <emscripten.h>
+#else
+#include <glad/glad.h>
+#endif
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+enum TextureTier
+{
+    TEXTURE_TIER_LOW = 0,
+    TEXTURE_TIER_MEDIUM,
+    TEXTURE_TIER_HIGH
+};
+
+// Texture settings for one class of device, picked once at startup. The same
+// res/ files are served everywhere; lower tiers cap their resolution on the
+// decode workers and store opaque colour maps in 16 bits.
+struct TextureQuality
+{
+    TextureTier tier = TEXTURE_TIER_HIGH;
+    // longest edge after decoding; larger images are downscaled with the
+    // mip filter (KTX2 files skip their top levels instead)
+    int maxSize = 0;
+    // opaque RGB textures are stored as RGB565, half the memory of RGB8
+    bool use16Bit = false;
+    size_t budgetBytes = 0;
+    // virtual texture cache edge, in pages
+    int vtCacheSide = 16;
+
+    // what the decision was based on, for the log
+    int glMaxTextureSize = 0;
+    int memoryMB = 0;
+    const char *memorySource = "unknown";
+    const char *reason = "";
+
+    // `setting` is "low", "medium" or "high" to override the detection
+    // (SOLAR_TEXTURE_QUALITY); budgetBytes is the most the caller allows
+    static TextureQuality choose(size_t budgetBytes, const char *setting = nullptr)
+    {
+        TextureQuality quality;
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &quality.glMaxTextureSize);
+        queryMemory(quality);
+
+        TextureTier tier = TEXTURE_TIER_HIGH;
+        quality.reason = "detected";
+        if (setting && parseTier(setting, tier))
+            quality.reason = "SOLAR_TEXTURE_QUALITY";
+        else if (quality.glMaxTextureSize < 4096 || (quality.memoryMB > 0 && quality.memoryMB <= 2048))
+            tier = TEXTURE_TIER_LOW;
+        else if (quality.glMaxTextureSize < 8192 || (quality.memoryMB > 0 && quality.memoryMB < 4096))
+            tier = TEXTURE_TIER_MEDIUM;
+
+        static const int maxSizes[] = {1024, 2048, 0};
+        static const size_t budgetsMB[] = {64, 128, 0};
+        static const int vtCacheSides[] = {8, 12, 16};
+        quality.tier = tier;
+        quality.maxSize = maxSizes[tier];
+        // nothing can be bigger than the GL limit anyway
+        if (quality.maxSize == 0 || quality.maxSize > quality.glMaxTextureSize)
+            quality.maxSize = quality.glMaxTextureSize;
+        quality.use16Bit = tier == TEXTURE_TIER_LOW;
+        quality.budgetBytes = budgetsMB[tier] ? std::min(budgetBytes, budgetsMB[tier] * 1024u * 1024u) : budgetBytes;
+        quality.vtCacheSide = vtCacheSides[tier];
+        return quality;
+    }
+
+    static const char *tierName(TextureTier tier)
+    {
+        static const char *names[] = {"low", "medium", "high"};
+        return names[tier];
+    }
+
+    void log(std::ostream &out = std::cout) const
+    {
+        out << "[TEXTURES] quality " << tierName(tier) << " (" << reason << "; GL_MAX_TEXTURE_SIZE " << glMaxTextureSize << ", ";
+        if (memoryMB > 0)
+            out << memoryMB << " MB " << memorySource;
+        else
+            out << "memory unknown";
+        out << "): textures up to " << maxSize << " px, " << (use16Bit ? "16-bit" : "8-bit") << " colour, "
+            << budgetBytes / (1024 * 1024) << " MB budget, " << vtCacheSide << "x" << vtCacheSide << " vt cache pages" << std::endl;
+    }
+
+private:
+    static bool parseTier(const char *setting, TextureTier &tier)
+    {
+        for (int i = TEXTURE_TIER_LOW; i <= TEXTURE_TIER_HIGH; i++)
+            if (strcmp(setting, tierName((TextureTier)i)) == 0)
+            {
+                tier = (TextureTier)i;
+                return true;
+            }
+        std::cout << "[TEXTURES] unknown quality '" << setting << "', expected low, medium or high" << std::endl;
+        return false;
+    }
+
+    // Browsers report rounded system memory; desktop drivers only expose
+    // video memory through vendor extensions, NVIDIA's being the common one.
+    static void queryMemory(TextureQuality &quality)
+    {
+#ifdef __EMSCRIPTEN__
+        quality.memoryMB = emscripten_run_script_int("(navigator.deviceMemory || 0) * 1024");
+        quality.memorySource = "device memory";
+#else
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (GLint i = 0; i < count; i++)
+        {
+            const char *ext = (const char *)glGetStringi(GL_EXTENSIONS, i);
+            if (ext && strcmp(ext, "GL_NVX_gpu_memory_info") == 0)
+            {
+                // GL_GPU_MEMORY_INFO_DEDICATED_VIDMEM_NVX, in KB
+                GLint kb = 0;
+                glGetIntegerv(0x9047, &kb);
+                quality.memoryMB = kb / 1024;
+                quality.memorySource = "video memory";
+            }
+        }
+#endif
+    }
+};
+#endif
@@ -0,0 +1,148 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Web builds without -pthread have no threads at all; the pool then runs
+// every task inline on the calling thread.
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+#define THREAD_POOL_INLINE 1
+#else
+#define THREAD_POOL_INLINE 0
+#endif
+
+// Fixed set of worker threads pulling tasks from a shared queue.
+class ThreadPool
+{
+public:
+    ThreadPool() {}
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+    ~ThreadPool() { stop(); }
+
+    // a sensible default: leave one core for the render thread
+    static int defaultThreadCount()
+    {
+        int cores = (int)std::thread::hardware_concurrency();
+        return cores > 1 ? cores - 1 : 1;
+    }
+
+    void start(int threads)
+    {
+        stop();
+        stopping = false;
+#if !THREAD_POOL_INLINE
+        for (int i = 0; i < threads; i++)
+            workers.emplace_back([this]
+                                 { run(); });
+#else
+        (void)threads;
+#endif
+    }
+
+    // joins the workers and drops the tasks none of them got to; returns
+    // how many were dropped so callers counting submissions can settle up
+    size_t stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread &worker : workers)
+            worker.join();
+        workers.clear();
+        size_t dropped = tasks.size();
+        tasks.clear();
+        return dropped;
+    }
+
+    void submit(std::function<void()> task)
+    {
+        if (workers.empty())
+        {
+            task();
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(std::move(task));
+        }
+        wake.notify_one();
+    }
+
+    // runs fn(begin, end) over [0, count) in chunks of `grain`, the calling
+    // thread taking a share, and returns once every chunk is done
+    template <typename Fn>
+    void parallelFor(size_t count, size_t grain, Fn &&fn)
+    {
+        size_t chunks = (count + grain - 1) / grain;
+        if (workers.empty() || chunks < 2)
+        {
+            if (count > 0)
+                fn((size_t)0, count);
+            return;
+        }
+        // shared, so a helper that only starts after the last chunk finds
+        // nothing left instead of a dead stack frame
+        struct Progress
+        {
+            std::atomic<size_t> next{0}, done{0};
+        };
+        auto progress = std::make_shared<Progress>();
+        auto work = [progress, chunks, grain, count, &fn]
+        {
+            size_t chunk;
+            while ((chunk = progress->next++) < chunks)
+            {
+                size_t begin = chunk * grain;
+                fn(begin, begin + grain < count ? begin + grain : count);
+                progress->done++;
+            }
+        };
+        size_t helpers = chunks - 1 < workers.size() ? chunks - 1 : workers.size();
+        for (size_t i = 0; i < helpers; i++)
+            submit(work);
+        work();
+        while (progress->done.load() < chunks)
+            std::this_thread::yield();
+    }
+
+    int threadCount() const
+    {
+        return (int)workers.size();
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    void run()
+    {
+        while (true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this]
+                          { return stopping || !tasks.empty(); });
+                if (stopping)
+                    return;
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+};
+#endif
@@ -0,0 +1,259 @@
+#ifndef TRANSFORM_BATCH_H
+#define TRANSFORM_BATCH_H
+
+#ifdef __EMSCRIPTEN__
+#include <GLES3/gl3.h>
+#else
+#include <glad/glad.h>
+#endif
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define TRANSFORM_BATCH_SSE
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#define TRANSFORM_BATCH_WASM_SIMD
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "frame_stats.h"
+#include "gl_state.h"
+
+// Uniform block binding point shared by every shader that declares ObjectBlock
+const unsigned int OBJECT_BLOCK_BINDING = 0;
+
+// Mirrors `layout (std140) uniform ObjectBlock` in the shaders.
+struct ObjectUniforms
+{
+    glm::mat4 mvp;
+    glm::mat4 model;
+    // upper 3x3 holds the normal matrix, padded to a mat4 for std140
+    glm::mat4 normalMatrix;
+};
+
+// Computes MVP and normal matrices for every object once per frame on the cpu
+// and hands them to the shaders through a single uniform buffer, so vertex
+// shaders no longer multiply or invert matrices per vertex.
+class TransformBatch
+{
+public:
+    std::vector<glm::mat4> models;
+
+    TransformBatch()
+    {
+        GLint alignment = 256;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        stride = ((GLint)sizeof(ObjectUniforms) + alignment - 1) / alignment * alignment;
+        glGenBuffers(1, &UBO);
+    }
+
+    // registers an object and returns the slot used by bind()
+    unsigned int add(const glm::mat4 &model)
+    {
+        models.push_back(model);
+        return static_cast<unsigned int>(models.size() - 1);
+    }
+
+    void set(unsigned int slot, const glm::mat4 &model)
+    {
+        models[slot] = model;
+    }
+
+    void clear()
+    {
+        models.clear();
+    }
+
+    // batch pass over all objects: mvp = projection * view * model and the
+    // cofactor normal matrix, written straight into the std140 staging buffer
+    void compute(const glm::mat4 &view, const glm::mat4 &projection)
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        size_t count = models.size();
+        staging.resize(count * stride);
+        computeBatch(projection * view, models, staging.data(), stride);
+
+        frameStats.objectsTransformed = static_cast<unsigned int>(count);
+        frameStats.transformMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void upload()
+    {
+        glState.bindBuffer(GL_UNIFORM_BUFFER, UBO);
+        if (staging.size() > capacity)
+        {
+            capacity = staging.size();
+            glBufferData(GL_UNIFORM_BUFFER, capacity, staging.data(), GL_DYNAMIC_DRAW);
+        }
+        else if (!staging.empty())
+        {
+            glBufferSubData(GL_UNIFORM_BUFFER, 0, staging.size(), staging.data());
+        }
+    }
+
+    // points ObjectBlock at the given object's matrices
+    void bind(unsigned int slot) const
+    {
+        glState.bindUniformRange(OBJECT_BLOCK_BINDING, UBO, slot * stride, sizeof(ObjectUniforms));
+    }
+
+    // Times the batch against the per-object path it replaced: glm's
+    // projection * view * model and mat3(transpose(inverse(model))) for each
+    // object, what the shaders used to redo per vertex. Dense sets of 1K to
+    // 100K rotated, unevenly scaled objects; cpu only, no GL needed.
+    static void benchmark(std::ostream &out = std::cout)
+    {
+        const int repeats = 20;
+        out << "[TRANSFORMS] kernels: " << simdName() << std::endl;
+        glm::mat4 projection(0.0f);
+        {
+            float f = 1.0f / std::tan(glm::radians(22.5f)), near = 0.1f, far = 100.0f;
+            projection[0][0] = f / (4.0f / 3.0f);
+            projection[1][1] = f;
+            projection[2][2] = (far + near) / (near - far);
+            projection[2][3] = -1.0f;
+            projection[3][2] = 2.0f * far * near / (near - far);
+        }
+        glm::mat4 view(1.0f);
+        view[3] = glm::vec4(0.0f, -3.0f, -12.0f, 1.0f);
+
+        for (int count : {1000, 10000, 100000})
+        {
+            std::mt19937 rng(5);
+            std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+            std::vector<glm::mat4> models(count);
+            for (glm::mat4 &model : models)
+            {
+                glm::vec3 axis = glm::normalize(glm::vec3(uniform(rng), uniform(rng), uniform(rng)) + glm::vec3(0.001f));
+                glm::vec3 scale = glm::vec3(1.5f) + glm::vec3(uniform(rng), uniform(rng), uniform(rng));
+                glm::vec3 position(10.0f * uniform(rng), uniform(rng), 10.0f * uniform(rng));
+                model = glm::translate(glm::mat4(1.0f), position) * glm::rotate(glm::mat4(1.0f), 3.0f * uniform(rng), axis) *
+                        glm::scale(glm::mat4(1.0f), scale);
+            }
+            std::vector<unsigned char> batched(count * sizeof(ObjectUniforms));
+            std::vector<ObjectUniforms> perObject(count);
+
+            auto time = [&](auto &&work)
+            {
+                work();
+                auto start = std::chrono::steady_clock::now();
+                for (int i = 0; i < repeats; i++)
+                    work();
+                return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count() / repeats;
+            };
+            float perObjectMs = time([&]
+                                     {
+                for (int i = 0; i < count; i++)
+                {
+                    perObject[i].mvp = projection * view * models[i];
+                    perObject[i].model = models[i];
+                    perObject[i].normalMatrix = glm::mat4(glm::mat3(glm::transpose(glm::inverse(models[i]))));
+                } });
+            float batchedMs = time([&]
+                                   { computeBatch(projection * view, models, batched.data(), sizeof(ObjectUniforms)); });
+
+            // both sides must agree, normals up to the scale the cofactor skips
+            float mvpError = 0.0f, normalError = 0.0f;
+            for (int i = 0; i < count; i++)
+            {
+                const ObjectUniforms &b = reinterpret_cast<const ObjectUniforms *>(batched.data())[i];
+                for (int c = 0; c < 4; c++)
+                    mvpError = std::max(mvpError, glm::length(b.mvp[c] - perObject[i].mvp[c]));
+                for (int c = 0; c < 3; c++)
+                    normalError = std::max(normalError, glm::length(glm::normalize(glm::vec3(b.normalMatrix[c])) -
+                                                                    glm::normalize(glm::vec3(perObject[i].normalMatrix[c]))));
+            }
+            out << "[TRANSFORMS] " << count << " objects: per object " << perObjectMs << " ms, batched " << batchedMs << " ms, "
+                << perObjectMs / batchedMs << "x (max error mvp " << mvpError << ", normals " << normalError << ")" << std::endl;
+        }
+    }
+
+private:
+    GLuint UBO = 0;
+    GLint stride = 0;
+    size_t capacity = 0;
+    std::vector<unsigned char> staging;
+
+    // one ObjectUniforms per model, `stride` bytes apart
+    static void computeBatch(const glm::mat4 &viewProjection, const std::vector<glm::mat4> &models, unsigned char *staging, size_t stride)
+    {
+        for (size_t i = 0; i < models.size(); i++)
+        {
+            ObjectUniforms *out = reinterpret_cast<ObjectUniforms *>(&staging[i * stride]);
+            mulMat4(viewProjection, models[i], out->mvp);
+            out->model = models[i];
+            out->normalMatrix = normalMatrix(models[i]);
+        }
+    }
+
+    static const char *simdName()
+    {
+#if defined(TRANSFORM_BATCH_SSE)
+        return "sse";
+#elif defined(TRANSFORM_BATCH_WASM_SIMD)
+        return "wasm simd128";
+#else
+        return "scalar";
+#endif
+    }
+
+    // out = a * b, column by column: out[c] = sum_k a[k] * b[c][k]
+    static void mulMat4(const glm::mat4 &a, const glm::mat4 &b, glm::mat4 &out)
+    {
+        const float *pa = glm::value_ptr(a);
+        const float *pb = glm::value_ptr(b);
+        float *po = glm::value_ptr(out);
+#if defined(TRANSFORM_BATCH_SSE)
+        __m128 a0 = _mm_loadu_ps(pa), a1 = _mm_loadu_ps(pa + 4), a2 = _mm_loadu_ps(pa + 8), a3 = _mm_loadu_ps(pa + 12);
+        for (int c = 0; c < 4; c++)
+        {
+            __m128 r = _mm_mul_ps(a0, _mm_set1_ps(pb[c * 4 + 0]));
+            r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_set1_ps(pb[c * 4 + 1])));
+            r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_set1_ps(pb[c * 4 + 2])));
+            r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_set1_ps(pb[c * 4 + 3])));
+            _mm_storeu_ps(po + c * 4, r);
+        }
+#elif defined(TRANSFORM_BATCH_WASM_SIMD)
+        v128_t a0 = wasm_v128_load(pa), a1 = wasm_v128_load(pa + 4), a2 = wasm_v128_load(pa + 8), a3 = wasm_v128_load(pa + 12);
+        for (int c = 0; c < 4; c++)
+        {
+            v128_t r = wasm_f32x4_mul(a0, wasm_f32x4_splat(pb[c * 4 + 0]));
+            r = wasm_f32x4_add(r, wasm_f32x4_mul(a1, wasm_f32x4_splat(pb[c * 4 + 1])));
+            r = wasm_f32x4_add(r, wasm_f32x4_mul(a2, wasm_f32x4_splat(pb[c * 4 + 2])));
+            r = wasm_f32x4_add(r, wasm_f32x4_mul(a3, wasm_f32x4_splat(pb[c * 4 + 3])));
+            wasm_v128_store(po + c * 4, r);
+        }
+#else
+        out = a * b;
+#endif
+    }
+
+    // inverse-transpose of the upper 3x3 up to a positive scale: the cofactor
+    // matrix. Shaders normalize the result, so the division by det is skipped.
+    static glm::mat4 normalMatrix(const glm::mat4 &m)
+    {
+        glm::vec3 c0(m[0]), c1(m[1]), c2(m[2]);
+        glm::vec3 r0 = glm::cross(c1, c2);
+        glm::vec3 r1 = glm::cross(c2, c0);
+        glm::vec3 r2 = glm::cross(c0, c1);
+        // mirrored transforms would flip the normals otherwise
+        float sign = glm::dot(c0, r0) < 0.0f ? -1.0f : 1.0f;
+        glm::mat4 n(1.0f);
+        n[0] = glm::vec4(r0 * sign, 0.0f);
+        n[1] = glm::vec4(r1 * sign, 0.0f);
+        n[2] = glm::vec4(r2 * sign, 0.0f);
+        return n;
+    }
+};
+#endif
@@ -0,0 +1,146 @@
+#ifndef UPLOAD_RING_H
+#define UPLOAD_RING_H
+
+#ifdef __EMSCRIPTEN__
+#include <GLES3/gl3.h>
+#else
+#include <glad/glad.h>
+#endif
+#include <cstring>
+#include <vector>
+
+#include "gl_state.h"
+
+// Ring of pixel unpack buffers for streaming texture data. Each frame stages
+// at most one slot's worth of bytes; a fence guards the slot until the GPU
+// has consumed it, and a frame whose slot is still in flight skips its
+// uploads instead of stalling. Texture uploads issued between stage() and
+// unbind() read from the bound buffer, so pass offsets, not pointers.
+class UploadRing
+{
+public:
+    static const int SLOTS = 3;
+
+    ~UploadRing() { destroy(); }
+
+    // bytesPerFrame is the per-frame upload budget and the size of a slot
+    void init(size_t bytesPerFrame)
+    {
+        destroy();
+        slotBytes = bytesPerFrame;
+        glGenBuffers(SLOTS, buffers);
+        for (int i = 0; i < SLOTS; i++)
+        {
+            glState.bindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[i]);
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr)slotBytes, nullptr, GL_STREAM_DRAW);
+            fences[i] = 0;
+        }
+        glState.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        current = 0;
+        used = 0;
+    }
+
+    void destroy()
+    {
+        if (!buffers[0])
+            return;
+        for (int i = 0; i < SLOTS; i++)
+            if (fences[i])
+                glDeleteSync(fences[i]);
+        for (int i = 0; i < SLOTS; i++)
+            glState.forgetBuffer(buffers[i]);
+        glDeleteBuffers(SLOTS, buffers);
+        buffers[0] = 0;
+    }
+
+    bool ready() const
+    {
+        return buffers[0] != 0;
+    }
+
+    size_t capacity() const
+    {
+        return slotBytes;
+    }
+
+    // moves to the next slot; false while the GPU is still reading it
+    bool beginFrame()
+    {
+        current = (current + 1) % SLOTS;
+        used = 0;
+        if (!fences[current])
+            return true;
+        GLenum status = glClientWaitSync(fences[current], 0, 0);
+        if (status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED)
+        {
+            used = slotBytes;
+            return false;
+        }
+        glDeleteSync(fences[current]);
+        fences[current] = 0;
+        return true;
+    }
+
+    size_t remaining() const
+    {
+        return slotBytes - used;
+    }
+
+    // copies bytes into the current slot and leaves it bound; returns the
+    // offset to pass as the pixel pointer
+    size_t stage(const void *data, size_t size)
+    {
+        size_t offset = used;
+        glState.bindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[current]);
+#ifdef __EMSCRIPTEN__
+        // WebGL2 can't map buffers
+        glBufferSubData(GL_PIXEL_UNPACK_BUFFER, (GLintptr)offset, (GLsizeiptr)size, data);
+#else
+        // the fence already guarantees the GPU is done with this slot
+        void *mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, (GLintptr)offset, (GLsizeiptr)size,
+                                        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        if (mapped)
+        {
+            memcpy(mapped, data, size);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        }
+        else
+        {
+            // mapping is allowed to fail; copy the slow way instead
+            glBufferSubData(GL_PIXEL_UNPACK_BUFFER, (GLintptr)offset, (GLsizeiptr)size, data);
+        }
+#endif
+        // keep the next band 4-byte aligned for the unpack alignment rules
+        used += (size + 3) & ~(size_t)3;
+        if (used > slotBytes)
+            used = slotBytes;
+        return offset;
+    }
+
+    // counts bytes sent without the ring against this frame's budget
+    void consume(size_t size)
+    {
+        used = size < remaining() ? used + size : slotBytes;
+    }
+
+    void unbind()
+    {
+        glState.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    // fences the slot if anything was staged into it this frame
+    void endFrame()
+    {
+        unbind();
+        if (used > 0 && !fences[current])
+            fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+private:
+    GLuint buffers[SLOTS] = {};
+    GLsync fences[SLOTS] = {};
+    size_t slotBytes = 0;
+    size_t used = 0;
+    int current = 0;
+};
+#endif
@@ -0,0 +1,484 @@
+#ifndef VIRTUAL_TEXTURE_H
+#define VIRTUAL_TEXTURE_H
+
+#ifdef __EMSCRIPTEN__
+#include <GLES3/gl3.h>
+#else
+#include <glad/glad.h>
+#endif
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "frame_stats.h"
+#include "gl_state.h"
+#include "lockfree_queue.h"
+#include "page_file.h"
+#include "shader.h"
+#include "thread_pool.h"
+
+// Samples an image far larger than fits in GPU memory (a 16K-64K planet map)
+// out of a fixed size page cache. Each frame:
+//
+//   1. a feedback pass renders the geometry at 1/FEEDBACK_SCALE resolution,
+//      writing the page and level every pixel wants; it is read back a frame
+//      later through a PBO (synchronously on WebGL, which can't map buffers)
+//   2. update() turns the readback into page requests, coarse levels first,
+//      and page workers read and decode them from the PageFile
+//   3. up to the page budget of decoded pages are copied into free or least
+//      recently used slots of the cache texture
+//   4. the indirection texture, one texel per page and one mip per level,
+//      is rebuilt so every page points at its finest resident ancestor
+//
+// Shaders sample with vtSample() (see planet_vt.fs), which looks up the
+// indirection and reads the cache; missing pages fall back to coarser levels.
+// The last level is a single page that is loaded at open() and never evicted.
+class VirtualTexture
+{
+public:
+    static const int FEEDBACK_SCALE = 8;
+    // decodes queued at once; the rest are requested again next frame
+    static const int MAX_PENDING = 32;
+
+    VirtualTexture() : decoded(64) {}
+    ~VirtualTexture() { shutdown(); }
+
+    // cacheSide x cacheSide pages of cache
+    bool open(const std::string &path, int cacheSide = 16)
+    {
+        std::string error;
+        if (!file.open(path, error))
+        {
+            std::cout << "[VT] " << error << std::endl;
+            return false;
+        }
+        pool.start(1);
+        side = cacheSide;
+        slots.assign(side * side, Slot());
+
+        int cachePixels = side * file.slotSize();
+        glGenTextures(1, &cache);
+        glState.bindTexture(0, GL_TEXTURE_2D, cache);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, cachePixels, cachePixels, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        // read with texelFetch, so the filters only need to be complete
+        glGenTextures(1, &indirection);
+        glState.bindTexture(0, GL_TEXTURE_2D, indirection);
+        table.resize(file.levels());
+        for (int level = 0; level < file.levels(); level++)
+        {
+            table[level].assign(file.pagesX(level) * file.pagesY(level), 0);
+            glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, file.pagesX(level), file.pagesY(level), 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, file.levels() - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        // the fallback every lookup ends at
+        int top = file.levels() - 1;
+        for (int y = 0; y < file.pagesY(top); y++)
+            for (int x = 0; x < file.pagesX(top); x++)
+            {
+                std::vector<unsigned char> pixels;
+                if (!file.readPage(top, x, y, pixels, error))
+                {
+                    std::cout << "[VT] " << error << std::endl;
+                    shutdown();
+                    return false;
+                }
+                int slot = upload(pageKey(top, x, y), pixels);
+                slots[slot].pinned = true;
+            }
+        rebuildIndirection();
+        std::cout << "[VT] " << path << ": " << file.width() << "x" << file.height() << ", " << file.levels() << " levels, "
+                  << side * side << " cache pages of " << file.pageSize() << " (" << cachePixels << "x" << cachePixels << ")" << std::endl;
+        return true;
+    }
+
+    bool ready() const
+    {
+        return cache != 0;
+    }
+
+    // pages uploaded per frame at most
+    void setPageBudget(int pages)
+    {
+        pageBudget = pages;
+    }
+
+    // binds the cache and indirection and sets the vt* uniforms; the shader
+    // must be in use. `feedback` switches it to writing page ids.
+    void bind(const Shader &shader, GLuint cacheUnit, GLuint indirectionUnit, bool feedback) const
+    {
+        glState.bindTexture(cacheUnit, GL_TEXTURE_2D, cache);
+        glState.bindTexture(indirectionUnit, GL_TEXTURE_2D, indirection);
+        shader.setInt("vtCache", cacheUnit);
+        shader.setInt("vtIndirection", indirectionUnit);
+        shader.setVec2("vtVirtualSize", (float)file.width(), (float)file.height());
+        shader.setFloat("vtPageSize", (float)file.pageSize());
+        shader.setFloat("vtBorder", (float)file.border());
+        shader.setFloat("vtCacheSize", (float)(side * file.slotSize()));
+        shader.setFloat("vtMaxLevel", (float)(file.levels() - 1));
+        // the feedback target is smaller, so its derivatives are larger
+        shader.setFloat("vtLodBias", feedback ? -std::log2((float)FEEDBACK_SCALE) : 0.0f);
+        shader.setBool("vtFeedback", feedback);
+    }
+
+    // redirects drawing to the feedback target; draw the geometry that uses
+    // this texture with bind(..., true), then call endFeedback()
+    void beginFeedback(int screenWidth, int screenHeight)
+    {
+        int width = std::max(1, screenWidth / FEEDBACK_SCALE), height = std::max(1, screenHeight / FEEDBACK_SCALE);
+        if (width != feedbackWidth || height != feedbackHeight)
+            createFeedbackTarget(width, height);
+        if (!glState.currentViewport(savedViewport))
+            glGetIntegerv(GL_VIEWPORT, savedViewport);
+        glGetFloatv(GL_COLOR_CLEAR_VALUE, savedClear);
+        glState.bindFramebuffer(feedbackFramebuffer);
+        glState.viewport(0, 0, feedbackWidth, feedbackHeight);
+        // alpha 0 marks pixels without virtual texture
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
+
+    void endFeedback()
+    {
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+#ifdef __EMSCRIPTEN__
+        feedback.resize((size_t)feedbackWidth * feedbackHeight * 4);
+        glReadPixels(0, 0, feedbackWidth, feedbackHeight, GL_RGBA, GL_UNSIGNED_BYTE, feedback.data());
+        feedbackReady = true;
+#else
+        // the copy finishes in the background; update() maps it once fenced
+        if (!readbackFence)
+        {
+            glState.bindBuffer(GL_PIXEL_PACK_BUFFER, readback);
+            glReadPixels(0, 0, feedbackWidth, feedbackHeight, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+            glState.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            readbackFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        }
+#endif
+        glState.bindFramebuffer(0);
+        glState.viewport(savedViewport[0], savedViewport[1], savedViewport[2], savedViewport[3]);
+        glClearColor(savedClear[0], savedClear[1], savedClear[2], savedClear[3]);
+    }
+
+    // call once a frame on the GL thread: requests what the last feedback
+    // asked for and uploads decoded pages within the budget
+    void update()
+    {
+        if (!ready())
+            return;
+        frame++;
+        collectFeedback();
+
+        int uploads = 0;
+        PageData page;
+        while (uploads < pageBudget && decoded.pop(page))
+        {
+            pending.erase(page.key);
+            if (!page.ok)
+            {
+                std::cout << "[VT] " << page.error << std::endl;
+                continue;
+            }
+            if (upload(page.key, page.pixels) < 0)
+                continue; // every slot is in use this frame, asked for again later
+            uploads++;
+        }
+        if (dirty)
+            rebuildIndirection();
+
+        frameStats.vtPageUploads += uploads;
+        frameStats.vtResidentPages = (unsigned int)resident.size();
+        frameStats.vtCachePages = (unsigned int)slots.size();
+    }
+
+    void shutdown()
+    {
+        pool.stop();
+        PageData page;
+        while (decoded.pop(page))
+            ;
+        pending.clear();
+        if (!cache)
+            return;
+        glState.forgetTexture(cache);
+        glState.forgetTexture(indirection);
+        glDeleteTextures(1, &cache);
+        glDeleteTextures(1, &indirection);
+        cache = indirection = 0;
+        destroyFeedbackTarget();
+        resident.clear();
+    }
+
+private:
+    struct Slot
+    {
+        uint32_t key = 0;
+        bool used = false;
+        bool pinned = false;
+        uint64_t lastUsedFrame = 0;
+    };
+
+    struct PageData
+    {
+        uint32_t key = 0;
+        bool ok = false;
+        std::vector<unsigned char> pixels;
+        std::string error;
+    };
+
+    PageFile file;
+    int side = 0;
+    GLuint cache = 0;
+    GLuint indirection = 0;
+    std::vector<Slot> slots;
+    // page key -> cache slot
+    std::unordered_map<uint32_t, int> resident;
+    std::unordered_set<uint32_t> pending;
+    // per level, RGBA8 texels: cache slot x, y, resident level, 255
+    std::vector<std::vector<uint32_t>> table;
+    bool dirty = false;
+    int pageBudget = 8;
+    uint64_t frame = 0;
+
+    ThreadPool pool;
+    LockFreeQueue<PageData> decoded;
+
+    GLuint feedbackFramebuffer = 0;
+    GLuint feedbackColor = 0;
+    GLuint feedbackDepth = 0;
+    GLuint readback = 0;
+    GLsync readbackFence = 0;
+    int feedbackWidth = 0;
+    int feedbackHeight = 0;
+    std::vector<unsigned char> feedback;
+    bool feedbackReady = false;
+    GLint savedViewport[4] = {};
+    GLfloat savedClear[4] = {};
+
+    // 4 bits of level, 14 of y, 14 of x
+    static uint32_t pageKey(int level, int x, int y)
+    {
+        return (uint32_t)level << 28 | (uint32_t)y << 14 | (uint32_t)x;
+    }
+
+    static int keyLevel(uint32_t key) { return (int)(key >> 28); }
+    static int keyY(uint32_t key) { return (int)((key >> 14) & 0x3FFF); }
+    static int keyX(uint32_t key) { return (int)(key & 0x3FFF); }
+
+    void createFeedbackTarget(int width, int height)
+    {
+        destroyFeedbackTarget();
+        feedbackWidth = width;
+        feedbackHeight = height;
+        glGenTextures(1, &feedbackColor);
+        glState.bindTexture(0, GL_TEXTURE_2D, feedbackColor);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glGenRenderbuffers(1, &feedbackDepth);
+        glBindRenderbuffer(GL_RENDERBUFFER, feedbackDepth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+        glGenFramebuffers(1, &feedbackFramebuffer);
+        glState.bindFramebuffer(feedbackFramebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, feedbackColor, 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, feedbackDepth);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "[VT] feedback framebuffer is not complete" << std::endl;
+        glState.bindFramebuffer(0);
+#ifndef __EMSCRIPTEN__
+        glGenBuffers(1, &readback);
+        glState.bindBuffer(GL_PIXEL_PACK_BUFFER, readback);
+        glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)width * height * 4, nullptr, GL_STREAM_READ);
+        glState.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+#endif
+    }
+
+    void destroyFeedbackTarget()
+    {
+        if (!feedbackFramebuffer)
+            return;
+        if (readbackFence)
+            glDeleteSync(readbackFence);
+        readbackFence = 0;
+        if (readback)
+        {
+            glState.forgetBuffer(readback);
+            glDeleteBuffers(1, &readback);
+        }
+        readback = 0;
+        glDeleteFramebuffers(1, &feedbackFramebuffer);
+        glDeleteRenderbuffers(1, &feedbackDepth);
+        glState.forgetTexture(feedbackColor);
+        glDeleteTextures(1, &feedbackColor);
+        feedbackFramebuffer = feedbackDepth = feedbackColor = 0;
+        feedbackWidth = feedbackHeight = 0;
+    }
+
+    // turns a finished readback into page requests
+    void collectFeedback()
+    {
+#ifndef __EMSCRIPTEN__
+        if (readbackFence)
+        {
+            GLenum status = glClientWaitSync(readbackFence, 0, 0);
+            if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+            {
+                glDeleteSync(readbackFence);
+                readbackFence = 0;
+                size_t bytes = (size_t)feedbackWidth * feedbackHeight * 4;
+                glState.bindBuffer(GL_PIXEL_PACK_BUFFER, readback);
+                const unsigned char *mapped = (const unsigned char *)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)bytes, GL_MAP_READ_BIT);
+                if (mapped)
+                {
+                    feedback.assign(mapped, mapped + bytes);
+                    feedbackReady = true;
+                }
+                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+                glState.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            }
+        }
+#endif
+        if (!feedbackReady)
+            return;
+        feedbackReady = false;
+
+        // r, g: low bits of the page x and y, b: their high nibbles,
+        // a: level + 1
+        std::vector<uint32_t> wanted;
+        for (size_t i = 0; i + 3 < feedback.size(); i += 4)
+        {
+            const unsigned char *p = &feedback[i];
+            if (p[3] == 0)
+                continue;
+            int level = std::min(p[3] - 1, file.levels() - 1);
+            int x = p[0] | (p[2] & 15) << 8, y = p[1] | (p[2] >> 4) << 8;
+            if (x < file.pagesX(level) && y < file.pagesY(level))
+                wanted.push_back(pageKey(level, x, y));
+        }
+        std::sort(wanted.begin(), wanted.end());
+        wanted.erase(std::unique(wanted.begin(), wanted.end()), wanted.end());
+        // coarse levels first, so fallbacks sharpen gradually
+        std::stable_sort(wanted.begin(), wanted.end(), [](uint32_t a, uint32_t b)
+                         { return keyLevel(a) > keyLevel(b); });
+
+        for (uint32_t key : wanted)
+        {
+            frameStats.vtPageRequests++;
+            // keep the page and the ancestors it falls back to warm
+            bool hit = true;
+            for (uint32_t ancestor = key;; ancestor = parentKey(ancestor))
+            {
+                auto found = resident.find(ancestor);
+                if (found != resident.end())
+                    slots[found->second].lastUsedFrame = frame;
+                else if (ancestor == key)
+                    hit = false;
+                if (keyLevel(ancestor) == file.levels() - 1)
+                    break;
+            }
+            if (hit)
+                frameStats.vtPageHits++;
+            else
+                request(key);
+        }
+    }
+
+    uint32_t parentKey(uint32_t key) const
+    {
+        return pageKey(keyLevel(key) + 1, keyX(key) / 2, keyY(key) / 2);
+    }
+
+    void request(uint32_t key)
+    {
+        if (pending.count(key) || (int)pending.size() >= MAX_PENDING)
+            return;
+        pending.insert(key);
+        pool.submit([this, key]
+                    {
+                        PageData page;
+                        page.key = key;
+                        page.ok = file.readPage(keyLevel(key), keyX(key), keyY(key), page.pixels, page.error);
+                        // MAX_PENDING is below the queue size, so this only
+                        // waits if the GL thread is far behind
+                        while (!decoded.push(std::move(page)))
+                            std::this_thread::yield(); });
+    }
+
+    // copies a page into a free or least recently used slot; -1 when every
+    // slot was used this frame
+    int upload(uint32_t key, const std::vector<unsigned char> &pixels)
+    {
+        if (resident.count(key))
+            return resident[key];
+        int victim = -1;
+        for (int i = 0; i < (int)slots.size(); i++)
+        {
+            const Slot &slot = slots[i];
+            if (!slot.used)
+            {
+                victim = i;
+                break;
+            }
+            if (!slot.pinned && slot.lastUsedFrame < frame && (victim < 0 || slot.lastUsedFrame < slots[victim].lastUsedFrame))
+                victim = i;
+        }
+        if (victim < 0)
+            return -1;
+
+        Slot &slot = slots[victim];
+        if (slot.used)
+            resident.erase(slot.key);
+        slot.key = key;
+        slot.used = true;
+        slot.lastUsedFrame = frame;
+        resident[key] = victim;
+
+        int size = file.slotSize();
+        glState.bindTexture(0, GL_TEXTURE_2D, cache);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, (victim % side) * size, (victim / side) * size, size, size, GL_RGBA, GL_UNSIGNED_BYTE,
+                        pixels.data());
+        dirty = true;
+        return victim;
+    }
+
+    // every page points at itself when resident, else at its parent's entry
+    void rebuildIndirection()
+    {
+        glState.bindTexture(0, GL_TEXTURE_2D, indirection);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        for (int level = file.levels() - 1; level >= 0; level--)
+        {
+            int pagesX = file.pagesX(level), pagesY = file.pagesY(level);
+            std::vector<uint32_t> &entries = table[level];
+            for (int y = 0; y < pagesY; y++)
+                for (int x = 0; x < pagesX; x++)
+                {
+                    uint32_t &entry = entries[y * pagesX + x];
+                    auto found = resident.find(pageKey(level, x, y));
+                    if (found != resident.end())
+                        entry = (uint32_t)(found->second % side) | (uint32_t)(found->second / side) << 8 | (uint32_t)level << 16 | 0xFF000000u;
+                    else if (level + 1 < file.levels())
+                        entry = table[level + 1][(y / 2) * file.pagesX(level + 1) + x / 2];
+                }
+            glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, pagesX, pagesY, GL_RGBA, GL_UNSIGNED_BYTE, entries.data());
+        }
+        dirty = false;
+    }
+};
+#endif